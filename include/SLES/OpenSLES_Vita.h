@@ -0,0 +1,200 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef OPENSL_ES_VITA_H_
+#define OPENSL_ES_VITA_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*---------------------------------------------------------------------------*/
+/* Vita audio player extensions                                              */
+/*---------------------------------------------------------------------------*/
+
+/** Mark an audio player for automatic release.
+ *  Once an auto-release player has played out all of its data (the buffer queue drained, or the
+ *  file reached end of stream) the engine stops it and destroys the object on its own, along with
+ *  its output mix track.  After playback has started, the application must not call Destroy on
+ *  an auto-release player, and must not use the player once it has finished.
+ */
+
+SLresult SLAPIENTRY slVitaSetAutoRelease(SLObjectItf player, SLboolean autoRelease);
+
+
+/*---------------------------------------------------------------------------*/
+/* Vita file streaming                                                       */
+/*---------------------------------------------------------------------------*/
+
+/** An audio player whose data source is a file URI decodes the file ahead of playback into
+ *  a ring of buffers, each of a number of stereo sample frames at the output rate.  The number
+ *  of buffers queued ahead starts at a minimum, doubles (up to a maximum) each time the decoder
+ *  falls behind, and shrinks by one after a while without falling behind.  Buffers are only
+ *  allocated as the ring reaches them, and freed when it shrinks.  If the minimum and maximum
+ *  are equal, the number of buffers is fixed.
+ *
+ *  A paused player decodes ahead too, so it can be prefetched before it plays.  Its prefetch
+ *  fill level is the part of the ring that is decoded, or all of it once the decoder reached the
+ *  end of file; the data is sufficient with the minimum number of buffers decoded, and underflows
+ *  with none, e.g. right after a seek.  A file played from memory is always fully prefetched.
+ *
+ *  The loop of Seek::SetLoop is played by the decoder, which goes on from the loop start right
+ *  after the sample frame before the loop end, in the same buffer, so the loop has no gap; a
+ *  file played from memory loops in place.  The buffers already decoded ahead when the loop is
+ *  set play as they are, and a player that is after the loop end plays on to the end of file,
+ *  then loops.
+ *
+ *  These engine options set the defaults for players of the engine: 1024 frames per buffer,
+ *  and from 2 to 16 buffers.  The frames per buffer are from 64 to 16384, the minimum is at least
+ *  2, and the maximum is at most 64.
+ */
+
+#define SL_VITA_ENGINEOPTION_STREAMFRAMES       ((SLuint32) 0x80000001)
+#define SL_VITA_ENGINEOPTION_STREAMMINBUFFERS   ((SLuint32) 0x80000002)
+#define SL_VITA_ENGINEOPTION_STREAMMAXBUFFERS   ((SLuint32) 0x80000003)
+
+/** Set the buffering of one audio player, before it is realized.  Returns
+ *  SL_RESULT_PRECONDITIONS_VIOLATED if the player is realized, and SL_RESULT_FEATURE_UNSUPPORTED
+ *  if its data source is not a file URI.
+ */
+
+SLresult SLAPIENTRY slVitaSetStreamBuffering(SLObjectItf player, SLuint32 frames,
+        SLuint32 minBuffers, SLuint32 maxBuffers);
+
+/** Besides uncompressed WAV, AIFF, W64 and RF64 files, a file URI can be Ogg Vorbis or FLAC,
+ *  provided the libsndfile the application links with was built with them.  These are decoded
+ *  on the streaming workers like any other file.  The audio decoder capabilities interface lists
+ *  the codecs of the files that can be played: SL_AUDIOCODEC_PCM, SL_AUDIOCODEC_VORBIS, which
+ *  has the ID of OpenSL ES 1.1, and SL_VITA_AUDIOCODEC_FLAC, which has none in OpenSL ES.
+ */
+
+#ifndef SL_AUDIOCODEC_VORBIS
+#define SL_AUDIOCODEC_VORBIS                    ((SLuint32) 0x00000009)
+#endif
+#define SL_VITA_AUDIOCODEC_FLAC                 ((SLuint32) 0x80000001)
+
+/** The players of an engine share the files they play as decoded assets, keyed by the path,
+ *  modification time and size of the file: the first player of a file loads the whole of it as
+ *  16-bit stereo at the output rate, and later players of the same file play that copy from
+ *  memory.  Assets no player uses are kept until their total size is over the budget of this
+ *  engine option, in bytes, and then the least recently used are freed first.  The default
+ *  budget is 4 MiB, and a budget of 0 disables the cache.  A file larger than a quarter of the
+ *  budget is streamed instead.
+ */
+
+#define SL_VITA_ENGINEOPTION_ASSETCACHEBYTES    ((SLuint32) 0x80000004)
+
+/** Called on a worker thread of the engine when a preload is done.  result is SL_RESULT_SUCCESS
+ *  if the asset is in the cache, SL_RESULT_BUFFER_INSUFFICIENT if it is too large to be cached,
+ *  or the error that realizing a player of the file would report.
+ */
+
+typedef void (SLAPIENTRY *slVitaPreloadCallback)(void *pContext, SLresult result);
+
+/** Load a file URI into the asset cache of a realized engine ahead of creating its players.
+ *  The callback, if any, is not called if the engine is destroyed before the preload starts.
+ *  Returns SL_RESULT_FEATURE_UNSUPPORTED if the cache is disabled.
+ */
+
+SLresult SLAPIENTRY slVitaPreloadAsset(SLEngineItf engine, const SLchar *pURI,
+        slVitaPreloadCallback callback, void *pContext);
+
+/*  An asynchronous Object::Realize of a player of a file URI, or a batched realize of it, loads,
+ *  maps or opens the file on a worker thread of the engine while the realize can still be
+ *  aborted, so several players open their files at once.  Object::AbortAsyncOperation or
+ *  Object::Destroy meanwhile waits only for the file operation under way, and the realize then
+ *  reports SL_RESULT_OPERATION_ABORTED.  A streamed file stays open after its player is
+ *  destroyed, so that the next player of the same file does not open it and parse its header
+ *  again; an engine keeps up to 4 such files open, and closes the least recently used first.
+ */
+
+
+/*---------------------------------------------------------------------------*/
+/* Vita audio player prototypes                                              */
+/*---------------------------------------------------------------------------*/
+
+/** A player prototype holds a validated audio player configuration, so that identical players
+ *  can be created from it without checking the data source, data sink and interfaces again.
+ *  A prototype does not occupy an object slot, but it keeps a reference to the output mix,
+ *  and must be destroyed before the output mix and the engine.
+ */
+
+typedef struct SLVitaPlayerPrototype_ * SLVitaPlayerPrototype;
+
+/** Check an audio player configuration as Engine::CreateAudioPlayer does, and keep it as a
+ *  prototype.  The data sink must be an output mix.
+ */
+
+SLresult SLAPIENTRY slVitaCreatePlayerPrototype(SLEngineItf engine,
+        SLVitaPlayerPrototype *pPrototype, SLDataSource *pAudioSrc, SLDataSink *pAudioSnk,
+        SLuint32 numInterfaces, const SLInterfaceID *pInterfaceIds,
+        const SLboolean *pInterfaceRequired);
+
+/** Create an audio player that is a copy of the prototype.  The new player is already in the
+ *  realized state.
+ */
+
+SLresult SLAPIENTRY slVitaCreateAudioPlayerFromPrototype(SLVitaPlayerPrototype prototype,
+        SLObjectItf *pPlayer);
+
+void SLAPIENTRY slVitaDestroyPlayerPrototype(SLVitaPlayerPrototype prototype);
+
+
+/*---------------------------------------------------------------------------*/
+/* Vita batched realize                                                      */
+/*---------------------------------------------------------------------------*/
+
+/** Called once when every object of a batch has been realized or has failed to realize.
+ *  pResults[i] is the result of realizing pObjects[i].  Both arrays are only valid during the
+ *  callback.
+ */
+
+typedef void (SLAPIENTRY *slVitaRealizeCallback)(void *pContext, SLuint32 numObjects,
+        const SLObjectItf *pObjects, const SLresult *pResults);
+
+/** Realize several objects of one engine concurrently on the engine's worker threads.
+ *  If async is SL_BOOLEAN_FALSE, the call returns when all are done and stores the result of
+ *  each object in pResults, and callback is not used.  Otherwise the call returns at once, pResults is not used, and the
+ *  results are reported to the callback, if any.  The objects do not report
+ *  SL_OBJECT_EVENT_ASYNC_TERMINATION to their own callbacks.  An object that is not in the
+ *  unrealized state gets SL_RESULT_PRECONDITIONS_VIOLATED without affecting the others, and an
+ *  object whose realize is aborted gets SL_RESULT_OPERATION_ABORTED.
+ */
+
+SLresult SLAPIENTRY slVitaRealizeObjects(SLEngineItf engine, SLuint32 numObjects,
+        const SLObjectItf *pObjects, SLboolean async, SLresult *pResults,
+        slVitaRealizeCallback callback, void *pContext);
+
+
+/*---------------------------------------------------------------------------*/
+/* Vita lock profile                                                         */
+/*---------------------------------------------------------------------------*/
+
+/** Log the lock contention profile: for each call site that takes an object lock, the number
+ *  of acquisitions, how many of those were contended, and the total and maximum time spent
+ *  waiting for and holding the lock, call sites with the most waiting first.  If reset is
+ *  SL_BOOLEAN_TRUE, the counts start again from zero.  The profile is also logged when an engine
+ *  is destroyed.  Returns SL_RESULT_FEATURE_UNSUPPORTED unless the library was built with
+ *  LOCK_PROFILE=1.
+ */
+
+SLresult SLAPIENTRY slVitaDumpLockProfile(SLboolean reset);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* OPENSL_ES_VITA_H_ */
@@ -41,6 +41,7 @@ LOCAL_SRC_FILES:=                     \
         devices.c                     \
         trace.c                       \
         locks.c                       \
+        handlers.c                    \
         sles.c                        \
         sllog.c                       \
         android_AudioPlayer.cpp       \
@@ -55,12 +55,14 @@ SLresult CAudioPlayer_Resume(void *self, SLboolean async)
 void CAudioPlayer_Destroy(void *self)
 {
     CAudioPlayer *this = (CAudioPlayer *) self;
-    freeDataLocatorFormat(&this->mDataSource);
-    freeDataLocatorFormat(&this->mDataSink);
-    IBufferQueue_Destroy(&this->mBufferQueue);
 #ifdef USE_SNDFILE
+    // stop the streaming worker before freeing the buffer queue it enqueues to, and close the
+    // file before freeing the path that its handle is kept under
     SndFile_Destroy(this);
 #endif
+    freeDataLocatorFormat(&this->mDataSource);
+    freeDataLocatorFormat(&this->mDataSink);
+    IBufferQueue_Destroy(&this->mBufferQueue);
 #ifdef ANDROID
     android_audioPlayer_destroy(this);
 #endif
@@ -83,6 +85,7 @@ bool CAudioPlayer_PreDestroy(void *self)
     assert(audioPlayer == this);
     // Request the mixer thread to unlink this audio player's track
     this->mDestroyRequested = true;
+    audioPlayerTrackRequest(this);
     while (this->mDestroyRequested) {
         object_cond_wait(self);
     }
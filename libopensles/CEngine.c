@@ -29,8 +29,11 @@ SLresult CEngine_Realize(void *self, SLboolean async)
     SLresult result = err_to_result(err);
     if (SL_RESULT_SUCCESS != result)
         return result;
-    // initialize the thread pool for asynchronous operations
-    result = ThreadPool_init(&this->mEngine.mThreadPool, 0, 0);
+    // initialize the thread pool for asynchronous operations, keeping one worker for streaming
+    // work so that it never waits behind a slow Realize; each object has at most one streaming
+    // closure pending, so with room for one per object the mixer never finds the queue full
+    static const unsigned reserved[THREADPOOL_PRIORITIES] = {1, 0};
+    result = ThreadPool_init(&this->mEngine.mThreadPool, MAX_INSTANCE, 0, reserved);
     if (SL_RESULT_SUCCESS != result) {
         this->mEngine.mShutdown = SL_BOOLEAN_TRUE;
         (void) pthread_join(this->mSyncThread, (void **) NULL);
@@ -112,6 +115,10 @@ void CEngine_Destroy(void *self)
     SDL_close();
 #endif
 
+#ifdef USE_LOCK_PROFILE
+    lock_profile_dump(SL_BOOLEAN_FALSE);
+#endif
+
 }
 
 
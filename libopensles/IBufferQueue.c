@@ -21,6 +21,7 @@
 
 /** Determine the state of the audio player or audio recorder associated with a buffer queue.
  *  Note that PLAYSTATE and RECORDSTATE values are equivalent (where PLAYING == RECORDING).
+ *  The state is in the transport lock domain, so it is only peeked at.
  */
 
 static SLuint32 getAssociatedState(IBufferQueue *this)
@@ -28,10 +29,10 @@ static SLuint32 getAssociatedState(IBufferQueue *this)
     SLuint32 state;
     switch (InterfaceToObjectID(this)) {
     case SL_OBJECTID_AUDIOPLAYER:
-        state = ((CAudioPlayer *) this->mThis)->mPlay.mState;
+        state = field_peek(((CAudioPlayer *) this->mThis)->mPlay.mState);
         break;
     case SL_OBJECTID_AUDIORECORDER:
-        state = ((CAudioRecorder *) this->mThis)->mRecord.mState;
+        state = field_peek(((CAudioRecorder *) this->mThis)->mRecord.mState);
         break;
     default:
         // unreachable, but just in case we will assume it is stopped
@@ -65,7 +66,9 @@ SLresult IBufferQueue_Enqueue(SLBufferQueueItf self, const void *pBuffer, SLuint
         if (newRear == this->mFront) {
             result = SL_RESULT_BUFFER_INSUFFICIENT;
         } else {
-            int num_cycles = (&_opensles_user_freq!=NULL?_opensles_user_freq:44100) * 1000 / this->samplerate;
+            // a URI player sets the format at Realize, so be sure not to divide by zero
+            int num_cycles = 0 == this->samplerate ? 1 :
+                (&_opensles_user_freq!=NULL?_opensles_user_freq:44100) * 1000 / this->samplerate;
             int multiplier = 1;
             if (this->channels == 1)
                 multiplier *= 2;
@@ -129,13 +132,20 @@ SLresult IBufferQueue_Enqueue(SLBufferQueueItf self, const void *pBuffer, SLuint
             oldRear->mBuffer = pBuffer;
             oldRear->mSize = size * num_cycles * multiplier;
             this->mRear = newRear;
-            ++this->mState.count;
+            // the transport domain peeks at the count
+            field_poke(this->mState.count, this->mState.count + 1);
             result = SL_RESULT_SUCCESS;
         }
-        // set enqueue attribute if state is PLAYING and the first buffer is enqueued
-        interface_unlock_exclusive_attributes(this, ((SL_RESULT_SUCCESS == result) &&
-            (1 == this->mState.count) && (SL_PLAYSTATE_PLAYING == getAssociatedState(this))) ?
-            ATTR_ENQUEUE : ATTR_NONE);
+        // set enqueue attribute if state is PLAYING and the first buffer is enqueued; the state
+        // is in the transport domain, so publish the count first, see ATTR_ENQUEUE in locks.c
+        unsigned attr = ATTR_NONE;
+        if ((SL_RESULT_SUCCESS == result) && (1 == this->mState.count)) {
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            if (SL_PLAYSTATE_PLAYING == getAssociatedState(this)) {
+                attr = ATTR_ENQUEUE;
+            }
+        }
+        interface_unlock_exclusive_attributes(this, attr);
     }
     SL_LEAVE_INTERFACE
 }
@@ -167,10 +177,24 @@ SLresult IBufferQueue_Clear(SLBufferQueueItf self)
 #ifdef USE_OUTPUTMIXEXT
     // mixer might be reading from the front buffer, so tread carefully here
     // NTH asynchronous cancel instead of blocking until mixer acknowledges
-    this->mClearRequested = SL_BOOLEAN_TRUE;
-    do {
-        interface_cond_wait(this);
-    } while (this->mClearRequested);
+    if ((SL_OBJECTID_AUDIOPLAYER == InterfaceToObjectID(this)) &&
+            (NULL == ((CAudioPlayer *) this->mThis)->mTrack)) {
+        // the mixer gave up the track, e.g. to a pending Destroy, so it will not acknowledge;
+        // it unlinks the track with this domain locked, so it is not reading either
+        this->mFront = &this->mArray[0];
+        this->mRear = &this->mArray[0];
+        field_poke(this->mState.count, 0);
+        this->mState.playIndex = 0;
+        this->mDiscardRequested = SL_BOOLEAN_FALSE;
+    } else {
+        this->mClearRequested = SL_BOOLEAN_TRUE;
+        if (SL_OBJECTID_AUDIOPLAYER == InterfaceToObjectID(this)) {
+            audioPlayerTrackRequest((CAudioPlayer *) this->mThis);
+        }
+        do {
+            interface_cond_wait(this);
+        } while (this->mClearRequested);
+    }
 #endif
 
     interface_unlock_exclusive(this);
@@ -245,6 +269,8 @@ void IBufferQueue_init(void *self)
     this->mContext = NULL;
     this->mNumBuffers = 0;
     this->mClearRequested = SL_BOOLEAN_FALSE;
+    this->mDiscardRequested = SL_BOOLEAN_FALSE;
+    this->mDiscardIndex = 0;
     this->mArray = NULL;
     this->mFront = NULL;
     this->mRear = NULL;
@@ -94,11 +94,167 @@ static SLresult IEngine_CreateVibraDevice(SLEngineItf self, SLObjectItf *pDevice
     SL_LEAVE_INTERFACE
 }
 
-#ifdef SYBERIA
-IObject *players[20] = {};
-int idx = 0;
+#ifdef USE_OUTPUTMIXEXT
+
+/** \brief Destroy the auto-release audio players that the mixer has stopped after they played out
+ *  all of their data.  Called with the engine unlocked, by the sync thread and by
+ *  Engine::CreateAudioPlayer, so that a new player can reuse the slot of a finished one.
+ */
+
+void IEngine_ReleaseFinishedPlayers(IEngine *this)
+{
+    // Claim the finished players while holding the engine lock, so that exactly one thread
+    // destroys each of them, and none of them can be freed while we are examining it.
+    // The lock order is object then engine, so peek at the player fields rather than lock them.
+    interface_lock_exclusive(this);
+    unsigned finishedMask = 0;
+    unsigned instanceMask = this->mInstanceMask;
+    while (instanceMask) {
+        unsigned i = ctz(instanceMask);
+        assert(MAX_INSTANCE > i);
+        instanceMask &= ~(1 << i);
+        IObject *instance = this->mInstances[i];
+        if ((NULL == instance) || (SL_OBJECTID_AUDIOPLAYER != IObjectToObjectID(instance))) {
+            continue;
+        }
+        CAudioPlayer *audioPlayer = (CAudioPlayer *) instance;
+        // the mixer sets mReleasePending before it pokes the stopped state
+        if ((SL_PLAYSTATE_STOPPED == field_peek(audioPlayer->mPlay.mState)) &&
+                audioPlayer->mReleasePending) {
+            audioPlayer->mReleasePending = SL_BOOLEAN_FALSE;
+            finishedMask |= 1 << i;
+        }
+    }
+    IObject *finished[MAX_INSTANCE];
+    unsigned mask = finishedMask;
+    while (mask) {
+        unsigned i = ctz(mask);
+        mask &= ~(1 << i);
+        finished[i] = this->mInstances[i];
+    }
+    interface_unlock_exclusive(this);
+    while (finishedMask) {
+        unsigned i = ctz(finishedMask);
+        finishedMask &= ~(1 << i);
+        IObject_Destroy(&finished[i]->mItf);
+    }
+}
+
 #endif
 
+/** \brief Check the data source and sink of a newly constructed audio player, make local copies
+ *  of them, and resolve everything that does not depend on the output mix track.
+ *  Shared by Engine::CreateAudioPlayer and by player prototypes.
+ */
+
+SLresult audioPlayerConfigure(CAudioPlayer *this, SLDataSource *pAudioSrc,
+    SLDataSink *pAudioSnk, SLuint32 numInterfaces, const SLInterfaceID *pInterfaceIds,
+    const SLboolean *pInterfaceRequired)
+{
+    SLresult result;
+
+    // Initialize private fields not associated with an interface
+    this->mMuteMask = 0;
+    this->mSoloMask = 0;
+    // Will be set soon for PCM buffer queues, or later by platform-specific code
+    // during Realize or Prefetch
+    this->mNumChannels = 0;
+    this->mSampleRateMilliHz = 0;
+
+    // Check the source and sink parameters against generic constraints,
+    // and make a local copy of all parameters in case other application threads
+    // change memory concurrently.
+
+    result = checkDataSource(pAudioSrc, &this->mDataSource);
+    if (SL_RESULT_SUCCESS != result) {
+        return result;
+    }
+
+    result = checkDataSink(pAudioSnk, &this->mDataSink, SL_OBJECTID_AUDIOPLAYER);
+    if (SL_RESULT_SUCCESS != result) {
+        return result;
+    }
+
+    // It would be unsafe to ever refer to the application pointers again
+    pAudioSrc = NULL;
+    pAudioSnk = NULL;
+
+    // Check that the requested interfaces are compatible with the data source
+    result = checkSourceFormatVsInterfacesCompatibility(&this->mDataSource,
+            numInterfaces, pInterfaceIds, pInterfaceRequired);
+    if (SL_RESULT_SUCCESS != result) {
+        return result;
+    }
+
+    // copy the buffer queue count from source locator to the buffer queue interface
+    // we have already range-checked the value down to a smaller width
+
+    switch (this->mDataSource.mLocator.mLocatorType) {
+    case SL_DATALOCATOR_BUFFERQUEUE:
+    case SL_DATALOCATOR_ANDROIDSIMPLEBUFFERQUEUE:
+        this->mBufferQueue.samplerate = this->mDataSource.mFormat.mPCM.samplesPerSec;
+        this->mBufferQueue.channels = this->mDataSource.mFormat.mPCM.numChannels;
+        this->mBufferQueue.bps = this->mDataSource.mFormat.mPCM.bitsPerSample;
+        this->mDataSource.mFormat.mPCM.samplesPerSec = (&_opensles_user_freq!=NULL?_opensles_user_freq:44100) * 1000;
+        this->mDataSource.mFormat.mPCM.numChannels = 2;
+        this->mDataSource.mFormat.mPCM.bitsPerSample = 16;
+        this->mBufferQueue.mNumBuffers =
+                (SLuint16) this->mDataSource.mLocator.mBufferQueue.numBuffers;
+        assert(SL_DATAFORMAT_PCM == this->mDataSource.mFormat.mFormatType);
+        this->mNumChannels = this->mDataSource.mFormat.mPCM.numChannels;
+        this->mSampleRateMilliHz = this->mDataSource.mFormat.mPCM.samplesPerSec;
+        break;
+    default:
+        this->mBufferQueue.mNumBuffers = 0;
+        break;
+    }
+
+    // check the audio source and sink parameters against platform support
+#ifdef ANDROID
+    result = android_audioPlayer_checkSourceSink(this);
+    if (SL_RESULT_SUCCESS != result) {
+        return result;
+    }
+#endif
+
+#ifdef USE_SNDFILE
+    result = SndFile_checkAudioPlayerSourceSink(this);
+    if (SL_RESULT_SUCCESS != result) {
+        return result;
+    }
+#endif
+
+    // FIXME move to dedicated function
+    // Allocate memory for buffer queue
+
+    //if (0 != this->mBufferQueue.mNumBuffers) {
+        // inline allocation of circular mArray, up to a typical max
+        if (BUFFER_HEADER_TYPICAL >= this->mBufferQueue.mNumBuffers) {
+            this->mBufferQueue.mArray = this->mBufferQueue.mTypical;
+        } else {
+            // Avoid possible integer overflow during multiplication; this arbitrary
+            // maximum is big enough to not interfere with real applications, but
+            // small enough to not overflow.
+            if (this->mBufferQueue.mNumBuffers >= 256) {
+                return SL_RESULT_MEMORY_FAILURE;
+            }
+            this->mBufferQueue.mArray = (BufferHeader *) malloc((this->mBufferQueue.
+                mNumBuffers + 1) * sizeof(BufferHeader));
+            if (NULL == this->mBufferQueue.mArray) {
+                return SL_RESULT_MEMORY_FAILURE;
+            }
+        }
+        this->mBufferQueue.mFront = this->mBufferQueue.mArray;
+        this->mBufferQueue.mRear = this->mBufferQueue.mArray;
+        //}
+
+        // used to store the data source of our audio player
+        this->mDynamicSource.mDataSource = &this->mDataSource.u.mSource;
+
+    return SL_RESULT_SUCCESS;
+}
+
+
 static SLresult IEngine_CreateAudioPlayer(SLEngineItf self, SLObjectItf *pPlayer,
     SLDataSource *pAudioSrc, SLDataSink *pAudioSnk, SLuint32 numInterfaces,
     const SLInterfaceID *pInterfaceIds, const SLboolean *pInterfaceRequired)
@@ -108,22 +264,9 @@ static SLresult IEngine_CreateAudioPlayer(SLEngineItf self, SLObjectItf *pPlayer
     if (NULL == pPlayer) {
        result = SL_RESULT_PARAMETER_INVALID;
     } else {
-#ifdef SYBERIA
-		if (players[idx]) {
-			SLPlayItf playerPlay;
-			SLuint32 playerState;
-			SLObjectItf p = players[idx];
-			SLresult res = (*p)->GetInterface(p, SL_IID_PLAY, &playerPlay);
-			if (res == SL_RESULT_SUCCESS) {
-				(*playerPlay)->GetPlayState(playerPlay, &playerState);
-				if (playerState == SL_PLAYSTATE_STOPPED) {
-					IObject_Destroy(players[idx]);
-				}
-			} else {
-				// This seems to not be an AudioPlayer so we just free the entry
-				players[idx] = NULL;
-			}
-		}
+#ifdef USE_OUTPUTMIXEXT
+        // recycle finished one-shot players before looking for a free object slot
+        IEngine_ReleaseFinishedPlayers((IEngine *) self);
 #endif
         *pPlayer = NULL;
         unsigned exposedMask;
@@ -140,77 +283,12 @@ static SLresult IEngine_CreateAudioPlayer(SLEngineItf self, SLObjectItf *pPlayer
 
                 do {
 
-                    // Initialize private fields not associated with an interface
-                    this->mMuteMask = 0;
-                    this->mSoloMask = 0;
-                    // Will be set soon for PCM buffer queues, or later by platform-specific code
-                    // during Realize or Prefetch
-                    this->mNumChannels = 0;
-                    this->mSampleRateMilliHz = 0;
-
-                    // Check the source and sink parameters against generic constraints,
-                    // and make a local copy of all parameters in case other application threads
-                    // change memory concurrently.
-
-                    result = checkDataSource(pAudioSrc, &this->mDataSource);
+                    result = audioPlayerConfigure(this, pAudioSrc, pAudioSnk, numInterfaces,
+                        pInterfaceIds, pInterfaceRequired);
                     if (SL_RESULT_SUCCESS != result) {
                         break;
                     }
 
-                    result = checkDataSink(pAudioSnk, &this->mDataSink, SL_OBJECTID_AUDIOPLAYER);
-                    if (SL_RESULT_SUCCESS != result) {
-                        break;
-                    }
-
-                    // It would be unsafe to ever refer to the application pointers again
-                    pAudioSrc = NULL;
-                    pAudioSnk = NULL;
-
-                    // Check that the requested interfaces are compatible with the data source
-                    result = checkSourceFormatVsInterfacesCompatibility(&this->mDataSource,
-                            numInterfaces, pInterfaceIds, pInterfaceRequired);
-                    if (SL_RESULT_SUCCESS != result) {
-                        break;
-                    }
-                    
-                    // copy the buffer queue count from source locator to the buffer queue interface
-                    // we have already range-checked the value down to a smaller width
-
-                    switch (this->mDataSource.mLocator.mLocatorType) {
-                    case SL_DATALOCATOR_BUFFERQUEUE:
-                    case SL_DATALOCATOR_ANDROIDSIMPLEBUFFERQUEUE:
-                        this->mBufferQueue.samplerate = this->mDataSource.mFormat.mPCM.samplesPerSec;
-                        this->mBufferQueue.channels = this->mDataSource.mFormat.mPCM.numChannels;
-                        this->mBufferQueue.bps = this->mDataSource.mFormat.mPCM.bitsPerSample;
-                        this->mDataSource.mFormat.mPCM.samplesPerSec = (&_opensles_user_freq!=NULL?_opensles_user_freq:44100) * 1000;
-                        this->mDataSource.mFormat.mPCM.numChannels = 2;
-                        this->mDataSource.mFormat.mPCM.bitsPerSample = 16;
-                        this->mBufferQueue.mNumBuffers =
-                                (SLuint16) this->mDataSource.mLocator.mBufferQueue.numBuffers;
-                        assert(SL_DATAFORMAT_PCM == this->mDataSource.mFormat.mFormatType);
-                        this->mNumChannels = this->mDataSource.mFormat.mPCM.numChannels;
-                        this->mSampleRateMilliHz = this->mDataSource.mFormat.mPCM.samplesPerSec;
-                        break;
-                    default:
-                        this->mBufferQueue.mNumBuffers = 0;
-                        break;
-                    }
-
-                    // check the audio source and sink parameters against platform support
-#ifdef ANDROID
-                    result = android_audioPlayer_checkSourceSink(this);
-                    if (SL_RESULT_SUCCESS != result) {
-                        break;
-                    }
-#endif
-
-#ifdef USE_SNDFILE
-                    result = SndFile_checkAudioPlayerSourceSink(this);
-                    if (SL_RESULT_SUCCESS != result) {
-                        break;
-                    }
-#endif
-
 #ifdef USE_OUTPUTMIXEXT
                     result = IOutputMixExt_checkAudioPlayerSourceSink(this);
                     if (SL_RESULT_SUCCESS != result) {
@@ -218,35 +296,6 @@ static SLresult IEngine_CreateAudioPlayer(SLEngineItf self, SLObjectItf *pPlayer
                     }
 #endif
 
-                    // FIXME move to dedicated function
-                    // Allocate memory for buffer queue
-
-                    //if (0 != this->mBufferQueue.mNumBuffers) {
-                        // inline allocation of circular mArray, up to a typical max
-                        if (BUFFER_HEADER_TYPICAL >= this->mBufferQueue.mNumBuffers) {
-                            this->mBufferQueue.mArray = this->mBufferQueue.mTypical;
-                        } else {
-                            // Avoid possible integer overflow during multiplication; this arbitrary
-                            // maximum is big enough to not interfere with real applications, but
-                            // small enough to not overflow.
-                            if (this->mBufferQueue.mNumBuffers >= 256) {
-                                result = SL_RESULT_MEMORY_FAILURE;
-                                break;
-                            }
-                            this->mBufferQueue.mArray = (BufferHeader *) malloc((this->mBufferQueue.
-                                mNumBuffers + 1) * sizeof(BufferHeader));
-                            if (NULL == this->mBufferQueue.mArray) {
-                                result = SL_RESULT_MEMORY_FAILURE;
-                                break;
-                            }
-                        }
-                        this->mBufferQueue.mFront = this->mBufferQueue.mArray;
-                        this->mBufferQueue.mRear = this->mBufferQueue.mArray;
-                        //}
-
-                        // used to store the data source of our audio player
-                        this->mDynamicSource.mDataSource = &this->mDataSource.u.mSource;
-
                         // platform-specific initialization
 #ifdef ANDROID
                         android_audioPlayer_create(this);
@@ -260,10 +309,6 @@ static SLresult IEngine_CreateAudioPlayer(SLEngineItf self, SLObjectItf *pPlayer
                     IObject_Publish(&this->mObject);
                     // return the new audio player object
                     *pPlayer = &this->mObject.mItf;
-#ifdef SYBERIA
-					players[idx] = &this->mObject.mItf;
-					idx = (idx + 1) % 20;
-#endif
                 }
 
             }
@@ -794,8 +839,21 @@ void IEngine_init(void *self)
     }
     this->mShutdown = SL_BOOLEAN_FALSE;
     this->mShutdownAck = SL_BOOLEAN_FALSE;
+    this->mSyncInstance = NULL;
+#ifdef USE_SNDFILE
+    SndFileCache_init(&this->mSndFileCache);
+#endif
 #if defined(ANDROID) && !defined(USE_BACKPORT)
     this->mEqNumPresets = 0;
     this->mEqPresetNames = NULL;
 #endif
 }
+
+void IEngine_deinit(void *self)
+{
+#ifdef USE_SNDFILE
+    IEngine *this = (IEngine *) self;
+    // CEngine_Destroy has stopped the thread pool, so no preload is running
+    SndFileCache_deinit(&this->mSndFileCache);
+#endif
+}
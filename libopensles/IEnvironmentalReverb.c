@@ -684,10 +684,12 @@ static SLresult IEnvironmentalReverb_GetEnvironmentalReverbProperties(
         result = SL_RESULT_PARAMETER_INVALID;
     } else {
         IEnvironmentalReverb *this = (IEnvironmentalReverb *) self;
-        interface_lock_shared(this);
 #if !defined(ANDROID) || defined(USE_BACKPORT)
+        interface_lock_shared(this);
         result = SL_RESULT_SUCCESS;
 #else
+        // the cached properties are refreshed, which needs the exclusive lock
+        interface_lock_exclusive(this);
         if (NO_ENVREVERB(this)) {
             result = SL_RESULT_CONTROL_LOST;
         } else {
@@ -698,7 +700,11 @@ static SLresult IEnvironmentalReverb_GetEnvironmentalReverbProperties(
 #endif
         *pProperties = this->mProperties;
 
+#if !defined(ANDROID) || defined(USE_BACKPORT)
         interface_unlock_shared(this);
+#else
+        interface_unlock_exclusive(this);
+#endif
     }
 
     SL_LEAVE_INTERFACE
@@ -19,14 +19,13 @@
 #include "sles_allinclusive.h"
 
 
-// Called by a worker thread to handle an asynchronous Object.Realize.
-// Parameter self is the Object.
+// Run the realize hook of an object whose asynchronous Realize was queued, and update its state.
+// Called by a worker thread with the mutex locked, and returns with the mutex locked.
 
-static void HandleRealize(void *self, int unused)
+SLresult IObject_RealizeQueued(IObject *this)
 {
 
     // validate input parameters
-    IObject *this = (IObject *) self;
     assert(NULL != this);
     const ClassTable *class__ = this->mClass;
     assert(NULL != class__);
@@ -35,11 +34,30 @@ static void HandleRealize(void *self, int unused)
     SLuint8 state;
 
     // check object state
-    object_lock_exclusive(this);
     state = this->mState;
     switch (state) {
 
     case SL_OBJECT_STATE_REALIZING_1:   // normal case
+#ifdef USE_SNDFILE
+        // The file of an audio player is opened while the Realize can still be aborted, so
+        // that Abort and Destroy do not wait for the rest of it
+        if (SL_OBJECTID_AUDIOPLAYER == class__->mObjectID) {
+            object_unlock_exclusive(this);
+            result = SndFile_Open((CAudioPlayer *) this);
+            object_lock_exclusive(this);
+            if (SL_OBJECT_STATE_REALIZING_1A == this->mState) {
+                SndFile_Close((CAudioPlayer *) this);
+                result = SL_RESULT_OPERATION_ABORTED;
+                state = SL_OBJECT_STATE_UNREALIZED;
+                break;
+            }
+            assert(SL_OBJECT_STATE_REALIZING_1 == this->mState);
+            if (SL_RESULT_SUCCESS != result) {
+                state = SL_OBJECT_STATE_UNREALIZED;
+                break;
+            }
+        }
+#endif
         if (NULL != realize) {
             this->mState = SL_OBJECT_STATE_REALIZING_2;
             object_unlock_exclusive(this);
@@ -69,6 +87,21 @@ static void HandleRealize(void *self, int unused)
 
     // mutex is locked, update state
     this->mState = state;
+    return result;
+}
+
+
+// Called by a worker thread to handle an asynchronous Object.Realize.
+// Parameter self is the Object.
+
+static void HandleRealize(void *self, int unused)
+{
+    IObject *this = (IObject *) self;
+    assert(NULL != this);
+
+    object_lock_exclusive(this);
+    SLresult result = IObject_RealizeQueued(this);
+    SLuint8 state = this->mState;
 
     // Make a copy of these, so we can call the callback with mutex unlocked
     slObjectCallback callback = this->mCallback;
@@ -498,23 +531,11 @@ static void IObject_AbortAsyncOperation(SLObjectItf self)
     SL_LEAVE_INTERFACE_VOID
 }
 
-#ifdef SYBERIA
-extern IObject *players[20];
-#endif
-
 void IObject_Destroy(SLObjectItf self)
 {
     SL_ENTER_INTERFACE_VOID
 
     IObject *this = (IObject *) self;
-#ifdef SYBERIA
-	for (int i = 0; i < 20; i++) {
-		if (players[i] == self) {
-			players[i] = NULL;
-			break;
-		}
-	}
-#endif
     // mutex is unlocked
     Abort_internal(this);
     // mutex is locked
@@ -541,6 +562,10 @@ void IObject_Destroy(SLObjectItf self)
     // avoid a recursive lock on the engine when destroying the engine itself
     if (thisEngine->mThis != this) {
         interface_lock_exclusive(thisEngine);
+        // the sync thread may be updating us without our lock, so let it finish
+        while (thisEngine->mSyncInstance == this) {
+            interface_cond_wait(thisEngine);
+        }
     }
     // An unpublished object has a slot reserved, but the ID hasn't been chosen yet
     assert(0 < thisEngine->mInstanceCount);
@@ -741,16 +766,7 @@ void IObject_init(void *self)
     this->mPreemptable = SL_BOOLEAN_FALSE;
 #endif
     this->mStrongRefCount = 0;
-    int ok;
-    ok = pthread_mutex_init(&this->mMutex, (const pthread_mutexattr_t *) NULL);
-    assert(0 == ok);
-#ifdef USE_DEBUG
-    memset(&this->mOwner, 0, sizeof(pthread_t));
-    this->mFile = NULL;
-    this->mLine = 0;
-#endif
-    ok = pthread_cond_init(&this->mCond, (const pthread_condattr_t *) NULL);
-    assert(0 == ok);
+    object_init_locks(this);
 }
 
 
@@ -760,16 +776,9 @@ void IObject_deinit(void *self)
 {
     IObject *this = (IObject *) self;
 #ifdef USE_DEBUG
-    assert(pthread_equal(pthread_self(), this->mOwner));
+    assert(pthread_equal(pthread_self(), this->mDomains[LOCK_DOMAIN_OBJECT].mOwner));
 #endif
-    int ok;
-    ok = pthread_cond_destroy(&this->mCond);
-    assert(0 == ok);
-    // equivalent to object_unlock_exclusive, but without the rigmarole
-    ok = pthread_mutex_unlock(&this->mMutex);
-    assert(0 == ok);
-    ok = pthread_mutex_destroy(&this->mMutex);
-    assert(0 == ok);
+    object_deinit_locks(this);
     // redundant: this->mState = SL_OBJECT_STATE_UNREALIZED;
 }
 
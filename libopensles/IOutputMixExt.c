@@ -40,31 +40,81 @@ typedef enum {
 } Summary;
 
 
-/** \brief Check whether a track has any data for us to read */
+/** \brief Sample frames a playing track may mix without locking its audio player; bounds how far
+ *  the position of the audio player lags behind the mix
+ */
+
+#define FRAMES_MIXED_MAX 1024
+
 
-static SLboolean track_check(Track *track)
+/** \brief Unlink track i from its audio player, which is locked by the caller */
+
+static void track_unlink(IOutputMixExt *this, unsigned i, CAudioPlayer *audioPlayer)
 {
-    assert(NULL != track);
+    unsigned mask = 1 << i;
+    this->mTracks[i].mAudioPlayer = NULL;
+    assert(this->mActiveMask & mask);
+    this->mActiveMask &= ~mask;
+    // audioPlayerGainUpdate looks up the track without the locks held here
+    __atomic_store_n(&audioPlayer->mTrack, NULL, __ATOMIC_RELEASE);
+}
+
+
+/** \brief Set the play state of the audio player of track i, which is locked by the caller */
+
+static void track_state(IOutputMixExt *this, unsigned i, CAudioPlayer *audioPlayer,
+    SLuint32 state)
+{
+    field_poke(audioPlayer->mPlay.mState, state);
+    __atomic_store_n(&this->mStates[i], state, __ATOMIC_RELEASE);
+}
+
+
+/** \brief Check whether track i has any data for us to read */
+
+static SLboolean track_check(IOutputMixExt *this, unsigned i)
+{
+    assert(MAX_TRACK > i);
+    Track *track = &this->mTracks[i];
     SLboolean trackHasData = SL_BOOLEAN_FALSE;
+    unsigned mask = 1 << i;
+
+    // A track that is playing from the middle of a buffer needs nothing from its audio player:
+    // the play state and gains are pushed here when they change, and a request raises its bit
+    // in mRequestMask, so there is nothing to lock until the buffer runs out
+    if (SL_PLAYSTATE_PLAYING == __atomic_load_n(&this->mStates[i], __ATOMIC_ACQUIRE) &&
+            0 < this->mAvails[i] && FRAMES_MIXED_MAX > this->mFramesMixed[i] &&
+            !(__atomic_load_n(&this->mRequestMask, __ATOMIC_ACQUIRE) & mask)) {
+        return SL_BOOLEAN_TRUE;
+    }
 
     CAudioPlayer *audioPlayer = track->mAudioPlayer;
     if (NULL != audioPlayer) {
 
         // track is initialized
 
-        // FIXME This lock could block and result in stuttering;
+        // FIXME These locks could block and result in stuttering;
         // a trylock with retry or lockless solution would be ideal
-        object_lock_exclusive(&audioPlayer->mObject);
+        // The object domain guards the destroy request, the transport domain the play state and
+        // position, and the buffer queue domain the queue
+        IObject *thisAP = &audioPlayer->mObject;
+        object_lock_exclusive(thisAP);
+        domain_lock_exclusive(thisAP, LOCK_DOMAIN_TRANSPORT);
+        domain_lock_exclusive(thisAP, LOCK_DOMAIN_BUFFERQUEUE);
         assert(audioPlayer->mTrack == track);
+        // requests are raised with the domain of the request locked, so any request whose bit
+        // is cleared here is seen below
+        __atomic_fetch_and(&this->mRequestMask, ~mask, __ATOMIC_ACQ_REL);
 
-        SLuint32 framesMixed = track->mFramesMixed;
+        SLuint32 framesMixed = this->mFramesMixed[i];
         if (0 != framesMixed) {
-            track->mFramesMixed = 0;
+            this->mFramesMixed[i] = 0;
             audioPlayer->mPlay.mFramesSinceLastSeek += framesMixed;
             audioPlayer->mPlay.mFramesSincePositionUpdate += framesMixed;
         }
 
-        SLboolean doBroadcast = SL_BOOLEAN_FALSE;
+        // bit-mask of the domains whose waiters we need to wake up
+        unsigned doBroadcast = 0;
         const BufferHeader *oldFront;
 
         if (audioPlayer->mBufferQueue.mClearRequested) {
@@ -72,34 +122,48 @@ static SLboolean track_check(Track *track)
             // will block synchronously until mixer acknowledges the Clear request
             audioPlayer->mBufferQueue.mFront = &audioPlayer->mBufferQueue.mArray[0];
             audioPlayer->mBufferQueue.mRear = &audioPlayer->mBufferQueue.mArray[0];
-            audioPlayer->mBufferQueue.mState.count = 0;
+            field_poke(audioPlayer->mBufferQueue.mState.count, 0);
             audioPlayer->mBufferQueue.mState.playIndex = 0;
             audioPlayer->mBufferQueue.mClearRequested = SL_BOOLEAN_FALSE;
-            track->mReader = NULL;
-            track->mAvail = 0;
-            doBroadcast = SL_BOOLEAN_TRUE;
+            audioPlayer->mBufferQueue.mDiscardRequested = SL_BOOLEAN_FALSE;
+            this->mReaders[i] = NULL;
+            this->mAvails[i] = 0;
+            doBroadcast |= 1 << LOCK_DOMAIN_BUFFERQUEUE;
+        }
+
+        if (audioPlayer->mBufferQueue.mDiscardRequested) {
+            // a URI player seeked, and left the front buffer for the old position on the queue
+            // in case we were reading it; drop it now, unless we have moved on from it already
+            IBufferQueue *bufferQueue = &audioPlayer->mBufferQueue;
+            bufferQueue->mDiscardRequested = SL_BOOLEAN_FALSE;
+            if (bufferQueue->mState.playIndex == bufferQueue->mDiscardIndex &&
+                    bufferQueue->mFront != bufferQueue->mRear) {
+                BufferHeader *newFront = bufferQueue->mFront;
+                if (++newFront == &bufferQueue->mArray[bufferQueue->mNumBuffers + 1]) {
+                    newFront = bufferQueue->mArray;
+                }
+                bufferQueue->mFront = newFront;
+                assert(0 < bufferQueue->mState.count);
+                field_poke(bufferQueue->mState.count, bufferQueue->mState.count - 1);
+                ++bufferQueue->mState.playIndex;
+                this->mReaders[i] = NULL;
+                this->mAvails[i] = 0;
+            }
         }
 
         if (audioPlayer->mDestroyRequested) {
             // an application thread that calls Object::Destroy while mixer is active will block
             // synchronously in the PreDestroy hook until mixer acknowledges the Destroy request
-            COutputMix *outputMix = CAudioPlayer_GetOutputMix(audioPlayer);
-            unsigned i = track - outputMix->mOutputMixExt.mTracks;
-            assert( /* 0 <= i && */ i < MAX_TRACK);
-            unsigned mask = 1 << i;
-            track->mAudioPlayer = NULL;
-            assert(outputMix->mOutputMixExt.mActiveMask & mask);
-            outputMix->mOutputMixExt.mActiveMask &= ~mask;
-            audioPlayer->mTrack = NULL;
+            track_unlink(this, i, audioPlayer);
             audioPlayer->mDestroyRequested = SL_BOOLEAN_FALSE;
-            doBroadcast = SL_BOOLEAN_TRUE;
+            doBroadcast |= 1 << LOCK_DOMAIN_OBJECT;
             goto broadcast;
         }
 
         switch (audioPlayer->mPlay.mState) {
 
         case SL_PLAYSTATE_PLAYING:  // continue playing current track data
-            if (0 < track->mAvail) {
+            if (0 < this->mAvails[i]) {
                 trackHasData = SL_BOOLEAN_TRUE;
                 break;
             }
@@ -108,23 +172,21 @@ static SLboolean track_check(Track *track)
             oldFront = audioPlayer->mBufferQueue.mFront;
             if (oldFront != audioPlayer->mBufferQueue.mRear) {
                 assert(0 < audioPlayer->mBufferQueue.mState.count);
-                track->mReader = oldFront->mBuffer;
-                track->mAvail = oldFront->mSize;
+                this->mReaders[i] = oldFront->mBuffer;
+                this->mAvails[i] = oldFront->mSize;
                 // note that the buffer stays on the queue while we are reading
-                audioPlayer->mPlay.mState = SL_PLAYSTATE_PLAYING;
                 trackHasData = SL_BOOLEAN_TRUE;
+            } else if (audioPlayer->mAutoRelease &&
+                    0 != audioPlayer->mBufferQueue.mState.playIndex) {
+                // an auto-release player has played out all of its data, so stop it here
+                // and let the sync thread reclaim it
+                track_state(this, i, audioPlayer, SL_PLAYSTATE_STOPPING);
+                audioPlayer->mReleasePending = SL_BOOLEAN_TRUE;
             } else {
                 // no buffers on queue, so playable but not playing
                 // NTH should be able to call a desperation callback when completely starved,
                 // or call less often than every buffer based on high/low water-marks
-#ifdef SYBERIA
-				audioPlayer->mPlay.mState = SL_PLAYSTATE_STOPPING;
-#endif
             }
-
-            // copy gains from audio player to track
-            track->mGains[0] = audioPlayer->mGains[0];
-            track->mGains[1] = audioPlayer->mGains[1];
             break;
 
         case SL_PLAYSTATE_STOPPING: // application thread(s) called Play::SetPlayState(STOPPED)
@@ -132,16 +194,21 @@ static SLboolean track_check(Track *track)
             audioPlayer->mPlay.mFramesSinceLastSeek = 0;
             audioPlayer->mPlay.mFramesSincePositionUpdate = 0;
             audioPlayer->mPlay.mLastSeekPosition = 0;
-            audioPlayer->mPlay.mState = SL_PLAYSTATE_STOPPED;
+            track_state(this, i, audioPlayer, SL_PLAYSTATE_STOPPED);
             // stop cancels a pending seek
             audioPlayer->mSeek.mPos = SL_TIME_UNKNOWN;
             oldFront = audioPlayer->mBufferQueue.mFront;
             if (oldFront != audioPlayer->mBufferQueue.mRear) {
                 assert(0 < audioPlayer->mBufferQueue.mState.count);
-                track->mReader = oldFront->mBuffer;
-                track->mAvail = oldFront->mSize;
+                this->mReaders[i] = oldFront->mBuffer;
+                this->mAvails[i] = oldFront->mSize;
+            }
+            if (audioPlayer->mReleasePending) {
+                // a finished auto-release player gives up its track right away,
+                // so that it can be destroyed without waiting for the mixer
+                track_unlink(this, i, audioPlayer);
             }
-            doBroadcast = SL_BOOLEAN_TRUE;
+            doBroadcast |= 1 << LOCK_DOMAIN_TRANSPORT;
             break;
 
         case SL_PLAYSTATE_STOPPED:  // idle
@@ -154,11 +221,15 @@ static SLboolean track_check(Track *track)
         }
 
 broadcast:
-        if (doBroadcast) {
-            object_cond_broadcast(&audioPlayer->mObject);
+        while (doBroadcast) {
+            unsigned domain = ctz(doBroadcast);
+            doBroadcast &= ~(1 << domain);
+            domain_cond_broadcast(thisAP, domain);
         }
 
-        object_unlock_exclusive(&audioPlayer->mObject);
+        domain_unlock_exclusive(thisAP, LOCK_DOMAIN_BUFFERQUEUE);
+        domain_unlock_exclusive(thisAP, LOCK_DOMAIN_TRANSPORT);
+        object_unlock_exclusive(thisAP);
 
     }
 
@@ -200,11 +271,10 @@ void IOutputMixExt_FillBuffer(SLOutputMixExtItf self, void *pBuffer, SLuint32 si
         unsigned i = ctz(activeMask);
         assert(MAX_TRACK > i);
         activeMask &= ~(1 << i);
-        Track *track = &this->mTracks[i];
 
         // track is allocated
 
-        if (!track_check(track)) {
+        if (!track_check(this, i)) {
             continue;
         }
 
@@ -216,7 +286,8 @@ void IOutputMixExt_FillBuffer(SLOutputMixExtItf self, void *pBuffer, SLuint32 si
         Summary summaries[STEREO_CHANNELS];
         unsigned channel;
         for (channel = 0; channel < STEREO_CHANNELS; ++channel) {
-            float gain = track->mGains[channel];
+            float gain;
+            __atomic_load(&this->mGains[i][channel], &gain, __ATOMIC_RELAXED);
             gains[channel] = gain;
             Summary summary;
             if (gain <= 0.001) {
@@ -228,24 +299,28 @@ void IOutputMixExt_FillBuffer(SLOutputMixExtItf self, void *pBuffer, SLuint32 si
             }
             summaries[channel] = summary;
         }
+        // work on local copies of the hot track state, and write them back once per buffer
+        const void *reader = this->mReaders[i];
+        SLuint32 avail = this->mAvails[i];
+        SLuint32 framesMixed = 0;
         while (desired > 0) {
             unsigned actual = desired;
-            if (track->mAvail < actual) {
-                actual = track->mAvail;
+            if (avail < actual) {
+                actual = avail;
             }
             // force actual to be a frame multiple
             if (actual > 0) {
-                assert(NULL != track->mReader);
+                assert(NULL != reader);
                 stereo *mixBuffer = (stereo *) dstWriter;
-                const stereo *source = (const stereo *) track->mReader;
+                const stereo *source = (const stereo *) reader;
                 unsigned j;
                 if (GAIN_MUTE != summaries[0] || GAIN_MUTE != summaries[1]) {
                     if (mixBufferHasData) {
                         // apply gain during add
                         if (GAIN_UNITY != summaries[0] || GAIN_UNITY != summaries[1]) {
                             for (j = 0; j < actual; j += sizeof(stereo), ++mixBuffer, ++source) {
-                                mixBuffer->left += (short) (source->left * track->mGains[0]);
-                                mixBuffer->right += (short) (source->right * track->mGains[1]);
+                                mixBuffer->left += (short) (source->left * gains[0]);
+                                mixBuffer->right += (short) (source->right * gains[1]);
                             }
                         // no gain adjustment needed, so do a simple add
                         } else {
@@ -258,22 +333,23 @@ void IOutputMixExt_FillBuffer(SLOutputMixExtItf self, void *pBuffer, SLuint32 si
                         // apply gain during copy
                         if (GAIN_UNITY != summaries[0] || GAIN_UNITY != summaries[1]) {
                             for (j = 0; j < actual; j += sizeof(stereo), ++mixBuffer, ++source) {
-                                mixBuffer->left = (short) (source->left * track->mGains[0]);
-                                mixBuffer->right = (short) (source->right * track->mGains[1]);
+                                mixBuffer->left = (short) (source->left * gains[0]);
+                                mixBuffer->right = (short) (source->right * gains[1]);
                             }
                         // no gain adjustment needed, so do a simple copy
                         } else {
-                            memcpy(dstWriter, track->mReader, actual);
+                            memcpy(dstWriter, reader, actual);
                         }
                     }
                     trackContributedToMix = SL_BOOLEAN_TRUE;
                 }
                 dstWriter = (char *) dstWriter + actual;
                 desired -= actual;
-                track->mReader = (char *) track->mReader + actual;
-                track->mAvail -= actual;
-                if (track->mAvail == 0) {
-                    IBufferQueue *bufferQueue = &track->mAudioPlayer->mBufferQueue;
+                reader = (const char *) reader + actual;
+                avail -= actual;
+                framesMixed += actual >> 2;    // sizeof(short) * STEREO_CHANNELS
+                if (avail == 0) {
+                    IBufferQueue *bufferQueue = this->mTracks[i].mBufferQueue;
                     interface_lock_exclusive(bufferQueue);
                     const BufferHeader *oldFront, *newFront, *rear;
                     oldFront = bufferQueue->mFront;
@@ -286,13 +362,13 @@ void IOutputMixExt_FillBuffer(SLOutputMixExtItf self, void *pBuffer, SLuint32 si
                     }
                     bufferQueue->mFront = (BufferHeader *) newFront;
                     assert(0 < bufferQueue->mState.count);
-                    --bufferQueue->mState.count;
+                    field_poke(bufferQueue->mState.count, bufferQueue->mState.count - 1);
                     if (newFront != rear) {
                         // we don't acknowledge application requests between buffers
                         // within the same mixer frame
                         assert(0 < bufferQueue->mState.count);
-                        track->mReader = newFront->mBuffer;
-                        track->mAvail = newFront->mSize;
+                        reader = newFront->mBuffer;
+                        avail = newFront->mSize;
                     }
                     // else we would set play state to playable but not playing during next mixer
                     // frame if the queue is still empty at that time
@@ -307,20 +383,30 @@ void IOutputMixExt_FillBuffer(SLOutputMixExtItf self, void *pBuffer, SLuint32 si
                         // We will find out later during the next mixer frame.
                     }
                 }
-                // no lock, but safe because noone else updates this field
-                track->mFramesMixed += actual >> 2;    // sizeof(short) * STEREO_CHANNELS
                 continue;
             }
             // we need more data: desired > 0 but actual == 0
-            if (track_check(track)) {
+            this->mReaders[i] = reader;
+            this->mAvails[i] = avail;
+            // no lock, but safe because noone else updates this field
+            this->mFramesMixed[i] += framesMixed;
+            framesMixed = 0;
+            if (track_check(this, i)) {
+                reader = this->mReaders[i];
+                avail = this->mAvails[i];
                 continue;
             }
             // underflow: clear out rest of partial buffer (NTH synthesize comfort noise)
             if (!mixBufferHasData && trackContributedToMix) {
-                memset(dstWriter, 0, actual);
+                memset(dstWriter, 0, desired);
             }
             break;
         }
+        if (0 == desired) {
+            this->mReaders[i] = reader;
+            this->mAvails[i] = avail;
+            this->mFramesMixed[i] += framesMixed;
+        }
         if (trackContributedToMix) {
             mixBufferHasData = SL_BOOLEAN_TRUE;
         }
@@ -348,7 +434,12 @@ void IOutputMixExt_init(void *self)
     unsigned i;
     for (i = 0; i < MAX_TRACK; ++i, ++track) {
         track->mAudioPlayer = NULL;
+        this->mReaders[i] = NULL;
+        this->mAvails[i] = 0;
+        this->mStates[i] = SL_PLAYSTATE_STOPPED;
+        this->mFramesMixed[i] = 0;
     }
+    this->mRequestMask = 0;
     this->mDestroyRequested = SL_BOOLEAN_FALSE;
 }
 
@@ -402,11 +493,23 @@ SLresult IOutputMixExt_checkAudioPlayerSourceSink(CAudioPlayer *this)
         omExt->mActiveMask |= 1 << i;
         track = &omExt->mTracks[i];
         track->mAudioPlayer = NULL;    // only field that is accessed before full initialization
+        omExt->mReaders[i] = NULL;
+        omExt->mAvails[i] = 0;
+        omExt->mGains[i][0] = 1.0f;
+        omExt->mGains[i][1] = 1.0f;
+        omExt->mStates[i] = SL_PLAYSTATE_STOPPED;
+        omExt->mFramesMixed[i] = 0;
+        __atomic_fetch_and(&omExt->mRequestMask, ~(1 << i), __ATOMIC_RELAXED);
         interface_unlock_exclusive(omExt);
         this->mTrack = track;
-        this->mGains[0] = 1.0f;
-        this->mGains[1] = 1.0f;
         this->mDestroyRequested = SL_BOOLEAN_FALSE;
+#ifdef SYBERIA
+        // this title fires one-shot sounds and never destroys them
+        this->mAutoRelease = SL_BOOLEAN_TRUE;
+#else
+        this->mAutoRelease = SL_BOOLEAN_FALSE;
+#endif
+        this->mReleasePending = SL_BOOLEAN_FALSE;
         }
         break;
     default:
@@ -416,11 +519,6 @@ SLresult IOutputMixExt_checkAudioPlayerSourceSink(CAudioPlayer *this)
     assert(NULL != track);
     track->mBufferQueue = &this->mBufferQueue;
     track->mAudioPlayer = this;
-    track->mReader = NULL;
-    track->mAvail = 0;
-    track->mGains[0] = 1.0f;
-    track->mGains[1] = 1.0f;
-    track->mFramesMixed = 0;
     return SL_RESULT_SUCCESS;
 }
 
@@ -439,9 +537,18 @@ void audioPlayerGainUpdate(CAudioPlayer *audioPlayer)
     if (soloMask) {
         muteMask |= ~soloMask;
     }
+    // the gains are pushed to the track, which the mixer reads without a lock; at worst it mixes
+    // one block with one channel's old gain
+    Track *track = __atomic_load_n(&audioPlayer->mTrack, __ATOMIC_ACQUIRE);
+    if (NULL == track) {
+        return;
+    }
+    IOutputMixExt *omExt = &CAudioPlayer_GetOutputMix(audioPlayer)->mOutputMixExt;
+    float *gains = omExt->mGains[track - omExt->mTracks];
     if (mute || !(~muteMask & 3)) {
-        audioPlayer->mGains[0] = 0.0f;
-        audioPlayer->mGains[1] = 0.0f;
+        float zero = 0.0f;
+        __atomic_store(&gains[0], &zero, __ATOMIC_RELAXED);
+        __atomic_store(&gains[1], &zero, __ATOMIC_RELAXED);
     } else {
         float playerGain = powf(10.0f, level / 2000.0f);
         unsigned channel;
@@ -469,7 +576,34 @@ void audioPlayerGainUpdate(CAudioPlayer *audioPlayer)
                     }
                 }
             }
-            audioPlayer->mGains[channel] = gain;
+            __atomic_store(&gains[channel], &gain, __ATOMIC_RELAXED);
         }
     }
 }
+
+
+/** \brief Called when the play state of an audio player changed, with the transport domain locked */
+
+void audioPlayerStateUpdate(CAudioPlayer *audioPlayer)
+{
+    Track *track = audioPlayer->mTrack;
+    if (NULL != track) {
+        IOutputMixExt *omExt = &CAudioPlayer_GetOutputMix(audioPlayer)->mOutputMixExt;
+        __atomic_store_n(&omExt->mStates[track - omExt->mTracks],
+            audioPlayer->mPlay.mState, __ATOMIC_RELEASE);
+    }
+}
+
+
+/** \brief Called after raising a request for the mixer to acknowledge (mClearRequested,
+ *  mDiscardRequested or mDestroyRequested), with the domain of the request locked
+ */
+
+void audioPlayerTrackRequest(CAudioPlayer *audioPlayer)
+{
+    Track *track = audioPlayer->mTrack;
+    if (NULL != track) {
+        IOutputMixExt *omExt = &CAudioPlayer_GetOutputMix(audioPlayer)->mOutputMixExt;
+        __atomic_fetch_or(&omExt->mRequestMask, 1 << (track - omExt->mTracks), __ATOMIC_RELEASE);
+    }
+}
@@ -51,17 +51,19 @@ static SLresult IPlay_SetPlayState(SLPlayItf self, SLuint32 state)
             case (SL_PLAYSTATE_STOPPED  << 2) | SL_PLAYSTATE_PLAYING:
             case (SL_PLAYSTATE_PAUSED   << 2) | SL_PLAYSTATE_PLAYING:
                 attr = ATTR_TRANSPORT;
-                // set enqueue attribute if queue is non-empty and state becomes PLAYING
-                if ((NULL != audioPlayer) && (audioPlayer->mBufferQueue.mFront !=
-                    audioPlayer->mBufferQueue.mRear)) {
-                    attr |= ATTR_ENQUEUE;
-                }
                 // fall through
 
             case (SL_PLAYSTATE_STOPPED  << 2) | SL_PLAYSTATE_PAUSED:
+                // a paused player prefetches, so a URI player starts decoding ahead
+                attr = ATTR_TRANSPORT;
+                // fall through
+
             case (SL_PLAYSTATE_PLAYING  << 2) | SL_PLAYSTATE_PAUSED:
-                // easy
-                this->mState = state;
+                // easy, but the buffer queue domain peeks at the state
+                field_poke(this->mState, state);
+                if (NULL != audioPlayer) {
+                    audioPlayerStateUpdate(audioPlayer);
+                }
                 break;
 
             case (SL_PLAYSTATE_STOPPING << 2) | SL_PLAYSTATE_STOPPED:
@@ -76,7 +78,10 @@ static SLresult IPlay_SetPlayState(SLPlayItf self, SLuint32 state)
             case (SL_PLAYSTATE_PAUSED   << 2) | SL_PLAYSTATE_STOPPED:
             case (SL_PLAYSTATE_PLAYING  << 2) | SL_PLAYSTATE_STOPPED:
                 // tell mixer to stop, then wait for mixer to acknowledge the request to stop
-                this->mState = SL_PLAYSTATE_STOPPING;
+                field_poke(this->mState, SL_PLAYSTATE_STOPPING);
+                if (NULL != audioPlayer) {
+                    audioPlayerStateUpdate(audioPlayer);
+                }
                 continue;
 
             default:
@@ -89,6 +94,14 @@ static SLresult IPlay_SetPlayState(SLPlayItf self, SLuint32 state)
 
             break;
         }
+        // set enqueue attribute if queue is non-empty and state becomes PLAYING; the queue is
+        // in the buffer queue domain, so publish the state first, see ATTR_ENQUEUE in locks.c
+        if ((ATTR_TRANSPORT & attr) && (SL_PLAYSTATE_PLAYING == state) && (NULL != audioPlayer)) {
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            if (0 != field_peek(audioPlayer->mBufferQueue.mState.count)) {
+                attr |= ATTR_ENQUEUE;
+            }
+        }
 #else
         // Here life looks easy for an Android, but there are other troubles in play land
         this->mState = state;
@@ -114,9 +127,7 @@ static SLresult IPlay_GetPlayState(SLPlayItf self, SLuint32 *pState)
         result = SL_RESULT_PARAMETER_INVALID;
     } else {
         IPlay *this = (IPlay *) self;
-        interface_lock_peek(this);
-        SLuint32 state = this->mState;
-        interface_unlock_peek(this);
+        SLuint32 state = field_peek(this->mState);
         result = SL_RESULT_SUCCESS;
 #ifdef USE_OUTPUTMIXEXT
         switch (state) {
@@ -28,9 +28,7 @@ static SLresult IPlaybackRate_SetRate(SLPlaybackRateItf self, SLpermille rate)
     if (!(this->mMinRate <= rate && rate <= this->mMaxRate)) {
         result = SL_RESULT_PARAMETER_INVALID;
     } else {
-        interface_lock_exclusive(this);
-        this->mRate = rate;
-        interface_unlock_exclusive(this);
+        field_poke(this->mRate, rate);
 #ifdef ANDROID
         CAudioPlayer *ap = (SL_OBJECTID_AUDIOPLAYER == InterfaceToObjectID(this)) ?
                 (CAudioPlayer *) this->mThis : NULL;
@@ -56,9 +54,7 @@ static SLresult IPlaybackRate_GetRate(SLPlaybackRateItf self, SLpermille *pRate)
         result = SL_RESULT_PARAMETER_INVALID;
     } else {
         IPlaybackRate *this = (IPlaybackRate *) self;
-        interface_lock_peek(this);
-        SLpermille rate = this->mRate;
-        interface_unlock_peek(this);
+        SLpermille rate = field_peek(this->mRate);
         *pRate = rate;
         result = SL_RESULT_SUCCESS;
     }
@@ -164,4 +164,5 @@ void IPrefetchStatus_init(void *self)
     this->mContext = NULL;
     this->mCallbackEventsMask = 0;
     this->mFillUpdatePeriod = 100;
+    this->mReportedLevel = 0;
 }
@@ -29,12 +29,10 @@ static SLresult IRecord_SetRecordState(SLRecordItf self, SLuint32 state)
     case SL_RECORDSTATE_RECORDING:
         {
         IRecord *this = (IRecord *) self;
-        interface_lock_poke(this);
-        this->mState = state;
+        field_poke(this->mState, state);
 #ifdef ANDROID
         android_audioRecorder_setRecordState(InterfaceToCAudioRecorder(this), state);
 #endif
-        interface_unlock_poke(this);
         result = SL_RESULT_SUCCESS;
         }
         break;
@@ -55,9 +53,7 @@ static SLresult IRecord_GetRecordState(SLRecordItf self, SLuint32 *pState)
     if (NULL == pState) {
         result = SL_RESULT_PARAMETER_INVALID;
     } else {
-        interface_lock_peek(this);
-        SLuint32 state = this->mState;
-        interface_unlock_peek(this);
+        SLuint32 state = field_peek(this->mState);
         *pState = state;
         result = SL_RESULT_SUCCESS;
     }
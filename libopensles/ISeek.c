@@ -36,6 +36,12 @@ static SLresult ISeek_SetPosition(SLSeekItf self, SLmillisecond pos, SLuint32 se
         this->mPos = pos;
         // at this point the seek is merely pending, so do not yet update other fields
         interface_unlock_exclusive_attributes(this, ATTR_POSITION);
+#ifdef USE_SNDFILE
+        // the decoder of a URI player picks the seek up now, rather than at the next sync
+        if (SL_OBJECTID_AUDIOPLAYER == InterfaceToObjectID(this)) {
+            SndFile_seek(InterfaceToCAudioPlayer(this));
+        }
+#endif
         result = SL_RESULT_SUCCESS;
         }
         break;
@@ -79,6 +85,12 @@ static SLresult ISeek_SetLoop(SLSeekItf self, SLboolean loopEnable,
         result = SL_RESULT_SUCCESS;
 #endif
         interface_unlock_exclusive(this);
+#ifdef USE_SNDFILE
+        // the decoder of a URI player loops the file itself
+        if (SL_RESULT_SUCCESS == result && SL_OBJECTID_AUDIOPLAYER == InterfaceToObjectID(this)) {
+            SndFile_loop(InterfaceToCAudioPlayer(this));
+        }
+#endif
     }
 
     SL_LEAVE_INTERFACE
@@ -32,15 +32,14 @@ struct SLOutputMixExtItf_ {
     void (*FillBuffer)(SLOutputMixExtItf self, void *pBuffer, SLuint32 size);
 };
 
-/** \brief Track describes each PCM input source to OutputMix */
+/** \brief Track describes each PCM input source to OutputMix.
+ *  Only the rarely accessed back-pointers live here; the per-track state that the mixer
+ *  reads on every frame is kept as parallel arrays in IOutputMixExt, indexed by track number.
+ */
 
 typedef struct {
     struct BufferQueue_interface *mBufferQueue;
     CAudioPlayer *mAudioPlayer; ///< Mixer examines this track if non-NULL
-    const void *mReader;    ///< Pointer to next frame in BufferHeader.mBuffer
-    SLuint32 mAvail;        ///< Number of available bytes in the current buffer
-    float mGains[STEREO_CHANNELS]; ///< Copied from CAudioPlayer::mGains
-    SLuint32 mFramesMixed;  ///< Number of sample frames mixed from track; reset periodically
 } Track;
 
 #ifndef this
@@ -48,4 +47,6 @@ typedef struct {
 #endif
 extern SLresult IOutputMixExt_checkAudioPlayerSourceSink(CAudioPlayer *this);
 extern void audioPlayerGainUpdate(CAudioPlayer *this);
+extern void audioPlayerStateUpdate(CAudioPlayer *this);
+extern void audioPlayerTrackRequest(CAudioPlayer *this);
 extern void IOutputMixExt_FillBuffer(SLOutputMixExtItf self, void *pBuffer, SLuint32 size);
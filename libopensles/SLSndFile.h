@@ -16,9 +16,35 @@
 
 /** \file SLSndFile.h libsndfile interface */
 
+struct SndFileAsset;
+struct SndFileCache;
+
 extern void SLAPIENTRY SndFile_Callback(SLBufferQueueItf caller, void *pContext);
 extern SLboolean SndFile_IsSupported(const SF_INFO *sfinfo);
 extern SLresult SndFile_checkAudioPlayerSourceSink(CAudioPlayer *this_);
+extern SLboolean SndFile_checkBuffering(SLuint32 frames, SLuint32 minBuffers,
+    SLuint32 maxBuffers);
+extern SLresult SndFile_setBuffering(CAudioPlayer *this, SLuint32 frames, SLuint32 minBuffers,
+    SLuint32 maxBuffers);
 extern void audioPlayerTransportUpdate(CAudioPlayer *this);
+extern void SndFile_seek(CAudioPlayer *this);
+extern void SndFile_loop(CAudioPlayer *this);
+extern void SndFile_retry(CAudioPlayer *this);
+extern SLresult SndFile_Open(CAudioPlayer *this);
+extern void SndFile_Close(CAudioPlayer *this);
 extern SLresult SndFile_Realize(CAudioPlayer *this);
 extern void SndFile_Destroy(CAudioPlayer *this);
+extern SLuint32 SndFile_outputRate(void);
+extern SLresult SndFile_loadAsset(struct SndFileAsset *asset, size_t maxBytes);
+extern void SndFile_unloadAsset(struct SndFileAsset *asset);
+extern void SndFileCache_init(struct SndFileCache *this);
+extern void SndFileCache_deinit(struct SndFileCache *this);
+extern SLresult SndFileCache_acquire(struct SndFileCache *this, const char *path,
+    struct SndFileAsset **pAsset);
+extern void SndFileCache_release(struct SndFileCache *this, struct SndFileAsset *asset);
+extern SNDFILE *SndFileCache_openHandle(struct SndFileCache *this, const char *path,
+    SF_INFO *sfinfo, time_t *pModified, off_t *pFileSize);
+extern void SndFileCache_closeHandle(struct SndFileCache *this, const char *path,
+    time_t modified, off_t fileSize, SNDFILE *sndfile, const SF_INFO *sfinfo);
+extern SLresult SndFileCache_preload(struct SndFileCache *this, ThreadPool *threadPool,
+    const char *path, slVitaPreloadCallback callback, void *pContext);
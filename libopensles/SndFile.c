@@ -17,45 +17,881 @@
 /** \brief libsndfile integration */
 
 #include "sles_allinclusive.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef USE_MMAP
+#include <sys/mman.h>
+#endif
+
+
+/** \brief Whether the player has a file to play, through libsndfile or from memory */
+
+static SLboolean SndFile_isOpen(const struct SndFile *this)
+{
+    return NULL != this->mSNDFILE || NULL != this->mData;
+}
 
 
-/** \brief Called by SndFile.c:audioPlayerTransportUpdate after a play state change or seek,
- *  and by IOutputMixExt::FillBuffer after each buffer is consumed.
+/** \brief Set the gains of each channel of the file in the left and right outputs.  Files of
+ *  more than 2 channels are taken to be in the default WAVE_FORMAT_EXTENSIBLE order: front left
+ *  and right, center, LFE, then back and side pairs.  The center goes to both sides, the LFE is
+ *  dropped, and surround channels are attenuated by 3 dB, then each side is normalized so that
+ *  the downmix does not clip.
  */
 
-void SndFile_Callback(SLBufferQueueItf caller, void *pContext)
+static void SndFile_setDownmix(struct SndFile *this)
 {
-    CAudioPlayer *thisAP = (CAudioPlayer *) pContext;
-    object_lock_peek(&thisAP->mObject);
-    SLuint32 state = thisAP->mPlay.mState;
-    object_unlock_peek(&thisAP->mObject);
-    if (SL_PLAYSTATE_PLAYING != state) {
+    // L and R are front, l and r surround, C is center, c back center, x is dropped
+    static const char * const layouts[SndFile_MAXCHANNELS] = {
+        "C", "LR", "LRC", "LRlr", "LRClr", "LRCxlr", "LRCxclr", "LRCxlrlr"
+    };
+    static const float minus3dB = 0.70710678f;
+    SLuint32 channels = this->mSfInfo.channels;
+    const char *layout = layouts[channels - 1];
+    float sums[STEREO_CHANNELS] = {0.0f, 0.0f};
+    SLuint32 i;
+    for (i = 0; i < channels; ++i) {
+        float left = 0.0f, right = 0.0f;
+        switch (layout[i]) {
+        case 'L': left = 1.0f; break;
+        case 'R': right = 1.0f; break;
+        case 'l': left = minus3dB; break;
+        case 'r': right = minus3dB; break;
+        case 'C': left = right = 1 == channels ? 1.0f : minus3dB; break;
+        case 'c': left = right = 0.5f; break;
+        default: break;
+        }
+        this->mDownmix[i][0] = left;
+        this->mDownmix[i][1] = right;
+        sums[0] += left;
+        sums[1] += right;
+    }
+    for (i = 0; i < channels; ++i) {
+        this->mDownmix[i][0] /= sums[0] > 1.0f ? sums[0] : 1.0f;
+        this->mDownmix[i][1] /= sums[1] > 1.0f ? sums[1] : 1.0f;
+    }
+}
+
+
+/** \brief Convert frames read from the file to stereo.  The loops are simple enough for the
+ *  compiler to vectorize.
+ */
+
+static void SndFile_toStereo(const struct SndFile *this, const float * __restrict in,
+    float * __restrict out, SLuint32 frames)
+{
+    SLuint32 channels = this->mSfInfo.channels;
+    SLuint32 i;
+    switch (channels) {
+    case 1:
+        for (i = 0; i < frames; ++i) {
+            out[i * 2] = in[i];
+            out[i * 2 + 1] = in[i];
+        }
+        break;
+    case STEREO_CHANNELS:
+        memcpy(out, in, frames * STEREO_CHANNELS * sizeof(float));
+        break;
+    default:
+        for (i = 0; i < frames; ++i, in += channels) {
+            float left = 0.0f, right = 0.0f;
+            SLuint32 j;
+            for (j = 0; j < channels; ++j) {
+                left += in[j] * this->mDownmix[j][0];
+                right += in[j] * this->mDownmix[j][1];
+            }
+            out[i * 2] = left;
+            out[i * 2 + 1] = right;
+        }
+        break;
+    }
+}
+
+
+/** \brief Convert a sample to 16 bits, clipping it */
+
+static inline short SndFile_clip(float sample)
+{
+    sample *= 32768.0f;
+    sample = sample < 32767.0f ? sample : 32767.0f;
+    sample = sample > -32768.0f ? sample : -32768.0f;
+    return (short) sample;
+}
+
+
+/** \brief Convert samples to 16 bits, in a loop that the compiler can vectorize */
+
+static void SndFile_toShort(const float * __restrict in, short * __restrict out,
+    SLuint32 count)
+{
+    SLuint32 i;
+    for (i = 0; i < count; ++i) {
+        out[i] = SndFile_clip(in[i]);
+    }
+}
+
+
+/** \brief Start resampling from the current position of the file, with one frame of silence
+ *  before it.  Called with mMutex held, or before the decoder can run.
+ */
+
+static void SndFile_resetConverter(struct SndFile *this)
+{
+    this->mIn[0] = 0.0f;
+    this->mIn[1] = 0.0f;
+    this->mInCount = 1;
+    this->mPos = 0;
+    this->mInEOF = SL_BOOLEAN_FALSE;
+}
+
+
+/** \brief Set up the conversion of the open file to 16-bit stereo at the output rate */
+
+static SLresult SndFile_initConverter(struct SndFile *this, SLuint32 outputRate)
+{
+    this->mConvert = STEREO_CHANNELS != this->mSfInfo.channels ||
+        outputRate != (SLuint32) this->mSfInfo.samplerate ||
+        SF_FORMAT_PCM_16 != (this->mSfInfo.format & SF_FORMAT_SUBMASK);
+    this->mStep = ((uint64_t) this->mSfInfo.samplerate << 32) / outputRate;
+    this->mScratch = NULL;
+    this->mIn = NULL;
+    if (!this->mConvert) {
+        return SL_RESULT_SUCCESS;
+    }
+    this->mScratch = (float *) malloc(this->mFrames * this->mSfInfo.channels * sizeof(float));
+    this->mIn = (float *) malloc((this->mFrames + SndFile_TAPS) * STEREO_CHANNELS *
+        sizeof(float));
+    if (NULL == this->mScratch || NULL == this->mIn) {
+        free(this->mScratch);
+        free(this->mIn);
+        this->mScratch = NULL;
+        this->mIn = NULL;
+        return SL_RESULT_MEMORY_FAILURE;
+    }
+    SndFile_setDownmix(this);
+    SndFile_resetConverter(this);
+    return SL_RESULT_SUCCESS;
+}
+
+
+/** \brief Undo SndFile_initConverter */
+
+static void SndFile_deinitConverter(struct SndFile *this)
+{
+    free(this->mScratch);
+    free(this->mIn);
+    this->mScratch = NULL;
+    this->mIn = NULL;
+}
+
+
+/** \brief Read up to frames frames of the file through libsndfile, as float in pFloat if it is
+ *  not NULL, or else as short in pShort.  In a loop, the read stops at the loop end, or the end
+ *  of file when it started after the loop, and goes on from the loop start, so the buffer holds
+ *  both sides of the seam.  Returns the number of frames, which is less than asked only at the
+ *  end of file.  Called with mMutex held.
+ */
+
+static sf_count_t SndFile_readFrames(struct SndFile *this, float *pFloat, short *pShort,
+    SLuint32 frames)
+{
+    sf_count_t total = 0;
+    SLboolean wrapped = SL_BOOLEAN_FALSE;
+    for (;;) {
+        sf_count_t want = frames - total;
+        if (this->mLoop && this->mFrame <= this->mLoopEnd &&
+                want > this->mLoopEnd - this->mFrame) {
+            want = this->mLoopEnd - this->mFrame;
+        }
+        sf_count_t count = NULL != pFloat ?
+            sf_readf_float(this->mSNDFILE, &pFloat[total * this->mSfInfo.channels], want) :
+            sf_readf_short(this->mSNDFILE, &pShort[total * STEREO_CHANNELS], want);
+        if (0 < count) {
+            this->mFrame += count;
+            total += count;
+            wrapped = SL_BOOLEAN_FALSE;
+        }
+        // a loop start that reads nothing is past the real end of the file, so give up on it
+        if (total >= frames || !this->mLoop || wrapped) {
+            break;
+        }
+        if (0 > sf_seek(this->mSNDFILE, this->mLoopStart, SEEK_SET)) {
+            break;
+        }
+        this->mFrame = this->mLoopStart;
+        wrapped = SL_BOOLEAN_TRUE;
+    }
+    return total;
+}
+
+
+/** \brief Drop the frames before the next output from the resampler input, and read the next
+ *  block of the file after the rest, or silence at the end of the file.  Returns
+ *  SL_BOOLEAN_FALSE if there is nothing more to read.  Called with mMutex held.
+ */
+
+static SLboolean SndFile_refill(struct SndFile *this)
+{
+    SLuint32 drop = (SLuint32) (this->mPos >> 32);
+    if (drop > this->mInCount) {
+        // downsampling stepped past the end, so the frames in between are skipped as they are read
+        drop = this->mInCount;
+    }
+    this->mInCount -= drop;
+    memmove(this->mIn, &this->mIn[drop * STEREO_CHANNELS],
+        this->mInCount * STEREO_CHANNELS * sizeof(float));
+    this->mPos -= (uint64_t) drop << 32;
+    if (this->mInEOF) {
+        return SL_BOOLEAN_FALSE;
+    }
+    float *tail = &this->mIn[this->mInCount * STEREO_CHANNELS];
+    sf_count_t count = SndFile_readFrames(this, this->mScratch, NULL, this->mFrames);
+    if (0 >= count) {
+        // enough silence for the last frame of the file to be interpolated
+        memset(tail, 0, (SndFile_TAPS - 2) * STEREO_CHANNELS * sizeof(float));
+        this->mInCount += SndFile_TAPS - 2;
+        this->mInEOF = SL_BOOLEAN_TRUE;
+    } else {
+        SndFile_toStereo(this, this->mScratch, tail, (SLuint32) count);
+        this->mInCount += (SLuint32) count;
+    }
+    return SL_BOOLEAN_TRUE;
+}
+
+
+/** \brief Catmull-Rom interpolation between x1 and x2, at fraction f */
+
+static inline float SndFile_cubic(float x0, float x1, float x2, float x3, float f)
+{
+    float c1 = 0.5f * (x2 - x0);
+    float c2 = x0 - 2.5f * x1 + 2.0f * x2 - 0.5f * x3;
+    float c3 = 0.5f * (x3 - x0) + 1.5f * (x1 - x2);
+    return ((c3 * f + c2) * f + c1) * f + x1;
+}
+
+
+/** \brief Convert the next block of the file to at most mFrames frames of 16-bit stereo at the
+ *  output rate, in pBuffer.  A file at the output rate is converted a block at a time, and any
+ *  other is resampled by cubic interpolation.  Returns the number of frames.  Called with mMutex
+ *  held.
+ */
+
+static SLuint32 SndFile_convert(struct SndFile *this, short *pBuffer)
+{
+    if ((uint64_t) 1 << 32 == this->mStep) {
+        sf_count_t count = SndFile_readFrames(this, this->mScratch, NULL, this->mFrames);
+        if (0 >= count) {
+            return 0;
+        }
+        SndFile_toStereo(this, this->mScratch, this->mIn, (SLuint32) count);
+        SndFile_toShort(this->mIn, pBuffer, (SLuint32) count * STEREO_CHANNELS);
+        return (SLuint32) count;
+    }
+    SLuint32 n = 0;
+    while (n < this->mFrames) {
+        SLuint32 i = (SLuint32) (this->mPos >> 32);
+        if (i + SndFile_TAPS > this->mInCount) {
+            if (!SndFile_refill(this)) {
+                break;
+            }
+            continue;
+        }
+        float f = (float) (uint32_t) this->mPos * (1.0f / 4294967296.0f);
+        const float *x = &this->mIn[i * STEREO_CHANNELS];
+        pBuffer[n * 2] = SndFile_clip(SndFile_cubic(x[0], x[2], x[4], x[6], f));
+        pBuffer[n * 2 + 1] = SndFile_clip(SndFile_cubic(x[1], x[3], x[5], x[7], f));
+        this->mPos += this->mStep;
+        ++n;
+    }
+    return n;
+}
+
+
+/** \brief Called on a streaming worker: read the next block of the file into pBuffer, as 16-bit
+ *  stereo at the output rate.  Returns the size in bytes, or 0 at end of stream.  Called with
+ *  mMutex held.
+ */
+
+static SLuint32 SndFile_read(struct SndFile *this, short *pBuffer)
+{
+    sf_count_t frames;
+    if (this->mConvert) {
+        frames = SndFile_convert(this, pBuffer);
+    } else {
+        frames = SndFile_readFrames(this, NULL, pBuffer, this->mFrames);
+    }
+    if (0 >= frames) {
+        return 0;
+    }
+    return (SLuint32) (frames * STEREO_CHANNELS * sizeof(short));
+}
+
+
+/** \brief Whether the decoder should fill another buffer: the player is playing or paused, so it
+ *  prefetches, the file has more data, and the buffer queue has room.  Slots are filled in order,
+ *  so while the queue has room the next slot is not queued.  Called with mMutex held.
+ */
+
+static SLboolean SndFile_needsDecode(CAudioPlayer *thisAP)
+{
+    SLuint32 state = field_peek(thisAP->mPlay.mState);
+    return !field_peek(thisAP->mSndFile.mEOF) &&
+        (SL_PLAYSTATE_PLAYING == state || SL_PLAYSTATE_PAUSED == state) &&
+        thisAP->mSndFile.mDepth > field_peek(thisAP->mBufferQueue.mState.count);
+}
+
+
+/** \brief Adapt the decode-ahead depth to how the decoder keeps up: double it when the queue
+ *  ran low before the decoder got to it, and shrink it by one after SndFile_SHRINKAFTER buffers
+ *  were decoded in time.  count is the number of queued buffers when the decoder started.
+ *  Called with mMutex held.
+ */
+
+static void SndFile_adapt(struct SndFile *this, SLuint32 count)
+{
+    if (this->mMinBuffers == this->mMaxBuffers) {
+        return;
+    }
+    if (this->mPrimed && count <= this->mDepth / 4) {
+        SLuint32 depth = this->mDepth * 2;
+        this->mTargetDepth = depth < this->mMaxBuffers ? depth : this->mMaxBuffers;
+        this->mInTime = 0;
+        this->mPrimed = SL_BOOLEAN_FALSE;
+        SL_LOGV("decoder late with %lu of %lu buffers queued", count, this->mDepth);
+    } else if (this->mInTime >= SndFile_SHRINKAFTER && this->mTargetDepth > this->mMinBuffers) {
+        --this->mTargetDepth;
+        this->mInTime = 0;
+    }
+}
+
+
+/** \brief Change the ring to the target depth, if the queued buffers allow it: they are the count
+ *  buffers before mWhich, so none may wrap around the end of the ring, and when shrinking none
+ *  may be beyond the new end.  Buffers beyond the new end are freed.  Called with mMutex held.
+ */
+
+static void SndFile_resize(struct SndFile *this, SLuint32 count)
+{
+    SLuint32 depth = this->mTargetDepth;
+    if (depth == this->mDepth || this->mWhich < count) {
+        return;
+    }
+    if (depth < this->mDepth) {
+        if (this->mWhich > depth) {
+            return;
+        }
+        SLuint32 i;
+        for (i = depth; i < this->mDepth; ++i) {
+            free(this->mBuffers[i]);
+            this->mBuffers[i] = NULL;
+        }
+        if (this->mWhich == depth) {
+            this->mWhich = 0;
+        }
+    }
+    field_poke(this->mDepth, depth);
+}
+
+
+/** \brief The queued data has all been played at end of stream, so pause the player.
+ *  Called with the transport domain locked, which this unlocks.
+ */
+
+static void SndFile_drained(CAudioPlayer *thisAP)
+{
+#ifdef USE_OUTPUTMIXEXT
+    // an auto-release player stays in the playing state so that the mixer stops and releases it
+    if (!thisAP->mAutoRelease) {
+        field_poke(thisAP->mPlay.mState, SL_PLAYSTATE_PAUSED);
+        audioPlayerStateUpdate(thisAP);
+    }
+#else
+    field_poke(thisAP->mPlay.mState, SL_PLAYSTATE_PAUSED);
+#endif
+    // this would result in a non-monotonically increasing position, so don't do it
+    // thisAP->mPlay.mPosition = thisAP->mPlay.mDuration;
+    interface_unlock_exclusive_attributes(&thisAP->mPlay, ATTR_TRANSPORT);
+}
+
+
+/** \brief Whether a seek was requested that the decoder has not applied yet.  The applied epoch
+ *  is peeked first, so when it is current the decoder's end of stream flag is for the new position.
+ */
+
+static SLboolean SndFile_seekPending(struct SndFile *this)
+{
+    SLuint32 epoch = field_peek(this->mEpoch);
+    return epoch != field_peek(this->mSeekEpoch);
+}
+
+
+/** \brief Note the end of stream, after the last buffer was enqueued.  Called with mMutex held. */
+
+static void SndFile_endOfStream(CAudioPlayer *thisAP)
+{
+    field_poke(thisAP->mSndFile.mEOF, SL_BOOLEAN_TRUE);
+    // pairs with the fence in SndFile_Callback: if the mixer has already played out
+    // the queue, then it did not see end of stream, so we pause the player here, unless
+    // a seek is about to start decoding again
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (0 == field_peek(thisAP->mBufferQueue.mState.count) &&
+            !SndFile_seekPending(&thisAP->mSndFile)) {
+        interface_lock_exclusive(&thisAP->mPlay);
+        SndFile_drained(thisAP);
+    }
+}
+
+
+/** \brief Update the prefetch status of a streaming player from the decoded buffers queued ahead
+ *  of the mixer.  The fill level is the queue against the decode-ahead depth, or all of it once
+ *  the decoder reached the end of file.  The data is sufficient with mMinBuffers queued and
+ *  underflows with none, and in between the status holds, so it does not flap with each buffer.
+ *  Called with the transport domain locked; returns the events the application asked for.
+ */
+
+static SLuint32 SndFile_prefetchLocked(CAudioPlayer *thisAP)
+{
+    struct SndFile *this = &thisAP->mSndFile;
+    IPrefetchStatus *thisPS = &thisAP->mPrefetchStatus;
+    if (!this->mPrefetch) {
+        return 0;
+    }
+    SLuint32 count = field_peek(thisAP->mBufferQueue.mState.count);
+    SLuint32 depth = field_peek(this->mDepth);
+    SLboolean eof = field_peek(this->mEOF);
+    SLpermille level = eof || count >= depth ? 1000 : (SLpermille) (count * 1000 / depth);
+    SLuint32 status = thisPS->mStatus;
+    if (eof || count >= this->mMinBuffers) {
+        status = SL_PREFETCHSTATUS_SUFFICIENTDATA;
+    } else if (0 == count) {
+        status = SL_PREFETCHSTATUS_UNDERFLOW;
+    }
+    SLuint32 events = 0;
+    // the getters peek at the status and level
+    if (status != thisPS->mStatus) {
+        field_poke(thisPS->mStatus, status);
+        events |= SL_PREFETCHEVENT_STATUSCHANGE;
+    }
+    field_poke(thisPS->mLevel, level);
+    // report the level each time it moves into another period, so a burst of buffers is one event
+    SLpermille period = thisPS->mFillUpdatePeriod;
+    if (level / period != thisPS->mReportedLevel / period) {
+        thisPS->mReportedLevel = level;
+        events |= SL_PREFETCHEVENT_FILLLEVELCHANGE;
+    }
+    return events & thisPS->mCallbackEventsMask;
+}
+
+
+/** \brief Update the prefetch status of a streaming player after its queue changed outside the
+ *  mixer, and call the application's prefetch callback with the transport domain unlocked
+ */
+
+static void SndFile_prefetchUpdate(CAudioPlayer *thisAP)
+{
+    IPrefetchStatus *thisPS = &thisAP->mPrefetchStatus;
+    if (!thisAP->mSndFile.mPrefetch) {
         return;
     }
+    interface_lock_exclusive(thisPS);
+    SLuint32 events = SndFile_prefetchLocked(thisAP);
+    slPrefetchCallback callback = thisPS->mCallback;
+    void *context = thisPS->mContext;
+    interface_unlock_exclusive(thisPS);
+    if (0 != events && NULL != callback) {
+        (*callback)(&thisPS->mItf, context, events);
+    }
+}
+
+
+/** \brief Apply the latest seek.  The queued buffers for the old position are discarded in place,
+ *  except the front one that the mixer may be reading, which the mixer drops at its next buffer,
+ *  so there is no Clear to wait for: the new position is audible a mixer buffer later, and the
+ *  decoder goes on to decode ahead of it.  A seek that a stop cancelled only brings the epoch up
+ *  to date.  Called with mMutex held.
+ */
+
+static void SndFile_applySeek(CAudioPlayer *thisAP)
+{
+    struct SndFile *this = &thisAP->mSndFile;
+    IBufferQueue *thisBQ = &thisAP->mBufferQueue;
+    SLuint32 epoch = field_peek(this->mSeekEpoch);
+    // the seek and play positions are in the transport domain, which comes before the queue's
+    interface_lock_exclusive(&thisAP->mPlay);
+    SLmillisecond pos = thisAP->mSeek.mPos;
+    if (SL_TIME_UNKNOWN != pos) {
+        thisAP->mSeek.mPos = SL_TIME_UNKNOWN;
+        // trim seek position to the current known duration
+        if (pos > thisAP->mPlay.mDuration) {
+            pos = thisAP->mPlay.mDuration;
+        }
+        thisAP->mPlay.mLastSeekPosition = pos;
+        thisAP->mPlay.mFramesSinceLastSeek = 0;
+        // seek postpones the next head at new position callback
+        thisAP->mPlay.mFramesSincePositionUpdate = 0;
+        interface_lock_exclusive(thisBQ);
+        SLuint32 count = thisBQ->mState.count;
+        if (0 < count) {
+            BufferHeader *rear = thisBQ->mFront + 1;
+            if (rear == &thisBQ->mArray[thisBQ->mNumBuffers + 1]) {
+                rear = thisBQ->mArray;
+            }
+            thisBQ->mRear = rear;
+            field_poke(thisBQ->mState.count, 1);
+            // and the mixer drops the front one at its next buffer, rather than play it out
+            thisBQ->mDiscardIndex = thisBQ->mState.playIndex;
+            thisBQ->mDiscardRequested = SL_BOOLEAN_TRUE;
+#ifdef USE_OUTPUTMIXEXT
+            audioPlayerTrackRequest(thisAP);
+#endif
+        }
+        interface_unlock_exclusive(thisBQ);
+        // the front buffer keeps its slot of the ring, and the decoder goes on after it
+        if (NULL == this->mData && 1 < count) {
+            this->mWhich = (this->mWhich + this->mDepth - count + 1) % this->mDepth;
+        }
+    }
+    interface_unlock_exclusive(&thisAP->mPlay);
+
+    if (SL_TIME_UNKNOWN != pos) {
+        if (NULL != this->mData) {
+            long long offset = ((long long) pos * this->mSfInfo.samplerate / 1000LL) *
+                STEREO_CHANNELS * sizeof(short);
+            this->mDataPos = offset < this->mDataSize ? (SLuint32) offset : this->mDataSize;
+            this->mAdvised = this->mDataPos;
+        } else {
+            sf_count_t frame = sf_seek(this->mSNDFILE, (sf_count_t) (((long long) pos *
+                this->mSfInfo.samplerate) / 1000LL), SEEK_SET);
+            // a failed seek leaves the file where it was
+            if (0 <= frame) {
+                this->mFrame = frame;
+            }
+            if (this->mConvert) {
+                SndFile_resetConverter(this);
+            }
+            // the queue starts out short, which is not the decoder being late
+            this->mPrimed = SL_BOOLEAN_FALSE;
+        }
+        field_poke(this->mEOF, SL_BOOLEAN_FALSE);
+    }
+    // publish the end of stream flag for the new position with the epoch
+    field_poke(this->mEpoch, epoch);
+}
+
+
+/** \brief Whether the loop changed since the decoder last read it.  Called with mMutex held. */
+
+static SLboolean SndFile_loopPending(struct SndFile *this)
+{
+    return field_peek(this->mLoopEpoch) != this->mLoopApplied;
+}
+
+
+/** \brief Read the loop of the seek interface into frames of the file.  A loop that ends after
+ *  the file ends at the end of file, and a loop enabled after the decoder reached the end of
+ *  file goes on from there, but the buffers already decoded ahead of the mixer play as they are.
+ *  Called with mMutex held.
+ */
+
+static void SndFile_applyLoop(CAudioPlayer *thisAP)
+{
+    struct SndFile *this = &thisAP->mSndFile;
+    SLuint32 epoch = field_peek(this->mLoopEpoch);
+    interface_lock_shared(&thisAP->mSeek);
+    SLboolean loop = thisAP->mSeek.mLoopEnabled;
+    SLmillisecond startPos = thisAP->mSeek.mStartPos;
+    SLmillisecond endPos = thisAP->mSeek.mEndPos;
+    interface_unlock_shared(&thisAP->mSeek);
+    long long frames = this->mSfInfo.frames;
+    long long start = (long long) startPos * this->mSfInfo.samplerate / 1000LL;
+    long long end = SL_TIME_UNKNOWN == endPos ? frames :
+        (long long) endPos * this->mSfInfo.samplerate / 1000LL;
+    if (end > frames) {
+        end = frames;
+    }
+    this->mLoop = loop && start < end;
+    this->mLoopStart = this->mLoop ? (SLuint32) start : 0;
+    this->mLoopEnd = this->mLoop ? (SLuint32) end : 0;
+    if (this->mLoop && field_peek(this->mEOF)) {
+        if (this->mInEOF) {
+            // take back the silence after the end of file, as the loop start follows it instead
+            SLuint32 silence = SndFile_TAPS - 2;
+            this->mInCount -= this->mInCount < silence ? this->mInCount : silence;
+            this->mInEOF = SL_BOOLEAN_FALSE;
+        }
+        field_poke(this->mEOF, SL_BOOLEAN_FALSE);
+    }
+    this->mLoopApplied = epoch;
+}
+
+
+static void SndFile_enqueue(CAudioPlayer *thisAP, SLboolean mixer);
+
+/** \brief Whether the decoder has buffers to decode, or a seek or loop to apply.  Called with
+ *  mMutex held.
+ */
+
+static SLboolean SndFile_decodePending(CAudioPlayer *thisAP)
+{
+    struct SndFile *this = &thisAP->mSndFile;
+    return SndFile_needsDecode(thisAP) || SndFile_seekPending(this) || SndFile_loopPending(this);
+}
+
+
+/** \brief Closure run on a streaming worker: decode ahead until the buffer queue is full */
+
+static void SndFile_Decode(void *context, int parameter)
+{
+    CAudioPlayer *thisAP = (CAudioPlayer *) context;
     struct SndFile *this = &thisAP->mSndFile;
+    IBufferQueue *thisBQ = &thisAP->mBufferQueue;
     SLresult result;
+    // after a seek the queue holds the old front buffer until the mixer drops it, so a queue
+    // that is full in the same pass does not count as primed
+    SLboolean seeked = SL_BOOLEAN_FALSE;
     pthread_mutex_lock(&this->mMutex);
-    if (this->mEOF) {
+    if (SndFile_seekPending(this)) {
+        SndFile_applySeek(thisAP);
+        seeked = SL_BOOLEAN_TRUE;
+    }
+    SndFile_adapt(this, field_peek(thisBQ->mState.count));
+    for (;;) {
+        // a seek takes effect between buffers, so a long decode ahead does not hold it up
+        if (SndFile_seekPending(this)) {
+            SndFile_applySeek(thisAP);
+            seeked = SL_BOOLEAN_TRUE;
+        }
+        if (SndFile_loopPending(this)) {
+            SndFile_applyLoop(thisAP);
+        }
+        // the queue only shrinks while we hold the mutex, so this count is an upper bound
+        SLuint32 count = field_peek(thisBQ->mState.count);
+        SndFile_resize(this, count);
+        if (!SndFile_needsDecode(thisAP)) {
+            if (count >= this->mDepth && !seeked) {
+                this->mPrimed = SL_BOOLEAN_TRUE;
+            }
+            break;
+        }
+        short *pBuffer = this->mBuffers[this->mWhich];
+        if (NULL == pBuffer) {
+            pBuffer = (short *) malloc(this->mFrames * STEREO_CHANNELS * sizeof(short));
+            if (NULL == pBuffer) {
+                // the next buffer completion will try again
+                SL_LOGE("no memory for decode buffer");
+                break;
+            }
+            this->mBuffers[this->mWhich] = pBuffer;
+        }
+        SLuint32 size = SndFile_read(this, pBuffer);
+        if (0 == size) {
+            SndFile_endOfStream(thisAP);
+            break;
+        }
+        if (++this->mWhich >= this->mDepth) {
+            this->mWhich = 0;
+        }
+        ++this->mInTime;
+        result = IBufferQueue_Enqueue(&thisBQ->mItf, pBuffer, size);
+        // not much we can do if the Enqueue fails, so we'll just drop the decoded data
+        if (SL_RESULT_SUCCESS != result) {
+            SL_LOGE("enqueue failed 0x%lx", result);
+            break;
+        }
+    }
+    // report the decoded buffers with the mutex unlocked, but before going idle, as that is
+    // what SndFile_Destroy waits for
+    pthread_mutex_unlock(&this->mMutex);
+    SndFile_prefetchUpdate(thisAP);
+    pthread_mutex_lock(&this->mMutex);
+    // a buffer completion, seek or loop while we were finishing could not schedule us, so check
+    // once more.  SndFile_Destroy waits for us to go idle with the mutex, and may free the
+    // player as soon as we unlock it, so the decision is made here: with more to do we stay
+    // scheduled and queue ourselves again, otherwise we go idle and no longer touch the player.
+    SLboolean more = SndFile_decodePending(thisAP);
+    if (!more) {
+        __atomic_store_n(&this->mDecodeState, SndFile_IDLE, __ATOMIC_SEQ_CST);
+        // the epochs pair with the sequentially consistent increments in SndFile_seek and
+        // SndFile_loop: one that came just before we went idle saw us scheduled, so look again,
+        // unless another thread has scheduled a new decode already
+        unsigned expected = SndFile_IDLE;
+        more = SndFile_decodePending(thisAP) && __atomic_compare_exchange_n(
+            &this->mDecodeState, &expected, SndFile_SCHEDULED, SL_BOOLEAN_FALSE,
+            __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+        if (!more) {
+            pthread_cond_broadcast(&this->mCond);
+        }
+    }
+    pthread_mutex_unlock(&this->mMutex);
+    if (more) {
+        SndFile_enqueue(thisAP, SL_BOOLEAN_FALSE);
+    }
+}
+
+
+/** \brief Start a decode closure on a streaming worker, unless one is pending or running.
+ *  mixer is true on the mixer thread, see SndFile_enqueue.
+ */
+
+static void SndFile_schedule(CAudioPlayer *thisAP, SLboolean mixer)
+{
+    struct SndFile *this = &thisAP->mSndFile;
+    unsigned expected = SndFile_IDLE;
+    if (__atomic_compare_exchange_n(&this->mDecodeState, &expected, SndFile_SCHEDULED,
+            SL_BOOLEAN_FALSE, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+        SndFile_enqueue(thisAP, mixer);
+    }
+}
+
+
+/** \brief Queue a decode closure on a streaming worker, once mDecodeState is SndFile_SCHEDULED.
+ *  The mixer thread does not start a worker thread if none can take the closure, and leaves
+ *  that to the sync thread; any other caller starts it right away.
+ */
+
+static void SndFile_enqueue(CAudioPlayer *thisAP, SLboolean mixer)
+{
+    struct SndFile *this = &thisAP->mSndFile;
+    ThreadPool *tp = &thisAP->mObject.mEngine->mThreadPool;
+    SLresult result = ThreadPool_tryAddPriority(tp, THREADPOOL_PRIORITY_STREAMING,
+        SndFile_Decode, thisAP, 0);
+    if (SL_RESULT_SUCCESS == result) {
+        if (!mixer) {
+            ThreadPool_growPending(tp);
+        }
+    } else {
+        // the pool is shutting down, or its queue is full; if the buffer queue has already
+        // drained there will be no buffer completion to try again, so leave that to the sync
+        // thread, see SndFile_retry.  It is fine to take the mutex here to wake SndFile_Destroy.
+        SL_LOGW("decode not scheduled 0x%lx", result);
+        pthread_mutex_lock(&this->mMutex);
+        __atomic_store_n(&this->mRetry, SL_BOOLEAN_TRUE, __ATOMIC_RELAXED);
+        __atomic_store_n(&this->mDecodeState, SndFile_IDLE, __ATOMIC_RELEASE);
+        pthread_cond_broadcast(&this->mCond);
         pthread_mutex_unlock(&this->mMutex);
-        return;
     }
-    short *pBuffer = &this->mBuffer[this->mWhich * SndFile_BUFSIZE];
-    if (++this->mWhich >= SndFile_NUMBUFS) {
-        this->mWhich = 0;
+}
+
+
+/** \brief Advise the kernel to read the mapped file ahead of the next block to enqueue, a window
+ *  at a time.  Called with mMutex held.
+ */
+
+static void SndFile_readahead(struct SndFile *this)
+{
+#ifdef USE_MMAP
+    // an asset decoded into memory is already resident
+    SLboolean mapped = NULL != this->mAsset ? this->mAsset->mMapped : SL_BOOLEAN_TRUE;
+    if (mapped && this->mAdvised < this->mDataSize &&
+            this->mDataPos + SndFile_READAHEAD / 2 >= this->mAdvised) {
+        uintptr_t page = (uintptr_t) sysconf(_SC_PAGESIZE);
+        uintptr_t start = (uintptr_t) &this->mData[this->mAdvised] & ~(page - 1);
+        (void) madvise((void *) start, SndFile_READAHEAD, MADV_WILLNEED);
+        this->mAdvised += SndFile_READAHEAD;
+    }
+#endif
+}
+
+
+/** \brief Enqueue blocks of a file played from memory, pointing into its data chunk, until the
+ *  buffer queue has mDepth of them.  A block ends at the loop end, and the next one starts at
+ *  the loop start, which the mixer plays straight after it.  Called on the mixer thread after
+ *  each buffer is consumed, so there is no decoder, by SndFile_seek and SndFile_loop, and by
+ *  audioPlayerTransportUpdate to start.
+ */
+
+static void SndFile_fill(CAudioPlayer *thisAP)
+{
+    struct SndFile *this = &thisAP->mSndFile;
+    IBufferQueue *thisBQ = &thisAP->mBufferQueue;
+    SLuint32 block = this->mFrames * STEREO_CHANNELS * sizeof(short);
+    pthread_mutex_lock(&this->mMutex);
+    if (SndFile_seekPending(this)) {
+        SndFile_applySeek(thisAP);
+    }
+    if (SndFile_loopPending(this)) {
+        SndFile_applyLoop(thisAP);
     }
-    sf_count_t count;
-    count = sf_read_short(this->mSNDFILE, pBuffer, (sf_count_t) SndFile_BUFSIZE);
+    while (SndFile_needsDecode(thisAP)) {
+        SLuint32 end = this->mDataSize;
+        if (this->mLoop && this->mDataPos <= this->mLoopEnd * STEREO_CHANNELS * sizeof(short)) {
+            end = this->mLoopEnd * STEREO_CHANNELS * sizeof(short);
+        }
+        SLuint32 size = end - this->mDataPos;
+        if (0 == size) {
+            if (this->mLoop) {
+                // the loop is not empty, so the next block is not either
+                this->mDataPos = this->mLoopStart * STEREO_CHANNELS * sizeof(short);
+                this->mAdvised = this->mDataPos;
+                continue;
+            }
+            SndFile_endOfStream(thisAP);
+            break;
+        }
+        if (size > block) {
+            size = block;
+        }
+        SLresult result = IBufferQueue_Enqueue(&thisBQ->mItf, &this->mData[this->mDataPos], size);
+        if (SL_RESULT_SUCCESS != result) {
+            SL_LOGE("enqueue failed 0x%lx", result);
+            break;
+        }
+        this->mDataPos += size;
+    }
+    SndFile_readahead(this);
     pthread_mutex_unlock(&this->mMutex);
+}
+
+
+/** \brief Called by IOutputMixExt::FillBuffer after each buffer is consumed.  The mixer only
+ *  consumes buffers that are already decoded; decoding and file I/O are done by SndFile_Decode.
+ */
+
+void SndFile_Callback(SLBufferQueueItf caller, void *pContext)
+{
+    CAudioPlayer *thisAP = (CAudioPlayer *) pContext;
+    SLuint32 state = field_peek(thisAP->mPlay.mState);
+    if (SL_PLAYSTATE_PLAYING != state) {
+        return;
+    }
+    struct SndFile *this = &thisAP->mSndFile;
+    if (!field_peek(this->mEOF)) {
+        if (NULL != this->mData) {
+            SndFile_fill(thisAP);
+        } else {
+            SndFile_schedule(thisAP, SL_BOOLEAN_TRUE);
+        }
+    }
+    // pairs with the fence in SndFile_endOfStream; the end of stream is for an old position
+    // while a seek is pending
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    SLboolean drained = !SndFile_seekPending(this) && field_peek(this->mEOF) &&
+        0 == field_peek(thisAP->mBufferQueue.mState.count);
     bool headAtNewPos = false;
-    object_lock_exclusive(&thisAP->mObject);
+    interface_lock_exclusive(&thisAP->mPlay);
     slPlayCallback callback = thisAP->mPlay.mCallback;
     void *context = thisAP->mPlay.mContext;
+    // the prefetch status is in the transport domain too; a file in memory is always prefetched
+    SLuint32 prefetchEvents = NULL != this->mData ? 0 : SndFile_prefetchLocked(thisAP);
+    slPrefetchCallback prefetchCallback = thisAP->mPrefetchStatus.mCallback;
+    void *prefetchContext = thisAP->mPrefetchStatus.mContext;
     // make a copy of sample rate so we are absolutely sure we will not divide by zero
     SLuint32 sampleRateMilliHz = thisAP->mSampleRateMilliHz;
     if (0 != sampleRateMilliHz) {
         // this will overflow after 49 days, but no fix possible as it's part of the API
-        thisAP->mPlay.mPosition = (SLuint32) (((long long) thisAP->mPlay.mFramesSinceLastSeek *
+        SLmillisecond position = (SLuint32) (((long long) thisAP->mPlay.mFramesSinceLastSeek *
             1000000LL) / sampleRateMilliHz) + thisAP->mPlay.mLastSeekPosition;
+        // the position of a looping player wraps at the loop end as the decoder does, unless
+        // it started after the loop, when the decoder plays on to the end of file first
+        if (thisAP->mSeek.mLoopEnabled) {
+            SLmillisecond start = thisAP->mSeek.mStartPos;
+            SLmillisecond end = thisAP->mSeek.mEndPos < thisAP->mPlay.mDuration ?
+                thisAP->mSeek.mEndPos : thisAP->mPlay.mDuration;
+            if (start < end && thisAP->mPlay.mLastSeekPosition <= end && position >= end) {
+                position = start + (position - start) % (end - start);
+            }
+        }
+        thisAP->mPlay.mPosition = position;
         // make a good faith effort for the mean time between "head at new position" callbacks to
         // occur at the requested update period, but there will be jitter
         SLuint32 frameUpdatePeriod = thisAP->mPlay.mFrameUpdatePeriod;
@@ -72,20 +908,10 @@ void SndFile_Callback(SLBufferQueueItf caller, void *pContext)
             headAtNewPos = true;
         }
     }
-    if (0 < count) {
-        object_unlock_exclusive(&thisAP->mObject);
-        SLuint32 size = (SLuint32) (count * sizeof(short));
-        result = IBufferQueue_Enqueue(caller, pBuffer, size);
-        // not much we can do if the Enqueue fails, so we'll just drop the decoded data
-        if (SL_RESULT_SUCCESS != result) {
-            SL_LOGE("enqueue failed 0x%lx", result);
-        }
+    if (drained) {
+        SndFile_drained(thisAP);
     } else {
-        thisAP->mPlay.mState = SL_PLAYSTATE_PAUSED;
-        this->mEOF = SL_BOOLEAN_TRUE;
-        // this would result in a non-monotonically increasing position, so don't do it
-        // thisAP->mPlay.mPosition = thisAP->mPlay.mDuration;
-        object_unlock_exclusive_attributes(&thisAP->mObject, ATTR_TRANSPORT);
+        interface_unlock_exclusive(&thisAP->mPlay);
     }
     // callbacks are called with mutex unlocked
     if (NULL != callback) {
@@ -93,39 +919,62 @@ void SndFile_Callback(SLBufferQueueItf caller, void *pContext)
             (*callback)(&thisAP->mPlay.mItf, context, SL_PLAYEVENT_HEADATNEWPOS);
         }
     }
+    if (0 != prefetchEvents && NULL != prefetchCallback) {
+        (*prefetchCallback)(&thisAP->mPrefetchStatus.mItf, prefetchContext, prefetchEvents);
+    }
 }
 
 
-/** \brief Check whether the supplied libsndfile format is supported by us */
+/** \brief Check whether the supplied libsndfile format is supported by us: uncompressed
+ *  samples of any size, FLAC, or Ogg Vorbis, of a rate and number of channels that
+ *  SndFile_convert handles.  The compressed formats are decoded by SndFile_Decode on a streaming
+ *  worker like any other, and only need libsndfile to be built with them.
+ */
 
 SLboolean SndFile_IsSupported(const SF_INFO *sfinfo)
 {
+    SLuint32 subtype = sfinfo->format & SF_FORMAT_SUBMASK;
     switch (sfinfo->format & SF_FORMAT_TYPEMASK) {
     case SF_FORMAT_WAV:
+    case SF_FORMAT_WAVEX:
+    case SF_FORMAT_W64:
+    case SF_FORMAT_RF64:
+    case SF_FORMAT_AIFF:
+        switch (subtype) {
+        case SF_FORMAT_PCM_S8:
+        case SF_FORMAT_PCM_U8:
+        case SF_FORMAT_PCM_16:
+        case SF_FORMAT_PCM_24:
+        case SF_FORMAT_PCM_32:
+        case SF_FORMAT_FLOAT:
+        case SF_FORMAT_DOUBLE:
+            break;
+        default:
+            return SL_BOOLEAN_FALSE;
+        }
         break;
-    default:
-        return SL_BOOLEAN_FALSE;
-    }
-    switch (sfinfo->format & SF_FORMAT_SUBMASK) {
-    case SF_FORMAT_PCM_U8:
-    case SF_FORMAT_PCM_16:
+    case SF_FORMAT_FLAC:
+        switch (subtype) {
+        case SF_FORMAT_PCM_S8:
+        case SF_FORMAT_PCM_16:
+        case SF_FORMAT_PCM_24:
+            break;
+        default:
+            return SL_BOOLEAN_FALSE;
+        }
+        break;
+    case SF_FORMAT_OGG:
+        if (SF_FORMAT_VORBIS != subtype) {
+            return SL_BOOLEAN_FALSE;
+        }
         break;
     default:
         return SL_BOOLEAN_FALSE;
     }
-    switch (sfinfo->samplerate) {
-    case 11025:
-    case 22050:
-    case 44100:
-        break;
-    default:
+    if (SndFile_MINRATE > sfinfo->samplerate || SndFile_MAXRATE < sfinfo->samplerate) {
         return SL_BOOLEAN_FALSE;
     }
-    switch (sfinfo->channels) {
-    case 1:
-    case 2:
-        break;
-    default:
+    if (1 > sfinfo->channels || SndFile_MAXCHANNELS < sfinfo->channels) {
         return SL_BOOLEAN_FALSE;
     }
     return SL_BOOLEAN_TRUE;
@@ -161,7 +1010,11 @@ SLresult SndFile_checkAudioPlayerSourceSink(CAudioPlayer *this)
             return SL_RESULT_CONTENT_UNSUPPORTED;
         }
         this->mSndFile.mPathname = uri;
-        this->mBufferQueue.mNumBuffers = SndFile_NUMBUFS;
+        IEngine *thisEngine = this->mObject.mEngine;
+        this->mSndFile.mFrames = thisEngine->mStreamFrames;
+        this->mSndFile.mMinBuffers = thisEngine->mStreamMinBuffers;
+        this->mSndFile.mMaxBuffers = thisEngine->mStreamMaxBuffers;
+        this->mBufferQueue.mNumBuffers = (SLuint16) thisEngine->mStreamMaxBuffers;
         }
         break;
     default:
@@ -169,57 +1022,150 @@ SLresult SndFile_checkAudioPlayerSourceSink(CAudioPlayer *this)
     }
     this->mSndFile.mWhich = 0;
     this->mSndFile.mSNDFILE = NULL;
-    // this->mSndFile.mMutex is initialized only when there is a valid mSNDFILE
+    this->mSndFile.mModified = 0;
+    this->mSndFile.mFileSize = -1;
+    // this->mSndFile.mMutex and mCond are initialized only when the file is open
     this->mSndFile.mEOF = SL_BOOLEAN_FALSE;
+    this->mSndFile.mDecodeState = SndFile_IDLE;
+    this->mSndFile.mRetry = SL_BOOLEAN_FALSE;
+    this->mSndFile.mSeekEpoch = 0;
+    this->mSndFile.mEpoch = 0;
+    this->mSndFile.mLoopEpoch = 0;
+    this->mSndFile.mLoopApplied = 0;
+    this->mSndFile.mLoop = SL_BOOLEAN_FALSE;
+    this->mSndFile.mFrame = 0;
+    this->mSndFile.mConvert = SL_BOOLEAN_FALSE;
+    this->mSndFile.mPrefetch = SL_BOOLEAN_FALSE;
+    this->mSndFile.mScratch = NULL;
+    this->mSndFile.mIn = NULL;
+    this->mSndFile.mBuffers = NULL;
+    this->mSndFile.mMapping = NULL;
+    this->mSndFile.mData = NULL;
+    this->mSndFile.mAsset = NULL;
 
     return SL_RESULT_SUCCESS;
 }
 
 
-/** \brief Called with mutex unlocked for marker and position updates, and play state change */
+/** \brief Check a decode-ahead buffering configuration, see SLES/OpenSLES_Vita.h */
 
-void audioPlayerTransportUpdate(CAudioPlayer *audioPlayer)
+SLboolean SndFile_checkBuffering(SLuint32 frames, SLuint32 minBuffers, SLuint32 maxBuffers)
 {
+    return SndFile_MINFRAMES <= frames && SndFile_MAXFRAMES >= frames && 2 <= minBuffers &&
+        minBuffers <= maxBuffers && SndFile_LIMITBUFS >= maxBuffers;
+}
+
 
-    if (NULL != audioPlayer->mSndFile.mSNDFILE) {
+/** \brief Set the decode-ahead buffering of an unrealized player, and size its buffer queue to
+ *  the maximum depth.  Called by slVitaSetStreamBuffering with the object locked.
+ */
 
-        object_lock_exclusive(&audioPlayer->mObject);
-        SLboolean empty = 0 == audioPlayer->mBufferQueue.mState.count;
-        // FIXME a made-up number that should depend on player state and prefetch status
-        audioPlayer->mPrefetchStatus.mLevel = 1000;
-        SLmillisecond pos = audioPlayer->mSeek.mPos;
-        if (SL_TIME_UNKNOWN != pos) {
-            audioPlayer->mSeek.mPos = SL_TIME_UNKNOWN;
-            // trim seek position to the current known duration
-            if (pos > audioPlayer->mPlay.mDuration) {
-                pos = audioPlayer->mPlay.mDuration;
+SLresult SndFile_setBuffering(CAudioPlayer *this, SLuint32 frames, SLuint32 minBuffers,
+    SLuint32 maxBuffers)
+{
+    if (!SndFile_checkBuffering(frames, minBuffers, maxBuffers)) {
+        return SL_RESULT_PARAMETER_INVALID;
+    }
+    IBufferQueue *thisBQ = &this->mBufferQueue;
+    if (maxBuffers != thisBQ->mNumBuffers) {
+        BufferHeader *array = thisBQ->mTypical;
+        if (BUFFER_HEADER_TYPICAL < maxBuffers) {
+            array = (BufferHeader *) malloc((maxBuffers + 1) * sizeof(BufferHeader));
+            if (NULL == array) {
+                return SL_RESULT_MEMORY_FAILURE;
             }
-            audioPlayer->mPlay.mLastSeekPosition = pos;
-            audioPlayer->mPlay.mFramesSinceLastSeek = 0;
-            // seek postpones the next head at new position callback
-            audioPlayer->mPlay.mFramesSincePositionUpdate = 0;
         }
-        object_unlock_exclusive(&audioPlayer->mObject);
+        if (thisBQ->mArray != thisBQ->mTypical) {
+            free(thisBQ->mArray);
+        }
+        thisBQ->mArray = array;
+        thisBQ->mFront = array;
+        thisBQ->mRear = array;
+        thisBQ->mNumBuffers = (SLuint16) maxBuffers;
+    }
+    this->mSndFile.mFrames = frames;
+    this->mSndFile.mMinBuffers = minBuffers;
+    this->mSndFile.mMaxBuffers = maxBuffers;
+    return SL_RESULT_SUCCESS;
+}
+
+
+/** \brief Called by ISeek::SetPosition after it stored the seek position, and by
+ *  audioPlayerTransportUpdate for one it finds pending.  The seek is handed to the decoder
+ *  right away, rather than waiting for the sync thread, and applied by SndFile_applySeek.
+ */
 
-        if (SL_TIME_UNKNOWN != pos) {
+void SndFile_seek(CAudioPlayer *audioPlayer)
+{
+    struct SndFile *this = &audioPlayer->mSndFile;
+    if (SndFile_isOpen(this)) {
+        // pairs with the check for a pending seek after the decoder goes idle
+        __atomic_add_fetch(&this->mSeekEpoch, 1, __ATOMIC_SEQ_CST);
+        if (NULL != this->mData) {
+            SndFile_fill(audioPlayer);
+        } else {
+            SndFile_schedule(audioPlayer, SL_BOOLEAN_FALSE);
+        }
+    }
+}
 
-            // discard any enqueued buffers for the old position
-            IBufferQueue_Clear(&audioPlayer->mBufferQueue.mItf);
-            empty = SL_BOOLEAN_TRUE;
 
-            pthread_mutex_lock(&audioPlayer->mSndFile.mMutex);
-            // FIXME why void?
-            (void) sf_seek(audioPlayer->mSndFile.mSNDFILE, (sf_count_t) (((long long) pos *
-                audioPlayer->mSndFile.mSfInfo.samplerate) / 1000LL), SEEK_SET);
-            audioPlayer->mSndFile.mEOF = SL_BOOLEAN_FALSE;
-            audioPlayer->mSndFile.mWhich = 0;
-            pthread_mutex_unlock(&audioPlayer->mSndFile.mMutex);
+/** \brief Called by ISeek::SetLoop after it stored the loop, which the decoder reads before its
+ *  next buffer.  The decoder is started in case it had stopped at the end of file.
+ */
 
+void SndFile_loop(CAudioPlayer *audioPlayer)
+{
+    struct SndFile *this = &audioPlayer->mSndFile;
+    if (SndFile_isOpen(this)) {
+        // pairs with the check for a loop change after the decoder goes idle
+        __atomic_add_fetch(&this->mLoopEpoch, 1, __ATOMIC_SEQ_CST);
+        if (NULL != this->mData) {
+            SndFile_fill(audioPlayer);
+        } else {
+            SndFile_schedule(audioPlayer, SL_BOOLEAN_FALSE);
         }
+    }
+}
+
+
+/** \brief Called by the sync thread for each audio player, to schedule a decode that could not
+ *  be queued before
+ */
+
+void SndFile_retry(CAudioPlayer *audioPlayer)
+{
+    struct SndFile *this = &audioPlayer->mSndFile;
+    // only set once the file is open
+    if (__atomic_load_n(&this->mRetry, __ATOMIC_RELAXED) &&
+            __atomic_exchange_n(&this->mRetry, SL_BOOLEAN_FALSE, __ATOMIC_ACQUIRE)) {
+        SndFile_schedule(audioPlayer, SL_BOOLEAN_FALSE);
+    }
+}
+
+
+/** \brief Called with mutex unlocked for marker and position updates, and play state change */
+
+void audioPlayerTransportUpdate(CAudioPlayer *audioPlayer)
+{
+
+    struct SndFile *this = &audioPlayer->mSndFile;
+    if (SndFile_isOpen(this)) {
+
+        // the play state, seek position and prefetch status are all in the transport domain;
+        // ISeek::SetPosition normally handed the seek to the decoder already
+        interface_lock_exclusive(&audioPlayer->mPlay);
+        SLboolean seek = SL_TIME_UNKNOWN != audioPlayer->mSeek.mPos;
+        interface_unlock_exclusive(&audioPlayer->mPlay);
 
         // FIXME only on seek or play state change (STOPPED, PAUSED) -> PLAYING
-        if (empty) {
-            SndFile_Callback(&audioPlayer->mBufferQueue.mItf, audioPlayer);
+        // the decoder does nothing unless the player is playing or paused and the queue has room
+        if (seek) {
+            SndFile_seek(audioPlayer);
+        } else if (NULL != this->mData) {
+            SndFile_fill(audioPlayer);
+        } else {
+            SndFile_schedule(audioPlayer, SL_BOOLEAN_FALSE);
         }
 
     }
@@ -227,39 +1173,397 @@ void audioPlayerTransportUpdate(CAudioPlayer *audioPlayer)
 }
 
 
-/** \brief Called by CAudioPlayer_Realize */
+/** \brief Little-endian fields of a RIFF header */
 
-SLresult SndFile_Realize(CAudioPlayer *this)
+static SLuint32 SndFile_le16(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static SLuint32 SndFile_le32(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((SLuint32) p[3] << 24);
+}
+
+
+/** \brief Find the data chunk of a WAV file of 16-bit stereo PCM at the output rate, which the
+ *  mixer can play as it is, and return its whole frames in pData and pDataSize.  Returns
+ *  SL_BOOLEAN_FALSE for anything else, including a fmt chunk that does not come before the data
+ *  chunk.
+ */
+
+static SLboolean SndFile_parseWav(const unsigned char *p, size_t size, SLuint32 outputRate,
+    const char **pData, SLuint32 *pDataSize)
+{
+    if (12 > size || memcmp(p, "RIFF", 4) || memcmp(&p[8], "WAVE", 4)) {
+        return SL_BOOLEAN_FALSE;
+    }
+    SLboolean playable = SL_BOOLEAN_FALSE;
+    size_t offset = 12;
+    while (8 <= size - offset) {
+        const unsigned char *chunk = &p[offset];
+        size_t length = SndFile_le32(&chunk[4]);
+        offset += 8;
+        if (!memcmp(chunk, "fmt ", 4)) {
+            if (16 > length || 16 > size - offset) {
+                return SL_BOOLEAN_FALSE;
+            }
+            playable = 1 == SndFile_le16(&chunk[8]) &&                  // PCM
+                STEREO_CHANNELS == SndFile_le16(&chunk[10]) &&
+                outputRate == SndFile_le32(&chunk[12]) &&
+                STEREO_CHANNELS * sizeof(short) == SndFile_le16(&chunk[20]) &&  // block align
+                16 == SndFile_le16(&chunk[22]);                         // bits per sample
+            if (!playable) {
+                return SL_BOOLEAN_FALSE;
+            }
+        } else if (!memcmp(chunk, "data", 4)) {
+            // the mixer reads whole 16-bit samples
+            if (!playable || 0 != (offset & 1)) {
+                return SL_BOOLEAN_FALSE;
+            }
+            // a truncated file plays what it has
+            if (length > size - offset) {
+                length = size - offset;
+            }
+            *pData = (const char *) &p[offset];
+            *pDataSize = length & ~(STEREO_CHANNELS * sizeof(short) - 1);
+            return SL_BOOLEAN_TRUE;
+        }
+        // chunks are padded to an even length
+        if (length > size - offset) {
+            break;
+        }
+        offset += length + (length & 1);
+        if (offset > size) {
+            break;
+        }
+    }
+    return SL_BOOLEAN_FALSE;
+}
+
+
+/** \brief Map a file, or without USE_MMAP read a file of up to maxLoad bytes into memory.
+ *  Returns NULL if the file cannot be opened or is too large to read.
+ */
+
+static void *SndFile_mapFile(const char *path, size_t maxLoad, size_t *pSize)
+{
+    int fd = open(path, O_RDONLY);
+    if (0 > fd) {
+        return NULL;
+    }
+    struct stat st;
+    if (0 != fstat(fd, &st) || !S_ISREG(st.st_mode) || 12 > st.st_size ||
+            (off_t) (SLuint32) st.st_size != st.st_size) {
+        (void) close(fd);
+        return NULL;
+    }
+    size_t size = (size_t) st.st_size;
+#ifdef USE_MMAP
+    (void) maxLoad;
+    void *mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    (void) close(fd);
+    if (MAP_FAILED == mapping) {
+        return NULL;
+    }
+#else
+    void *mapping = maxLoad >= size ? malloc(size) : NULL;
+    size_t count = 0;
+    while (NULL != mapping && count < size) {
+        ssize_t n = read(fd, (char *) mapping + count, size - count);
+        if (0 >= n) {
+            free(mapping);
+            mapping = NULL;
+            break;
+        }
+        count += n;
+    }
+    (void) close(fd);
+    if (NULL == mapping) {
+        return NULL;
+    }
+#endif
+    *pSize = size;
+    return mapping;
+}
+
+
+/** \brief Undo SndFile_mapFile */
+
+static void SndFile_unmapFile(void *mapping, size_t size)
+{
+#ifdef USE_MMAP
+    (void) munmap(mapping, size);
+#else
+    free(mapping);
+#endif
+}
+
+
+/** \brief Describe the data of a file played from memory, which is in the output format */
+
+static void SndFile_setDataInfo(struct SndFile *this, SLuint32 outputRate)
+{
+    this->mSfInfo.format = SF_FORMAT_WAV | SF_FORMAT_PCM_16;
+    this->mSfInfo.channels = STEREO_CHANNELS;
+    this->mSfInfo.samplerate = outputRate;
+    this->mSfInfo.frames = this->mDataSize / (STEREO_CHANNELS * sizeof(short));
+    this->mDataPos = 0;
+    this->mAdvised = 0;
+}
+
+
+/** \brief Map a PCM WAV file that the mixer can play as it is, so that its data chunk is enqueued
+ *  without decoding or copying.  Without USE_MMAP, a file of up to SndFile_MAXLOAD bytes is read
+ *  into memory instead.  Returns SL_BOOLEAN_FALSE if the file is to be decoded by libsndfile.
+ */
+
+static SLboolean SndFile_map(struct SndFile *this, SLuint32 outputRate)
+{
+    size_t size;
+    void *mapping = SndFile_mapFile((const char *) this->mPathname, SndFile_MAXLOAD, &size);
+    if (NULL == mapping) {
+        return SL_BOOLEAN_FALSE;
+    }
+    if (!SndFile_parseWav((const unsigned char *) mapping, size, outputRate, &this->mData,
+            &this->mDataSize)) {
+        SndFile_unmapFile(mapping, size);
+        this->mData = NULL;
+        return SL_BOOLEAN_FALSE;
+    }
+    this->mMapping = mapping;
+    this->mMappingSize = size;
+    SndFile_setDataInfo(this, outputRate);
+#ifdef USE_MMAP
+    (void) madvise(mapping, size, MADV_SEQUENTIAL);
+#endif
+    return SL_BOOLEAN_TRUE;
+}
+
+
+/** \brief Undo SndFile_map */
+
+static void SndFile_unmap(struct SndFile *this)
+{
+    SndFile_unmapFile(this->mMapping, this->mMappingSize);
+    this->mMapping = NULL;
+    this->mData = NULL;
+}
+
+
+/** \brief The output rate, at which files are played as 16-bit stereo */
+
+SLuint32 SndFile_outputRate(void)
+{
+    return &_opensles_user_freq != NULL ? _opensles_user_freq : 44100;
+}
+
+
+/** \brief Called by SndFileCache_acquire, without the cache mutex, to load the whole of the file
+ *  of a new asset.  A PCM WAV file in the output format is mapped or read as it is, and any
+ *  other file is decoded.  Returns SL_RESULT_BUFFER_INSUFFICIENT if the data would be larger
+ *  than maxBytes, and otherwise the result that SndFile_Realize would have for the file.
+ */
+
+SLresult SndFile_loadAsset(struct SndFileAsset *asset, size_t maxBytes)
+{
+    SLuint32 outputRate = SndFile_outputRate();
+    size_t size;
+    void *mapping = SndFile_mapFile(asset->mPath, maxBytes, &size);
+    if (NULL != mapping) {
+        if (SndFile_parseWav((const unsigned char *) mapping, size, outputRate, &asset->mData,
+                &asset->mDataSize) && maxBytes >= asset->mDataSize) {
+            asset->mStorage = mapping;
+            asset->mStorageSize = size;
+#ifdef USE_MMAP
+            asset->mMapped = SL_BOOLEAN_TRUE;
+#else
+            asset->mMapped = SL_BOOLEAN_FALSE;
+#endif
+            return SL_RESULT_SUCCESS;
+        }
+        SndFile_unmapFile(mapping, size);
+        asset->mData = NULL;
+    }
+    // decode through a private stream, converting a buffer at a time in place
+    struct SndFile file;
+    memset(&file, 0, sizeof(file));
+    file.mSNDFILE = sf_open(asset->mPath, SFM_READ, &file.mSfInfo);
+    if (NULL == file.mSNDFILE) {
+        return SL_RESULT_CONTENT_NOT_FOUND;
+    }
+    SLresult result = SL_RESULT_SUCCESS;
+    if (!SndFile_IsSupported(&file.mSfInfo)) {
+        result = SL_RESULT_CONTENT_UNSUPPORTED;
+    } else {
+        file.mFrames = SndFile_FRAMES;
+        // the resampler may make one more frame than the rounded up ratio
+        unsigned long long bytes = (((unsigned long long) file.mSfInfo.frames * outputRate +
+            file.mSfInfo.samplerate - 1) / file.mSfInfo.samplerate + 1) *
+            STEREO_CHANNELS * sizeof(short);
+        if (0 > file.mSfInfo.frames || maxBytes < bytes) {
+            result = SL_RESULT_BUFFER_INSUFFICIENT;
+        } else if (SL_RESULT_SUCCESS != (result = SndFile_initConverter(&file, outputRate))) {
+            // no memory
+        } else {
+            // one more buffer, in case the file has more frames than it said
+            size_t block = file.mFrames * STEREO_CHANNELS * sizeof(short);
+            char *pcm = (char *) malloc((size_t) bytes + block);
+            if (NULL == pcm) {
+                result = SL_RESULT_MEMORY_FAILURE;
+            } else {
+                size_t count = 0;
+                while (count <= bytes) {
+                    SLuint32 n = SndFile_read(&file, (short *) &pcm[count]);
+                    if (0 == n) {
+                        break;
+                    }
+                    count += n;
+                }
+                asset->mStorage = pcm;
+                asset->mStorageSize = (size_t) bytes + block;
+                asset->mMapped = SL_BOOLEAN_FALSE;
+                asset->mData = pcm;
+                asset->mDataSize = (SLuint32) count;
+            }
+            SndFile_deinitConverter(&file);
+        }
+    }
+    sf_close(file.mSNDFILE);
+    return result;
+}
+
+
+/** \brief Free the data of a loaded asset */
+
+void SndFile_unloadAsset(struct SndFileAsset *asset)
+{
+    if (asset->mMapped) {
+        SndFile_unmapFile(asset->mStorage, asset->mStorageSize);
+    } else {
+        free(asset->mStorage);
+    }
+    asset->mStorage = NULL;
+    asset->mData = NULL;
+}
+
+
+/** \brief Open the file of a URI player: take the engine's decoded copy of it, map it, or open
+ *  it through libsndfile and parse its header.  This is the slow part of Realize, which an
+ *  asynchronous Realize does while it can still be aborted.  Called by IObject_RealizeQueued
+ *  and SndFile_Realize with the object unlocked.
+ */
+
+SLresult SndFile_Open(CAudioPlayer *this)
 {
     SLresult result = SL_RESULT_SUCCESS;
-    if (NULL != this->mSndFile.mPathname) {
-        this->mSndFile.mSfInfo.format = 0;
-        this->mSndFile.mSNDFILE = sf_open(
-            (const char *) this->mSndFile.mPathname, SFM_READ, &this->mSndFile.mSfInfo);
-        if (NULL == this->mSndFile.mSNDFILE) {
-            result = SL_RESULT_CONTENT_NOT_FOUND;
-        } else if (!SndFile_IsSupported(&this->mSndFile.mSfInfo)) {
-            sf_close(this->mSndFile.mSNDFILE);
-            this->mSndFile.mSNDFILE = NULL;
-            result = SL_RESULT_CONTENT_UNSUPPORTED;
+    if (NULL != this->mSndFile.mPathname && !SndFile_isOpen(&this->mSndFile)) {
+        // the file is played as 16-bit stereo at the output rate, so the buffer queue
+        // does no conversion of its own, and the mixer counts frames at the output rate
+        SLuint32 outputRate = SndFile_outputRate();
+        SndFileCache *cache = &this->mObject.mEngine->mSndFileCache;
+        const char *path = (const char *) this->mSndFile.mPathname;
+        struct SndFileAsset *asset;
+        if (SL_RESULT_SUCCESS == SndFileCache_acquire(cache, path, &asset)) {
+            // played from the engine's copy
+            this->mSndFile.mAsset = asset;
+            this->mSndFile.mData = asset->mData;
+            this->mSndFile.mDataSize = asset->mDataSize;
+            SndFile_setDataInfo(&this->mSndFile, outputRate);
+        } else if (SndFile_map(&this->mSndFile, outputRate)) {
+            // played from memory
         } else {
-            int ok;
-            ok = pthread_mutex_init(&this->mSndFile.mMutex, (const pthread_mutexattr_t *) NULL);
-            assert(0 == ok);
-            SLBufferQueueItf bufferQueue = &this->mBufferQueue.mItf;
-            IBufferQueue *thisBQ = (IBufferQueue *) bufferQueue;
-            IBufferQueue_RegisterCallback(&thisBQ->mItf, SndFile_Callback, this);
+            this->mSndFile.mSNDFILE = SndFileCache_openHandle(cache, path,
+                &this->mSndFile.mSfInfo, &this->mSndFile.mModified, &this->mSndFile.mFileSize);
+            if (NULL == this->mSndFile.mSNDFILE) {
+                result = SL_RESULT_CONTENT_NOT_FOUND;
+            } else if (!SndFile_IsSupported(&this->mSndFile.mSfInfo)) {
+                result = SL_RESULT_CONTENT_UNSUPPORTED;
+            } else if (NULL == (this->mSndFile.mBuffers = (short **) calloc(
+                    this->mSndFile.mMaxBuffers, sizeof(short *)))) {
+                result = SL_RESULT_MEMORY_FAILURE;
+            } else {
+                result = SndFile_initConverter(&this->mSndFile, outputRate);
+            }
+            if (SL_RESULT_SUCCESS != result && NULL != this->mSndFile.mSNDFILE) {
+                free(this->mSndFile.mBuffers);
+                this->mSndFile.mBuffers = NULL;
+                sf_close(this->mSndFile.mSNDFILE);
+                this->mSndFile.mSNDFILE = NULL;
+            }
+        }
+    }
+    return result;
+}
+
+
+/** \brief Undo SndFile_Open.  A file opened through libsndfile is kept open by the engine for the
+ *  next player of the same file.  Called by IObject_RealizeQueued for an aborted Realize, and by
+ *  SndFile_Destroy once the decoder is shut down.
+ */
+
+void SndFile_Close(CAudioPlayer *this)
+{
+    if (NULL != this->mSndFile.mAsset) {
+        SndFileCache_release(&this->mObject.mEngine->mSndFileCache, this->mSndFile.mAsset);
+        this->mSndFile.mAsset = NULL;
+        this->mSndFile.mData = NULL;
+    } else if (NULL != this->mSndFile.mData) {
+        SndFile_unmap(&this->mSndFile);
+    } else if (NULL != this->mSndFile.mSNDFILE) {
+        SndFileCache_closeHandle(&this->mObject.mEngine->mSndFileCache,
+            (const char *) this->mSndFile.mPathname, this->mSndFile.mModified,
+            this->mSndFile.mFileSize, this->mSndFile.mSNDFILE, &this->mSndFile.mSfInfo);
+        this->mSndFile.mSNDFILE = NULL;
+        SLuint32 i;
+        for (i = 0; i < this->mSndFile.mMaxBuffers; ++i) {
+            free(this->mSndFile.mBuffers[i]);
+        }
+        free(this->mSndFile.mBuffers);
+        this->mSndFile.mBuffers = NULL;
+        SndFile_deinitConverter(&this->mSndFile);
+    }
+}
+
+
+/** \brief Called by CAudioPlayer_Realize, after SndFile_Open for an asynchronous Realize */
+
+SLresult SndFile_Realize(CAudioPlayer *this)
+{
+    SLresult result = SndFile_Open(this);
+    if (SL_RESULT_SUCCESS == result && NULL != this->mSndFile.mPathname) {
+        SLuint32 outputRate = SndFile_outputRate();
+        this->mSndFile.mDepth = this->mSndFile.mMinBuffers;
+        this->mSndFile.mTargetDepth = this->mSndFile.mMinBuffers;
+        this->mSndFile.mInTime = 0;
+        this->mSndFile.mPrimed = SL_BOOLEAN_FALSE;
+        int ok;
+        ok = pthread_mutex_init(&this->mSndFile.mMutex, (const pthread_mutexattr_t *) NULL);
+        assert(0 == ok);
+        ok = pthread_cond_init(&this->mSndFile.mCond, (const pthread_condattr_t *) NULL);
+        assert(0 == ok);
+        SLBufferQueueItf bufferQueue = &this->mBufferQueue.mItf;
+        IBufferQueue *thisBQ = (IBufferQueue *) bufferQueue;
+        IBufferQueue_RegisterCallback(&thisBQ->mItf, SndFile_Callback, this);
+        // a file in memory is all prefetched, while a stream starts prefetching when paused
+        this->mSndFile.mPrefetch = IsInterfaceInitialized(&this->mObject, MPH_PREFETCHSTATUS);
+        if (this->mSndFile.mPrefetch && NULL != this->mSndFile.mData) {
             this->mPrefetchStatus.mStatus = SL_PREFETCHSTATUS_SUFFICIENTDATA;
-            // this is the initial duration; will update when a new maximum position is detected
-            this->mPlay.mDuration = (SLmillisecond) (((long long) this->mSndFile.mSfInfo.frames *
-                1000LL) / this->mSndFile.mSfInfo.samplerate);
-            this->mNumChannels = this->mSndFile.mSfInfo.channels;
-            this->mSampleRateMilliHz = this->mSndFile.mSfInfo.samplerate * 1000;
+            this->mPrefetchStatus.mLevel = 1000;
+            this->mPrefetchStatus.mReportedLevel = 1000;
+        }
+        // this is the initial duration; will update when a new maximum position is detected
+        this->mPlay.mDuration = (SLmillisecond) (((long long) this->mSndFile.mSfInfo.frames *
+            1000LL) / this->mSndFile.mSfInfo.samplerate);
+        this->mBufferQueue.samplerate = outputRate * 1000;
+        this->mBufferQueue.channels = STEREO_CHANNELS;
+        this->mBufferQueue.bps = 16;
+        this->mNumChannels = STEREO_CHANNELS;
+        this->mSampleRateMilliHz = outputRate * 1000;
 #ifdef USE_OUTPUTMIXEXT
-            this->mPlay.mFrameUpdatePeriod = ((long long) this->mPlay.mPositionUpdatePeriod *
-                (long long) this->mSampleRateMilliHz) / 1000000LL;
+        this->mPlay.mFrameUpdatePeriod = ((long long) this->mPlay.mPositionUpdatePeriod *
+            (long long) this->mSampleRateMilliHz) / 1000000LL;
 #endif
-        }
     }
     return result;
 }
@@ -269,10 +1573,22 @@ SLresult SndFile_Realize(CAudioPlayer *this)
 
 void SndFile_Destroy(CAudioPlayer *this)
 {
-    if (NULL != this->mSndFile.mSNDFILE) {
-        sf_close(this->mSndFile.mSNDFILE);
-        this->mSndFile.mSNDFILE = NULL;
+    if (SndFile_isOpen(&this->mSndFile)) {
+        // wait for a decode closure that is pending or running, and keep new ones from starting
+        pthread_mutex_lock(&this->mSndFile.mMutex);
+        for (;;) {
+            unsigned expected = SndFile_IDLE;
+            if (__atomic_compare_exchange_n(&this->mSndFile.mDecodeState, &expected,
+                    SndFile_SHUTDOWN, SL_BOOLEAN_FALSE, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+                break;
+            }
+            pthread_cond_wait(&this->mSndFile.mCond, &this->mSndFile.mMutex);
+        }
+        pthread_mutex_unlock(&this->mSndFile.mMutex);
+        SndFile_Close(this);
         int ok;
+        ok = pthread_cond_destroy(&this->mSndFile.mCond);
+        assert(0 == ok);
         ok = pthread_mutex_destroy(&this->mSndFile.mMutex);
         assert(0 == ok);
     }
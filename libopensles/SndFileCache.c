@@ -0,0 +1,528 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** \file SndFileCache.c Decoded assets shared by the file players of an engine */
+
+#include "sles_allinclusive.h"
+#include <sys/stat.h>
+
+
+/** \brief A preload queued on the engine's thread pool by slVitaPreloadAsset */
+
+struct SndFilePreload {
+    struct SndFilePreload *mNext;   // in SndFileCache::mPreloads
+    struct SndFilePreload *mPrev;
+    SndFileCache *mCache;
+    slVitaPreloadCallback mCallback;
+    void *mContext;
+    char *mPath;                    // stored after the preload, in the same allocation
+};
+
+
+/** \brief A file that a streaming player opened through libsndfile, kept open after the player
+ *  is gone so that the next player of the file does not open it and parse its header again
+ */
+
+struct SndFileHandle {
+    struct SndFileHandle *mNext;    // in SndFileCache::mHandles
+    char *mPath;                    // stored after the handle, in the same allocation
+    time_t mModified;               // with the path and size, the file the handle is for
+    off_t mFileSize;
+    SNDFILE *mSNDFILE;
+    SF_INFO mSfInfo;
+};
+
+
+/** \brief Called by IEngine_init */
+
+void SndFileCache_init(SndFileCache *this)
+{
+    int ok;
+    ok = pthread_mutex_init(&this->mMutex, (const pthread_mutexattr_t *) NULL);
+    assert(0 == ok);
+    ok = pthread_cond_init(&this->mCond, (const pthread_condattr_t *) NULL);
+    assert(0 == ok);
+    this->mHead = NULL;
+    this->mTail = NULL;
+    this->mBytes = 0;
+    this->mFailures = 0;
+    this->mBudget = SndFileCache_BUDGET;
+    this->mPreloads = NULL;
+    this->mHandles = NULL;
+    this->mHandleCount = 0;
+}
+
+
+/** \brief Free an asset that is no longer in the cache and no longer used */
+
+static void SndFileAsset_free(struct SndFileAsset *asset)
+{
+    assert(!asset->mCached && 0 == asset->mRefCount);
+    if (SndFileAsset_READY == asset->mState) {
+        SndFile_unloadAsset(asset);
+    }
+    free(asset);
+}
+
+
+/** \brief Make an asset the most recently used.  Called with mMutex held. */
+
+static void SndFileCache_link(SndFileCache *this, struct SndFileAsset *asset)
+{
+    asset->mPrev = NULL;
+    asset->mNext = this->mHead;
+    if (NULL != this->mHead) {
+        this->mHead->mPrev = asset;
+    } else {
+        this->mTail = asset;
+    }
+    this->mHead = asset;
+}
+
+
+/** \brief Undo SndFileCache_link.  Called with mMutex held. */
+
+static void SndFileCache_unlink(SndFileCache *this, struct SndFileAsset *asset)
+{
+    if (NULL != asset->mPrev) {
+        asset->mPrev->mNext = asset->mNext;
+    } else {
+        this->mHead = asset->mNext;
+    }
+    if (NULL != asset->mNext) {
+        asset->mNext->mPrev = asset->mPrev;
+    } else {
+        this->mTail = asset->mPrev;
+    }
+    asset->mNext = NULL;
+    asset->mPrev = NULL;
+}
+
+
+/** \brief Take an asset out of the cache, and free it unless it is still used.
+ *  Called with mMutex held.
+ */
+
+static void SndFileCache_remove(SndFileCache *this, struct SndFileAsset *asset)
+{
+    SndFileCache_unlink(this, asset);
+    asset->mCached = SL_BOOLEAN_FALSE;
+    if (SndFileAsset_READY == asset->mState) {
+        assert(this->mBytes >= asset->mDataSize);
+        this->mBytes -= asset->mDataSize;
+    } else if (SndFileAsset_FAILED == asset->mState) {
+        assert(0 < this->mFailures);
+        --this->mFailures;
+    }
+    if (0 == asset->mRefCount) {
+        SndFileAsset_free(asset);
+    }
+}
+
+
+/** \brief Free unused assets, least recently used first, until the cache is within its budget,
+ *  and forget the least recently used failures beyond SndFileCache_FAILURES.
+ *  Called with mMutex held.
+ */
+
+static void SndFileCache_evict(SndFileCache *this)
+{
+    struct SndFileAsset *asset = this->mTail;
+    while ((this->mBytes > this->mBudget || this->mFailures > SndFileCache_FAILURES) &&
+            NULL != asset) {
+        struct SndFileAsset *prev = asset->mPrev;
+        if (0 == asset->mRefCount) {
+            if (SndFileAsset_READY == asset->mState && this->mBytes > this->mBudget) {
+                SL_LOGV("evicting %s", asset->mPath);
+                SndFileCache_remove(this, asset);
+            } else if (SndFileAsset_FAILED == asset->mState &&
+                    this->mFailures > SndFileCache_FAILURES) {
+                SndFileCache_remove(this, asset);
+            }
+        }
+        asset = prev;
+    }
+}
+
+
+/** \brief Called by IEngine_deinit, after the thread pool has stopped.  Preloads that never ran
+ *  are freed without calling their callbacks.
+ */
+
+void SndFileCache_deinit(SndFileCache *this)
+{
+    while (NULL != this->mPreloads) {
+        struct SndFilePreload *preload = this->mPreloads;
+        this->mPreloads = preload->mNext;
+        free(preload);
+    }
+    while (NULL != this->mHead) {
+        struct SndFileAsset *asset = this->mHead;
+        if (0 != asset->mRefCount) {
+            // a player outlived the engine; it will find its asset gone
+            SL_LOGE("asset %s still used by %lu players", asset->mPath, asset->mRefCount);
+            asset->mRefCount = 0;
+        }
+        SndFileCache_remove(this, asset);
+    }
+    while (NULL != this->mHandles) {
+        struct SndFileHandle *handle = this->mHandles;
+        this->mHandles = handle->mNext;
+        sf_close(handle->mSNDFILE);
+        free(handle);
+    }
+    this->mHandleCount = 0;
+    int ok;
+    ok = pthread_cond_destroy(&this->mCond);
+    assert(0 == ok);
+    ok = pthread_mutex_destroy(&this->mMutex);
+    assert(0 == ok);
+}
+
+
+/** \brief Find the asset of a path.  Called with mMutex held. */
+
+static struct SndFileAsset *SndFileCache_find(SndFileCache *this, const char *path)
+{
+    struct SndFileAsset *asset;
+    for (asset = this->mHead; NULL != asset; asset = asset->mNext) {
+        if (!strcmp(asset->mPath, path)) {
+            break;
+        }
+    }
+    return asset;
+}
+
+
+/** \brief Get a reference to the asset of a file, loading the file if the cache does not have the
+ *  current version of it.  Concurrent callers for the same file wait for the first one to load
+ *  it.  A file that could not be loaded is remembered, so the same error is returned until the
+ *  file changes, unless it ran out of memory, which a later acquire may not.  Called by
+ *  SndFile_Open.
+ */
+
+SLresult SndFileCache_acquire(SndFileCache *this, const char *path,
+    struct SndFileAsset **pAsset)
+{
+    *pAsset = NULL;
+    if (0 == this->mBudget) {
+        return SL_RESULT_FEATURE_UNSUPPORTED;
+    }
+    struct stat st;
+    if (0 != stat(path, &st) || !S_ISREG(st.st_mode)) {
+        return SL_RESULT_CONTENT_NOT_FOUND;
+    }
+
+    SLresult result;
+    int ok;
+    ok = pthread_mutex_lock(&this->mMutex);
+    assert(0 == ok);
+    struct SndFileAsset *asset;
+    for (;;) {
+        asset = SndFileCache_find(this, path);
+        if (NULL == asset) {
+            break;
+        }
+        if (SndFileAsset_LOADING == asset->mState) {
+            // keep it from being freed if the load fails
+            ++asset->mRefCount;
+            do {
+                ok = pthread_cond_wait(&this->mCond, &this->mMutex);
+                assert(0 == ok);
+            } while (SndFileAsset_LOADING == asset->mState);
+            --asset->mRefCount;
+            if (!asset->mCached) {
+                // replaced by a newer version while we waited, or failed to load for want of
+                // memory, so look again
+                if (0 == asset->mRefCount) {
+                    SndFileAsset_free(asset);
+                }
+                continue;
+            }
+        }
+        if (asset->mModified != st.st_mtime || asset->mFileSize != st.st_size) {
+            // the file changed; the players of the old version keep it until they are done
+            SndFileCache_remove(this, asset);
+            asset = NULL;
+            break;
+        }
+        SndFileCache_unlink(this, asset);
+        SndFileCache_link(this, asset);
+        if (SndFileAsset_READY == asset->mState) {
+            ++asset->mRefCount;
+            *pAsset = asset;
+            result = SL_RESULT_SUCCESS;
+        } else {
+            result = asset->mResult;
+        }
+        ok = pthread_mutex_unlock(&this->mMutex);
+        assert(0 == ok);
+        return result;
+    }
+
+    // the path is stored after the asset, in the same allocation
+    size_t length = strlen(path);
+    asset = (struct SndFileAsset *) calloc(1, sizeof(struct SndFileAsset) + length + 1);
+    if (NULL == asset) {
+        ok = pthread_mutex_unlock(&this->mMutex);
+        assert(0 == ok);
+        return SL_RESULT_MEMORY_FAILURE;
+    }
+    asset->mPath = (char *) &asset[1];
+    memcpy(asset->mPath, path, length + 1);
+    asset->mModified = st.st_mtime;
+    asset->mFileSize = st.st_size;
+    asset->mState = SndFileAsset_LOADING;
+    asset->mRefCount = 1;
+    asset->mCached = SL_BOOLEAN_TRUE;
+    SndFileCache_link(this, asset);
+    ok = pthread_mutex_unlock(&this->mMutex);
+    assert(0 == ok);
+
+    // any one asset may use a quarter of the budget, so that a few of them fit
+    result = SndFile_loadAsset(asset, this->mBudget / 4);
+
+    ok = pthread_mutex_lock(&this->mMutex);
+    assert(0 == ok);
+    if (SL_RESULT_SUCCESS == result) {
+        asset->mState = SndFileAsset_READY;
+        if (asset->mCached) {
+            this->mBytes += asset->mDataSize;
+            SndFileCache_evict(this);
+        }
+        *pAsset = asset;
+    } else {
+        asset->mState = SndFileAsset_FAILED;
+        asset->mResult = result;
+        if (asset->mCached) {
+            if (SL_RESULT_MEMORY_FAILURE == result) {
+                // the next acquire loads the file again, as there may be memory by then
+                SndFileCache_unlink(this, asset);
+                asset->mCached = SL_BOOLEAN_FALSE;
+            } else {
+                ++this->mFailures;
+            }
+        }
+        if (--asset->mRefCount == 0 && !asset->mCached) {
+            SndFileAsset_free(asset);
+        } else if (asset->mCached) {
+            // failures take no bytes, but there are only so many of them kept
+            SndFileCache_evict(this);
+        }
+    }
+    ok = pthread_cond_broadcast(&this->mCond);
+    assert(0 == ok);
+    ok = pthread_mutex_unlock(&this->mMutex);
+    assert(0 == ok);
+    return result;
+}
+
+
+/** \brief Give back a reference from SndFileCache_acquire.  An unused asset stays in the cache
+ *  while the cache is within its budget.  Called by SndFile_Destroy.
+ */
+
+void SndFileCache_release(SndFileCache *this, struct SndFileAsset *asset)
+{
+    int ok;
+    ok = pthread_mutex_lock(&this->mMutex);
+    assert(0 == ok);
+    assert(0 < asset->mRefCount);
+    if (0 == --asset->mRefCount) {
+        if (!asset->mCached) {
+            SndFileAsset_free(asset);
+        } else {
+            SndFileCache_evict(this);
+        }
+    }
+    ok = pthread_mutex_unlock(&this->mMutex);
+    assert(0 == ok);
+}
+
+
+/** \brief Open a file through libsndfile, or take a handle to it that the cache kept open and
+ *  rewind it.  The modification time and size of the file are stored for
+ *  SndFileCache_closeHandle, with a size of -1 if the file cannot be identified.  Returns NULL
+ *  if the file cannot be opened.  Called by SndFile_Open.
+ */
+
+SNDFILE *SndFileCache_openHandle(SndFileCache *this, const char *path, SF_INFO *sfinfo,
+    time_t *pModified, off_t *pFileSize)
+{
+    struct stat st;
+    if (0 != stat(path, &st) || !S_ISREG(st.st_mode)) {
+        *pModified = 0;
+        *pFileSize = -1;
+    } else {
+        *pModified = st.st_mtime;
+        *pFileSize = st.st_size;
+        int ok;
+        ok = pthread_mutex_lock(&this->mMutex);
+        assert(0 == ok);
+        struct SndFileHandle **pHandle, *handle;
+        for (pHandle = &this->mHandles; NULL != (handle = *pHandle); pHandle = &handle->mNext) {
+            if (!strcmp(handle->mPath, path)) {
+                *pHandle = handle->mNext;
+                --this->mHandleCount;
+                break;
+            }
+        }
+        ok = pthread_mutex_unlock(&this->mMutex);
+        assert(0 == ok);
+        if (NULL != handle) {
+            SNDFILE *sndfile = handle->mSNDFILE;
+            // a handle to an older version of the file is closed rather than reused
+            if (handle->mModified == st.st_mtime && handle->mFileSize == st.st_size &&
+                    0 == sf_seek(sndfile, (sf_count_t) 0, SEEK_SET)) {
+                *sfinfo = handle->mSfInfo;
+                free(handle);
+                return sndfile;
+            }
+            sf_close(sndfile);
+            free(handle);
+        }
+    }
+    sfinfo->format = 0;
+    return sf_open(path, SFM_READ, sfinfo);
+}
+
+
+/** \brief Give back a handle from SndFileCache_openHandle.  The cache keeps it open for the next
+ *  player of the file, and closes the least recently used handle if it has too many.  Called
+ *  by SndFile_Close.
+ */
+
+void SndFileCache_closeHandle(SndFileCache *this, const char *path, time_t modified,
+    off_t fileSize, SNDFILE *sndfile, const SF_INFO *sfinfo)
+{
+    // the path is stored after the handle, in the same allocation
+    size_t length = strlen(path);
+    struct SndFileHandle *handle = NULL;
+    if (0 <= fileSize) {
+        handle = (struct SndFileHandle *) malloc(sizeof(struct SndFileHandle) + length + 1);
+    }
+    if (NULL == handle) {
+        sf_close(sndfile);
+        return;
+    }
+    handle->mPath = (char *) &handle[1];
+    memcpy(handle->mPath, path, length + 1);
+    handle->mModified = modified;
+    handle->mFileSize = fileSize;
+    handle->mSNDFILE = sndfile;
+    handle->mSfInfo = *sfinfo;
+    int ok;
+    ok = pthread_mutex_lock(&this->mMutex);
+    assert(0 == ok);
+    handle->mNext = this->mHandles;
+    this->mHandles = handle;
+    struct SndFileHandle *evicted = NULL;
+    if (SndFileCache_HANDLES < ++this->mHandleCount) {
+        struct SndFileHandle **pHandle = &this->mHandles;
+        while (NULL != (*pHandle)->mNext) {
+            pHandle = &(*pHandle)->mNext;
+        }
+        evicted = *pHandle;
+        *pHandle = NULL;
+        --this->mHandleCount;
+    }
+    ok = pthread_mutex_unlock(&this->mMutex);
+    assert(0 == ok);
+    // closing may take a while, so not with the mutex held
+    if (NULL != evicted) {
+        sf_close(evicted->mSNDFILE);
+        free(evicted);
+    }
+}
+
+
+/** \brief Take a preload off the list of pending preloads, before it is freed */
+
+static void SndFileCache_forget(SndFileCache *this, struct SndFilePreload *preload)
+{
+    int ok;
+    ok = pthread_mutex_lock(&this->mMutex);
+    assert(0 == ok);
+    if (NULL != preload->mPrev) {
+        preload->mPrev->mNext = preload->mNext;
+    } else {
+        this->mPreloads = preload->mNext;
+    }
+    if (NULL != preload->mNext) {
+        preload->mNext->mPrev = preload->mPrev;
+    }
+    ok = pthread_mutex_unlock(&this->mMutex);
+    assert(0 == ok);
+}
+
+
+/** \brief Called by a worker thread to load the asset of a preload */
+
+static void HandlePreload(void *self, int unused)
+{
+    struct SndFilePreload *preload = (struct SndFilePreload *) self;
+    SndFileCache *this = preload->mCache;
+    struct SndFileAsset *asset;
+    SLresult result = SndFileCache_acquire(this, preload->mPath, &asset);
+    if (SL_RESULT_SUCCESS == result) {
+        SndFileCache_release(this, asset);
+    }
+    SndFileCache_forget(this, preload);
+    if (NULL != preload->mCallback) {
+        (*preload->mCallback)(preload->mContext, result);
+    }
+    free(preload);
+}
+
+
+/** \brief Queue the loading of a file on the thread pool.  Called by slVitaPreloadAsset. */
+
+SLresult SndFileCache_preload(SndFileCache *this, ThreadPool *threadPool, const char *path,
+    slVitaPreloadCallback callback, void *pContext)
+{
+    if (0 == this->mBudget) {
+        return SL_RESULT_FEATURE_UNSUPPORTED;
+    }
+    // the path is stored after the preload, in the same allocation
+    size_t length = strlen(path);
+    struct SndFilePreload *preload = (struct SndFilePreload *)
+        malloc(sizeof(struct SndFilePreload) + length + 1);
+    if (NULL == preload) {
+        return SL_RESULT_MEMORY_FAILURE;
+    }
+    preload->mCache = this;
+    preload->mCallback = callback;
+    preload->mContext = pContext;
+    preload->mPath = (char *) &preload[1];
+    memcpy(preload->mPath, path, length + 1);
+    int ok;
+    ok = pthread_mutex_lock(&this->mMutex);
+    assert(0 == ok);
+    preload->mPrev = NULL;
+    preload->mNext = this->mPreloads;
+    if (NULL != this->mPreloads) {
+        this->mPreloads->mPrev = preload;
+    }
+    this->mPreloads = preload;
+    ok = pthread_mutex_unlock(&this->mMutex);
+    assert(0 == ok);
+    SLresult result = ThreadPool_add(threadPool, HandlePreload, preload, 0);
+    if (SL_RESULT_SUCCESS != result) {
+        SndFileCache_forget(this, preload);
+        free(preload);
+    }
+    return result;
+}
@@ -18,22 +18,154 @@
 
 #include "sles_allinclusive.h"
 
+// Identifies the ThreadPoolWorker of the calling thread, if it is a worker thread
+
+static pthread_once_t workerKeyOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t workerKey;
+
+static void workerKeyCreate(void)
+{
+    int ok;
+    ok = pthread_key_create(&workerKey, NULL);
+    assert(0 == ok);
+}
+
+// Return the calling thread's worker in the specified pool, or NULL if it is not a worker thread
+// of that pool
+
+static ThreadPoolWorker *currentWorker(ThreadPool *tp)
+{
+    ThreadPoolWorker *worker = (ThreadPoolWorker *) pthread_getspecific(workerKey);
+    return (NULL != worker && tp == worker->mThreadPool) ? worker : NULL;
+}
+
+// Chase-Lev deque operations, see "Correct and Efficient Work-Stealing for Weak Memory Models"
+// by Le, Pop, Cohen and Zappa Nardelli.  The buffer has a fixed capacity; push fails when full.
+
+// Called only by the owner: push a closure at the bottom
+
+static SLboolean deque_push(ThreadPoolDeque *dq, void (*handler)(void *, int), void *context,
+    int parameter)
+{
+    long b = __atomic_load_n(&dq->mBottom, __ATOMIC_RELAXED);
+    long t = __atomic_load_n(&dq->mTop, __ATOMIC_ACQUIRE);
+    if (b - t >= DEQUE_CAPACITY)
+        return SL_BOOLEAN_FALSE;
+    // a thief may still be copying an older closure out of this slot, see deque_steal
+    Closure *slot = &dq->mBuffer[b & (DEQUE_CAPACITY - 1)];
+    __atomic_store_n(&slot->mHandler, handler, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->mContext, context, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->mParameter, parameter, __ATOMIC_RELAXED);
+    // publish the closure before the new bottom
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&dq->mBottom, b + 1, __ATOMIC_RELAXED);
+    return SL_BOOLEAN_TRUE;
+}
+
+// Called only by the owner: pop the newest closure from the bottom
+
+static SLboolean deque_pop(ThreadPoolDeque *dq, Closure *closure)
+{
+    long b = __atomic_load_n(&dq->mBottom, __ATOMIC_RELAXED) - 1;
+    __atomic_store_n(&dq->mBottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long t = __atomic_load_n(&dq->mTop, __ATOMIC_RELAXED);
+    if (t > b) {
+        // empty
+        __atomic_store_n(&dq->mBottom, b + 1, __ATOMIC_RELAXED);
+        return SL_BOOLEAN_FALSE;
+    }
+    *closure = dq->mBuffer[b & (DEQUE_CAPACITY - 1)];
+    if (t == b) {
+        // last closure, so race against the thieves for it
+        SLboolean won = __atomic_compare_exchange_n(&dq->mTop, &t, t + 1, 0, __ATOMIC_SEQ_CST,
+            __ATOMIC_RELAXED);
+        __atomic_store_n(&dq->mBottom, b + 1, __ATOMIC_RELAXED);
+        return won;
+    }
+    return SL_BOOLEAN_TRUE;
+}
+
+// Called by any other thread: steal the oldest closure from the top
+
+static SLboolean deque_steal(ThreadPoolDeque *dq, Closure *closure)
+{
+    long t = __atomic_load_n(&dq->mTop, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long b = __atomic_load_n(&dq->mBottom, __ATOMIC_ACQUIRE);
+    if (t >= b)
+        return SL_BOOLEAN_FALSE;
+    // The owner can only overwrite this slot after mTop has moved past t,
+    // in which case the compare-and-swap fails and the (possibly torn) copy is discarded
+    Closure *slot = &dq->mBuffer[t & (DEQUE_CAPACITY - 1)];
+    Closure copy;
+    copy.mHandler = __atomic_load_n(&slot->mHandler, __ATOMIC_RELAXED);
+    copy.mContext = __atomic_load_n(&slot->mContext, __ATOMIC_RELAXED);
+    copy.mParameter = __atomic_load_n(&slot->mParameter, __ATOMIC_RELAXED);
+    if (!__atomic_compare_exchange_n(&dq->mTop, &t, t + 1, 0, __ATOMIC_SEQ_CST,
+            __ATOMIC_RELAXED))
+        return SL_BOOLEAN_FALSE;
+    *closure = copy;
+    return SL_BOOLEAN_TRUE;
+}
+
+static SLboolean deque_isEmpty(ThreadPoolDeque *dq)
+{
+    long t = __atomic_load_n(&dq->mTop, __ATOMIC_ACQUIRE);
+    long b = __atomic_load_n(&dq->mBottom, __ATOMIC_ACQUIRE);
+    return t >= b;
+}
+
+// Try to steal a closure of the specified priority from the other workers,
+// starting with the one after self
+
+static SLboolean ThreadPool_steal(ThreadPool *tp, ThreadPoolWorker *self, unsigned priority,
+    Closure *closure)
+{
+    unsigned nThreads = tp->mMaxThreads;
+    unsigned first = (NULL != self) ? self->mIndex + 1 : 0;
+    unsigned i;
+    for (i = 0; i < nThreads; ++i) {
+        ThreadPoolWorker *victim = &tp->mWorkerArray[(first + i) % nThreads];
+        if (victim != self && deque_steal(&victim->mDeque[priority], closure))
+            return SL_BOOLEAN_TRUE;
+    }
+    return SL_BOOLEAN_FALSE;
+}
+
+// Wake up parked workers after adding a closure; called with mMutex held
+
+static void ThreadPool_wake(ThreadPool *tp)
+{
+    int ok;
+    if (tp->mWakeAll)
+        ok = pthread_cond_broadcast(&tp->mCondNotEmpty);
+    else
+        ok = pthread_cond_signal(&tp->mCondNotEmpty);
+    assert(0 == ok);
+}
+
 // Entry point for each worker thread
 
 static void *ThreadPool_start(void *context)
 {
-    ThreadPool *tp = (ThreadPool *) context;
+    ThreadPoolWorker *worker = (ThreadPoolWorker *) context;
+    assert(NULL != worker);
+    ThreadPool *tp = worker->mThreadPool;
     assert(NULL != tp);
+    int ok;
+    ok = pthread_setspecific(workerKey, worker);
+    assert(0 == ok);
     for (;;) {
-        Closure *pClosure = ThreadPool_remove(tp);
-        // closure is NULL when thread pool is being destroyed
+        Closure closure;
+        Closure *pClosure = ThreadPool_remove(tp, &closure);
+        // closure is NULL when thread pool is being destroyed, or this thread has been idle
         if (NULL == pClosure)
             break;
         void (*handler)(void *, int);
         handler = pClosure->mHandler;
         void *context = pClosure->mContext;
         int parameter = pClosure->mParameter;
-        free(pClosure);
         assert(NULL != handler);
         (*handler)(context, parameter);
     }
@@ -46,21 +178,121 @@ static void *ThreadPool_start(void *context)
 #define INITIALIZED_CONDNOTEMPTY 4
 #define INITIALIZED_ALL          7
 
-static void ThreadPool_deinit_internal(ThreadPool *tp, unsigned initialized, unsigned nThreads);
+#define PRIORITY_MASK_ALL ((1 << THREADPOOL_PRIORITIES) - 1)
+
+static void ThreadPool_deinit_internal(ThreadPool *tp, unsigned initialized);
+
+// Start the thread of a worker slot; called with mMutex held
+
+static SLresult ThreadPool_spawn(ThreadPool *tp, ThreadPoolWorker *worker)
+{
+    int ok;
+    // reap the previous thread of this slot; it does not need the mutex to finish exiting
+    if (WORKER_EXITED == worker->mState) {
+        ok = pthread_join(worker->mThread, (void **) NULL);
+        assert(0 == ok);
+        worker->mState = WORKER_NONE;
+    }
+    assert(WORKER_NONE == worker->mState);
+    int err = pthread_create(&worker->mThread, (const pthread_attr_t *) NULL, ThreadPool_start,
+        worker);
+    SLresult result = err_to_result(err);
+    if (SL_RESULT_SUCCESS == result) {
+        worker->mState = WORKER_RUNNING;
+        __atomic_add_fetch(&tp->mThreadCount, 1, __ATOMIC_RELAXED);
+    }
+    return result;
+}
+
+// Make sure that a closure of the specified priority class will be run: if no parked worker can
+// run it, then start another worker thread that can; called with mMutex held.
+// Fails only if no worker thread can run it at all.
+// If spawn is false, as for a caller that must not block, then no thread is joined or started;
+// that is left to ThreadPool_growPending, and the closure waits for a busy worker or for it.
+
+static SLresult ThreadPool_grow(ThreadPool *tp, unsigned priority, SLboolean spawn)
+{
+    unsigned bit = 1 << priority;
+    if (spawn)
+        __atomic_store_n(&tp->mGrowPending, tp->mGrowPending & ~bit, __ATOMIC_RELAXED);
+    SLboolean running = SL_BOOLEAN_FALSE;
+    ThreadPoolWorker *idleSlot = NULL;
+    unsigned i;
+    for (i = 0; i < tp->mMaxThreads; ++i) {
+        ThreadPoolWorker *worker = &tp->mWorkerArray[i];
+        if (!(worker->mPriorityMask & bit))
+            continue;
+        if (WORKER_RUNNING == worker->mState) {
+            if (worker->mParked)
+                return SL_RESULT_SUCCESS;
+            running = SL_BOOLEAN_TRUE;
+        } else if (NULL == idleSlot) {
+            idleSlot = worker;
+        }
+    }
+    if (NULL == idleSlot)
+        return SL_RESULT_SUCCESS;
+    if (!spawn) {
+        __atomic_store_n(&tp->mGrowPending, tp->mGrowPending | bit, __ATOMIC_RELAXED);
+        return SL_RESULT_SUCCESS;
+    }
+    SLresult result = ThreadPool_spawn(tp, idleSlot);
+    // a busy worker will get to it eventually
+    return running ? SL_RESULT_SUCCESS : result;
+}
+
+// Compute the deadline for a parked worker thread to exit
+
+static void ThreadPool_idleDeadline(struct timespec *deadline)
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    long nsec = now.tv_usec * 1000L + (THREAD_IDLE_TIMEOUT_MS % 1000) * 1000000L;
+    deadline->tv_sec = now.tv_sec + THREAD_IDLE_TIMEOUT_MS / 1000 + nsec / 1000000000L;
+    deadline->tv_nsec = nsec % 1000000000L;
+}
 
 // Initialize a ThreadPool
 // maxClosures defaults to CLOSURE_TYPICAL if 0
 // maxThreads defaults to THREAD_TYPICAL if 0
+// reserved is NULL, or the number of workers that run only closures of each priority class;
+// the remaining workers run closures of any class
+// No worker threads are started here; see ThreadPool_grow
 
-SLresult ThreadPool_init(ThreadPool *tp, unsigned maxClosures, unsigned maxThreads)
+SLresult ThreadPool_init(ThreadPool *tp, unsigned maxClosures, unsigned maxThreads,
+    const unsigned *reserved)
 {
     assert(NULL != tp);
     memset(tp, 0, sizeof(ThreadPool));
     tp->mShutdown = SL_BOOLEAN_FALSE;
     unsigned initialized = INITIALIZED_NONE;    // which objects were successfully initialized
-    unsigned nThreads = 0;                      // number of threads successfully created
     int err;
     SLresult result;
+    unsigned i, p;
+
+    // use default values for parameters, if not specified explicitly
+    tp->mWaitingNotFull = 0;
+    tp->mWaitingNotEmpty = 0;
+    if (0 == maxClosures)
+        maxClosures = CLOSURE_TYPICAL;
+    tp->mMaxClosures = maxClosures;
+    if (0 == maxThreads)
+        maxThreads = THREAD_TYPICAL;
+    tp->mMaxThreads = maxThreads;
+
+    // every priority class must be run by at least one worker
+    unsigned nReserved = 0;
+    SLboolean allClassesReserved = SL_BOOLEAN_TRUE;
+    if (NULL != reserved) {
+        for (p = 0; p < THREADPOOL_PRIORITIES; ++p) {
+            nReserved += reserved[p];
+            if (0 == reserved[p])
+                allClassesReserved = SL_BOOLEAN_FALSE;
+        }
+    }
+    if (nReserved > maxThreads || (nReserved == maxThreads && !allClassesReserved))
+        return SL_RESULT_PARAMETER_INVALID;
+    tp->mWakeAll = 0 < nReserved;
 
     // initialize mutex and condition variables
     err = pthread_mutex_init(&tp->mMutex, (const pthread_mutexattr_t *) NULL);
@@ -79,47 +311,48 @@ SLresult ThreadPool_init(ThreadPool *tp, unsigned maxClosures, unsigned maxThrea
         goto fail;
     initialized |= INITIALIZED_CONDNOTEMPTY;
 
-    // use default values for parameters, if not specified explicitly
-    tp->mWaitingNotFull = 0;
-    tp->mWaitingNotEmpty = 0;
-    if (0 == maxClosures)
-        maxClosures = CLOSURE_TYPICAL;
-    tp->mMaxClosures = maxClosures;
-    if (0 == maxThreads)
-        maxThreads = THREAD_TYPICAL;
-    tp->mMaxThreads = maxThreads;
-
-    // initialize circular buffer for closures
-    if (CLOSURE_TYPICAL >= maxClosures) {
-        tp->mClosureArray = tp->mClosureTypical;
-    } else {
-        tp->mClosureArray = (Closure **) malloc((maxClosures + 1) * sizeof(Closure *));
-        if (NULL == tp->mClosureArray) {
-            result = SL_RESULT_RESOURCE_ERROR;
-            goto fail;
+    // initialize a circular buffer for closures of each priority class
+    for (p = 0; p < THREADPOOL_PRIORITIES; ++p) {
+        ThreadPoolQueue *queue = &tp->mQueue[p];
+        if (CLOSURE_TYPICAL >= maxClosures) {
+            queue->mArray = tp->mClosureTypical[p];
+        } else {
+            queue->mArray = (Closure *) malloc((maxClosures + 1) * sizeof(Closure));
+            if (NULL == queue->mArray) {
+                result = SL_RESULT_RESOURCE_ERROR;
+                goto fail;
+            }
         }
+        queue->mFront = queue->mArray;
+        queue->mRear = queue->mArray;
     }
-    tp->mClosureFront = tp->mClosureArray;
-    tp->mClosureRear = tp->mClosureArray;
 
     // initialize thread pool
+    err = pthread_once(&workerKeyOnce, workerKeyCreate);
+    result = err_to_result(err);
+    if (SL_RESULT_SUCCESS != result)
+        goto fail;
     if (THREAD_TYPICAL >= maxThreads) {
-        tp->mThreadArray = tp->mThreadTypical;
+        tp->mWorkerArray = tp->mWorkerTypical;
     } else {
-        tp->mThreadArray = (pthread_t *) malloc(maxThreads * sizeof(pthread_t));
-        if (NULL == tp->mThreadArray) {
+        tp->mWorkerArray = (ThreadPoolWorker *) calloc(maxThreads, sizeof(ThreadPoolWorker));
+        if (NULL == tp->mWorkerArray) {
             result = SL_RESULT_RESOURCE_ERROR;
             goto fail;
         }
     }
-    unsigned i;
+    // the reserved workers come first, in order of priority class
+    p = (NULL != reserved) ? 0 : THREADPOOL_PRIORITIES;
+    unsigned nextClass = (NULL != reserved) ? reserved[0] : 0;
     for (i = 0; i < maxThreads; ++i) {
-        int err = pthread_create(&tp->mThreadArray[i], (const pthread_attr_t *) NULL,
-            ThreadPool_start, tp);
-        result = err_to_result(err);
-        if (SL_RESULT_SUCCESS != result)
-            goto fail;
-        ++nThreads;
+        ThreadPoolWorker *worker = &tp->mWorkerArray[i];
+        worker->mThreadPool = tp;
+        worker->mIndex = i;
+        while (p < THREADPOOL_PRIORITIES && i >= nextClass) {
+            if (++p < THREADPOOL_PRIORITIES)
+                nextClass += reserved[p];
+        }
+        worker->mPriorityMask = (p < THREADPOOL_PRIORITIES) ? 1 << p : PRIORITY_MASK_ALL;
     }
     tp->mInitialized = initialized;
 
@@ -128,51 +361,49 @@ SLresult ThreadPool_init(ThreadPool *tp, unsigned maxClosures, unsigned maxThrea
 
     // here on any kind of error
 fail:
-    ThreadPool_deinit_internal(tp, initialized, nThreads);
+    ThreadPool_deinit_internal(tp, initialized);
     return result;
 }
 
-static void ThreadPool_deinit_internal(ThreadPool *tp, unsigned initialized, unsigned nThreads)
+static void ThreadPool_deinit_internal(ThreadPool *tp, unsigned initialized)
 {
     int ok;
+    unsigned i, p;
 
     assert(NULL != tp);
     // Destroy all threads
-    if (0 < nThreads) {
-        assert(INITIALIZED_ALL == initialized);
+    if (INITIALIZED_ALL == initialized) {
         ok = pthread_mutex_lock(&tp->mMutex);
         assert(0 == ok);
-        tp->mShutdown = SL_BOOLEAN_TRUE;
+        __atomic_store_n(&tp->mShutdown, SL_BOOLEAN_TRUE, __ATOMIC_SEQ_CST);
         ok = pthread_cond_broadcast(&tp->mCondNotEmpty);
         assert(0 == ok);
         ok = pthread_cond_broadcast(&tp->mCondNotFull);
         assert(0 == ok);
         ok = pthread_mutex_unlock(&tp->mMutex);
         assert(0 == ok);
-        unsigned i;
-        for (i = 0; i < nThreads; ++i) {
-            ok = pthread_join(tp->mThreadArray[i], (void **) NULL);
-            assert(ok == 0);
+        // no more threads are started after shutdown, and the slots of the ones that are
+        // still running can only change to WORKER_EXITED
+        for (i = 0; i < tp->mMaxThreads; ++i) {
+            ThreadPoolWorker *worker = &tp->mWorkerArray[i];
+            if (WORKER_NONE != worker->mState) {
+                ok = pthread_join(worker->mThread, (void **) NULL);
+                assert(ok == 0);
+                worker->mState = WORKER_NONE;
+            }
         }
 
-        // Empty out the circular buffer of closures
+        // Empty out the circular buffers and the deques; closures are stored by value,
+        // so nothing to free
         ok = pthread_mutex_lock(&tp->mMutex);
         assert(0 == ok);
         assert(0 == tp->mWaitingNotEmpty);
-        Closure **oldFront = tp->mClosureFront;
-        while (oldFront != tp->mClosureRear) {
-            Closure **newFront = oldFront;
-            if (++newFront == &tp->mClosureArray[tp->mMaxClosures + 1])
-                newFront = tp->mClosureArray;
-            Closure *pClosure = *oldFront;
-            assert(NULL != pClosure);
-            *oldFront = NULL;
-            tp->mClosureFront = newFront;
-            ok = pthread_mutex_unlock(&tp->mMutex);
-            assert(0 == ok);
-            free(pClosure);
-            ok = pthread_mutex_lock(&tp->mMutex);
-            assert(0 == ok);
+        for (p = 0; p < THREADPOOL_PRIORITIES; ++p) {
+            tp->mQueue[p].mFront = tp->mQueue[p].mRear;
+            for (i = 0; i < tp->mMaxThreads; ++i) {
+                ThreadPoolDeque *dq = &tp->mWorkerArray[i].mDeque[p];
+                dq->mTop = dq->mBottom;
+            }
         }
         ok = pthread_mutex_unlock(&tp->mMutex);
         assert(0 == ok);
@@ -194,76 +425,142 @@ static void ThreadPool_deinit_internal(ThreadPool *tp, unsigned initialized, uns
     }
     tp->mInitialized = INITIALIZED_NONE;
 
-    // release the closure circular buffer
-    if (tp->mClosureTypical != tp->mClosureArray && NULL != tp->mClosureArray) {
-        free(tp->mClosureArray);
-        tp->mClosureArray = NULL;
+    // release the closure circular buffers
+    for (p = 0; p < THREADPOOL_PRIORITIES; ++p) {
+        ThreadPoolQueue *queue = &tp->mQueue[p];
+        if (tp->mClosureTypical[p] != queue->mArray && NULL != queue->mArray) {
+            free(queue->mArray);
+            queue->mArray = NULL;
+        }
     }
 
     // release the thread pool
-    if (tp->mThreadTypical != tp->mThreadArray && NULL != tp->mThreadArray) {
-        free(tp->mThreadArray);
-        tp->mThreadArray = NULL;
+    if (tp->mWorkerTypical != tp->mWorkerArray && NULL != tp->mWorkerArray) {
+        free(tp->mWorkerArray);
+        tp->mWorkerArray = NULL;
     }
 
 }
 
 void ThreadPool_deinit(ThreadPool *tp)
 {
-    ThreadPool_deinit_internal(tp, tp->mInitialized, tp->mMaxThreads);
+    ThreadPool_deinit_internal(tp, tp->mInitialized);
 }
 
-// Enqueue a closure to be executed later by a worker thread
-SLresult ThreadPool_add(ThreadPool *tp, void (*handler)(void *, int), void *context, int parameter)
+// Start the worker threads that non-blocking adds left for later; called with mMutex held
+
+static void ThreadPool_growPendingLocked(ThreadPool *tp)
+{
+    unsigned pending = tp->mGrowPending;
+    while (pending) {
+        unsigned priority = ctz(pending);
+        pending &= ~(1 << priority);
+        (void) ThreadPool_grow(tp, priority, SL_BOOLEAN_TRUE);
+    }
+}
+
+// Start the worker threads that non-blocking adds left for later, so that their closures do not
+// wait for the next add that may block; called periodically by the sync thread
+
+void ThreadPool_growPending(ThreadPool *tp)
+{
+    assert(NULL != tp);
+    if (0 == __atomic_load_n(&tp->mGrowPending, __ATOMIC_RELAXED))
+        return;
+    int ok;
+    ok = pthread_mutex_lock(&tp->mMutex);
+    assert(0 == ok);
+    if (!tp->mShutdown)
+        ThreadPool_growPendingLocked(tp);
+    ok = pthread_mutex_unlock(&tp->mMutex);
+    assert(0 == ok);
+}
+
+// Enqueue a closure of the specified priority class to be executed later by a worker thread
+// The closure is copied into the calling worker's deque, or into the circular buffer if the caller
+// is not a worker thread or its deque is full, so there is no allocation per closure.
+// If the circular buffer is full, wait for room, or fail if wait is false.
+static SLresult ThreadPool_addInternal(ThreadPool *tp, unsigned priority,
+    void (*handler)(void *, int), void *context, int parameter, SLboolean wait)
 {
     assert(NULL != tp);
     assert(NULL != handler);
-    Closure *closure = (Closure *) malloc(sizeof(Closure));
-    if (NULL == closure)
-        return SL_RESULT_RESOURCE_ERROR;
-    closure->mHandler = handler;
-    closure->mContext = context;
-    closure->mParameter = parameter;
+    assert(THREADPOOL_PRIORITIES > priority);
     int ok;
+    ThreadPoolWorker *self = currentWorker(tp);
+    if (NULL != self && deque_push(&self->mDeque[priority], handler, context, parameter)) {
+        // Pairs with the fence in ThreadPool_remove: either a parking worker sees the new closure,
+        // or we see that it is parked and wake it
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (0 < __atomic_load_n(&tp->mWaitingNotEmpty, __ATOMIC_RELAXED)) {
+            ok = pthread_mutex_lock(&tp->mMutex);
+            assert(0 == ok);
+            ThreadPool_wake(tp);
+            ok = pthread_mutex_unlock(&tp->mMutex);
+            assert(0 == ok);
+        } else if (__atomic_load_n(&tp->mThreadCount, __ATOMIC_RELAXED) < tp->mMaxThreads) {
+            // every worker is busy, so this closure would wait; if we can't start another
+            // worker, then it is still run by us or by a worker that steals it
+            ok = pthread_mutex_lock(&tp->mMutex);
+            assert(0 == ok);
+            if (!tp->mShutdown)
+                (void) ThreadPool_grow(tp, priority, wait);
+            ok = pthread_mutex_unlock(&tp->mMutex);
+            assert(0 == ok);
+        }
+        return SL_RESULT_SUCCESS;
+    }
+    ThreadPoolQueue *queue = &tp->mQueue[priority];
     ok = pthread_mutex_lock(&tp->mMutex);
     assert(0 == ok);
     // can't enqueue while thread pool shutting down
     if (tp->mShutdown) {
         ok = pthread_mutex_unlock(&tp->mMutex);
         assert(0 == ok);
-        free(closure);
         return SL_RESULT_PRECONDITIONS_VIOLATED;
     }
     for (;;) {
-        Closure **oldRear = tp->mClosureRear;
-        Closure **newRear = oldRear;
-        if (++newRear == &tp->mClosureArray[tp->mMaxClosures + 1])
-            newRear = tp->mClosureArray;
+        Closure *oldRear = queue->mRear;
+        Closure *newRear = oldRear;
+        if (++newRear == &queue->mArray[tp->mMaxClosures + 1])
+            newRear = queue->mArray;
         // if closure circular buffer is full, then wait for it to become non-full
-        if (newRear == tp->mClosureFront) {
+        if (newRear == queue->mFront) {
+            if (!wait) {
+                ok = pthread_mutex_unlock(&tp->mMutex);
+                assert(0 == ok);
+                return SL_RESULT_BUFFER_INSUFFICIENT;
+            }
+            // the waiter maintains the count of waiters, so spurious wakeups are harmless
             ++tp->mWaitingNotFull;
             ok = pthread_cond_wait(&tp->mCondNotFull, &tp->mMutex);
             assert(0 == ok);
+            assert(0 < tp->mWaitingNotFull);
+            --tp->mWaitingNotFull;
             // can't enqueue while thread pool shutting down
             if (tp->mShutdown) {
-                assert(0 < tp->mWaitingNotFull);
-                --tp->mWaitingNotFull;
                 ok = pthread_mutex_unlock(&tp->mMutex);
                 assert(0 == ok);
-                free(closure);
                 return SL_RESULT_PRECONDITIONS_VIOLATED;
             }
             continue;
         }
-        assert(NULL == *oldRear);
-        *oldRear = closure;
-        tp->mClosureRear = newRear;
-        // if a worker thread was waiting to dequeue, then suggest that it try again
-        if (0 < tp->mWaitingNotEmpty) {
-            --tp->mWaitingNotEmpty;
-            ok = pthread_cond_signal(&tp->mCondNotEmpty);
+        // a caller that may block also starts the workers that non-blocking adds left for later
+        if (wait)
+            ThreadPool_growPendingLocked(tp);
+        SLresult result = ThreadPool_grow(tp, priority, wait);
+        if (SL_RESULT_SUCCESS != result) {
+            ok = pthread_mutex_unlock(&tp->mMutex);
             assert(0 == ok);
+            return result;
         }
+        oldRear->mHandler = handler;
+        oldRear->mContext = context;
+        oldRear->mParameter = parameter;
+        __atomic_store_n(&queue->mRear, newRear, __ATOMIC_RELEASE);
+        // if a worker thread was waiting to dequeue, then suggest that it try again
+        if (0 < tp->mWaitingNotEmpty)
+            ThreadPool_wake(tp);
         break;
     }
     ok = pthread_mutex_unlock(&tp->mMutex);
@@ -271,47 +568,153 @@ SLresult ThreadPool_add(ThreadPool *tp, void (*handler)(void *, int), void *cont
     return SL_RESULT_SUCCESS;
 }
 
-// Called by a worker thread when it is ready to accept the next closure to execute
-Closure *ThreadPool_remove(ThreadPool *tp)
+SLresult ThreadPool_addPriority(ThreadPool *tp, unsigned priority, void (*handler)(void *, int),
+    void *context, int parameter)
+{
+    return ThreadPool_addInternal(tp, priority, handler, context, parameter, SL_BOOLEAN_TRUE);
+}
+
+// Enqueue a closure without waiting, for callers such as the mixer thread that must not block;
+// returns SL_RESULT_BUFFER_INSUFFICIENT if there is no room, and the caller may try again later.
+// Only the mutex is taken: if a worker thread would have to be started for the closure, then
+// that is left to the next add that may block, or to ThreadPool_growPending.
+SLresult ThreadPool_tryAddPriority(ThreadPool *tp, unsigned priority,
+    void (*handler)(void *, int), void *context, int parameter)
 {
-    Closure *pClosure;
+    return ThreadPool_addInternal(tp, priority, handler, context, parameter, SL_BOOLEAN_FALSE);
+}
+
+// Enqueue a background closure to be executed later by a worker thread
+SLresult ThreadPool_add(ThreadPool *tp, void (*handler)(void *, int), void *context, int parameter)
+{
+    return ThreadPool_addPriority(tp, THREADPOOL_PRIORITY_BACKGROUND, handler, context,
+        parameter);
+}
+
+// Dequeue the closure at front of a circular buffer, if any; called with mMutex held
+
+static SLboolean ThreadPool_removeShared(ThreadPool *tp, ThreadPoolQueue *queue, Closure *closure)
+{
+    Closure *oldFront = queue->mFront;
+    if (oldFront == queue->mRear)
+        return SL_BOOLEAN_FALSE;
+    Closure *newFront = oldFront;
+    if (++newFront == &queue->mArray[tp->mMaxClosures + 1])
+        newFront = queue->mArray;
+    *closure = *oldFront;
+    assert(NULL != closure->mHandler);
+    __atomic_store_n(&queue->mFront, newFront, __ATOMIC_RELEASE);
+    // if a client thread was waiting to enqueue, then suggest that it try again
+    if (0 < tp->mWaitingNotFull) {
+        int ok;
+        ok = pthread_cond_broadcast(&tp->mCondNotFull);
+        assert(0 == ok);
+    }
+    return SL_BOOLEAN_TRUE;
+}
+
+// Look for a closure of the priority classes in mask, highest priority first; for each class,
+// look at our own deque, then at the circular buffer, then at the other deques
+
+static SLboolean ThreadPool_find(ThreadPool *tp, ThreadPoolWorker *self, unsigned mask,
+    Closure *closure)
+{
+    unsigned p;
     int ok;
-    ok = pthread_mutex_lock(&tp->mMutex);
-    assert(0 == ok);
-    for (;;) {
-        Closure **oldFront = tp->mClosureFront;
-        // if closure circular buffer is empty, then wait for it to become non-empty
-        if (oldFront == tp->mClosureRear) {
-            ++tp->mWaitingNotEmpty;
-            ok = pthread_cond_wait(&tp->mCondNotEmpty, &tp->mMutex);
+    for (p = 0; p < THREADPOOL_PRIORITIES; ++p) {
+        if (!(mask & (1 << p)))
+            continue;
+        if (NULL != self && deque_pop(&self->mDeque[p], closure))
+            return SL_BOOLEAN_TRUE;
+        // only take the mutex if the circular buffer looks non-empty
+        ThreadPoolQueue *queue = &tp->mQueue[p];
+        if (__atomic_load_n(&queue->mFront, __ATOMIC_ACQUIRE) !=
+                __atomic_load_n(&queue->mRear, __ATOMIC_ACQUIRE)) {
+            ok = pthread_mutex_lock(&tp->mMutex);
             assert(0 == ok);
-            // fail if thread pool is shutting down
-            if (tp->mShutdown) {
-                assert(0 < tp->mWaitingNotEmpty);
-                --tp->mWaitingNotEmpty;
-                pClosure = NULL;
-                break;
-            }
-            // try again
+            SLboolean found = ThreadPool_removeShared(tp, queue, closure);
+            ok = pthread_mutex_unlock(&tp->mMutex);
+            assert(0 == ok);
+            if (found)
+                return SL_BOOLEAN_TRUE;
+        }
+        if (ThreadPool_steal(tp, self, p, closure))
+            return SL_BOOLEAN_TRUE;
+    }
+    return SL_BOOLEAN_FALSE;
+}
+
+// Return whether there is no closure of the priority classes in mask; called with mMutex held
+
+static SLboolean ThreadPool_isIdle(ThreadPool *tp, unsigned mask)
+{
+    unsigned i, p;
+    for (p = 0; p < THREADPOOL_PRIORITIES; ++p) {
+        if (!(mask & (1 << p)))
             continue;
+        if (tp->mQueue[p].mFront != tp->mQueue[p].mRear)
+            return SL_BOOLEAN_FALSE;
+        for (i = 0; i < tp->mMaxThreads; ++i) {
+            if (!deque_isEmpty(&tp->mWorkerArray[i].mDeque[p]))
+                return SL_BOOLEAN_FALSE;
         }
-        // dequeue the closure at front of circular buffer
-        Closure **newFront = oldFront;
-        if (++newFront == &tp->mClosureArray[tp->mMaxClosures + 1])
-            newFront = tp->mClosureArray;
-        pClosure = *oldFront;
-        assert(NULL != pClosure);
-        *oldFront = NULL;
-        tp->mClosureFront = newFront;
-        // if a client thread was waiting to enqueue, then suggest that it try again
-        if (0 < tp->mWaitingNotFull) {
-            --tp->mWaitingNotFull;
-            ok = pthread_cond_signal(&tp->mCondNotFull);
-            assert(0 == ok);
+    }
+    return SL_BOOLEAN_TRUE;
+}
+
+// Called by a worker thread when it is ready to accept the next closure to execute.
+// The closure is copied into the caller's storage, and the return value is that storage,
+// or NULL if the thread pool is being destroyed or the calling worker thread should exit.
+// A worker runs only the priority classes it is not reserved away from; any other caller runs
+// all classes.  If there is nothing to run, it parks until a closure is added; a worker thread
+// that stays parked for THREAD_IDLE_TIMEOUT_MS exits.
+Closure *ThreadPool_remove(ThreadPool *tp, Closure *closure)
+{
+    assert(NULL != closure);
+    ThreadPoolWorker *self = currentWorker(tp);
+    unsigned mask = (NULL != self) ? self->mPriorityMask : PRIORITY_MASK_ALL;
+    int ok;
+    for (;;) {
+        // fail if thread pool is shutting down
+        if (__atomic_load_n(&tp->mShutdown, __ATOMIC_ACQUIRE))
+            return NULL;
+        if (ThreadPool_find(tp, self, mask, closure))
+            return closure;
+        // nothing to do, so park; advertise first, then look once more before waiting
+        ok = pthread_mutex_lock(&tp->mMutex);
+        assert(0 == ok);
+        __atomic_add_fetch(&tp->mWaitingNotEmpty, 1, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        int err = 0;
+        if (!tp->mShutdown && ThreadPool_isIdle(tp, mask)) {
+            // the waiter maintains the count of waiters, so spurious wakeups are harmless
+            if (NULL != self) {
+                struct timespec deadline;
+                ThreadPool_idleDeadline(&deadline);
+                self->mParked = SL_BOOLEAN_TRUE;
+                err = pthread_cond_timedwait(&tp->mCondNotEmpty, &tp->mMutex, &deadline);
+                assert(0 == err || ETIMEDOUT == err);
+                self->mParked = SL_BOOLEAN_FALSE;
+            } else {
+                ok = pthread_cond_wait(&tp->mCondNotEmpty, &tp->mMutex);
+                assert(0 == ok);
+            }
         }
-        break;
+        assert(0 < tp->mWaitingNotEmpty);
+        __atomic_sub_fetch(&tp->mWaitingNotEmpty, 1, __ATOMIC_SEQ_CST);
+        // Exit after a whole timeout without work, unless a closure arrived meanwhile;
+        // pairs with the fence in ThreadPool_addPriority as above
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        // a worker reserved for streaming stays, so that the mixer never waits for one to start
+        SLboolean retire = ETIMEDOUT == err && !tp->mShutdown && ThreadPool_isIdle(tp, mask) &&
+            (1 << THREADPOOL_PRIORITY_STREAMING) != mask;
+        if (retire) {
+            self->mState = WORKER_EXITED;
+            __atomic_sub_fetch(&tp->mThreadCount, 1, __ATOMIC_RELAXED);
+        }
+        ok = pthread_mutex_unlock(&tp->mMutex);
+        assert(0 == ok);
+        if (retire)
+            return NULL;
     }
-    ok = pthread_mutex_unlock(&tp->mMutex);
-    assert(0 == ok);
-    return pClosure;
 }
@@ -24,30 +24,91 @@ typedef struct {
     int mParameter;
 } Closure;
 
-/** \brief ThreadPool manages a pool of worker threads that execute Closures */
+/** \brief Priority classes of closures; a worker runs the lower values first */
+
+#define THREADPOOL_PRIORITY_STREAMING  0    ///< Latency-critical work such as streaming and decode
+#define THREADPOOL_PRIORITY_BACKGROUND 1    ///< Realize, resume, dynamic interfaces and metadata
+#define THREADPOOL_PRIORITIES          2
+
+/** \brief ThreadPoolQueue is a circular buffer of closures of one priority class, for closures
+ *  added by threads other than the workers.  It is guarded by the pool mutex.
+ */
+
+typedef struct {
+    Closure *mArray;        ///< The circular buffer of closures, stored by value
+    Closure *mFront, *mRear;    ///< Written with mMutex held, may be peeked without
+} ThreadPoolQueue;
+
+/** \brief ThreadPoolDeque is a Chase-Lev work-stealing deque of closures, owned by one worker.
+ *  The owner pushes and pops at the bottom, other workers steal from the top.
+ */
 
 typedef struct {
+    long mTop;      ///< Index of the oldest closure, advanced by steal and last pop
+    long mBottom;   ///< Index past the newest closure, only written by the owner
+#define DEQUE_CAPACITY 32   // must be a power of 2
+    Closure mBuffer[DEQUE_CAPACITY];    ///< Circular buffer of closures, stored by value
+} ThreadPoolDeque;
+
+struct ThreadPool_struct;
+
+/** \brief ThreadPoolWorker is the per-thread state of a worker thread.  The slot outlives the
+ *  thread: a worker thread is only started on demand, and exits after being idle for a while.
+ */
+
+typedef struct {
+    struct ThreadPool_struct *mThreadPool;  ///< The pool this worker belongs to
+    unsigned mIndex;            ///< Index of this worker in the pool, also first steal victim
+    unsigned mPriorityMask;     ///< Priority classes this worker runs, bit 1 << priority
+#define WORKER_NONE    0        // no thread
+#define WORKER_RUNNING 1        // thread is running
+#define WORKER_EXITED  2        // thread has exited or is exiting, and must be joined
+    unsigned mState;            ///< One of the WORKER_ states, guarded by mMutex
+    SLboolean mParked;          ///< Whether the thread is waiting for work, guarded by mMutex
+    pthread_t mThread;
+    ThreadPoolDeque mDeque[THREADPOOL_PRIORITIES];  ///< Closures added by this worker thread
+} ThreadPoolWorker;
+
+/** \brief ThreadPool manages a pool of worker threads that execute Closures.
+ *  Each priority class has its own queues.  Closures added by a worker thread go to that
+ *  worker's deque, and idle workers steal from the other deques.  Closures added by any other
+ *  thread go to the shared circular buffer, which is guarded by mMutex.  Some workers may be
+ *  reserved for one priority class.  Idle workers park on mCondNotEmpty.  Worker threads are
+ *  started when a closure is added and no parked worker can run it, up to mMaxThreads.
+ */
+
+typedef struct ThreadPool_struct {
     unsigned mInitialized; ///< Indicates which of the following 3 fields are initialized
     pthread_mutex_t mMutex;
     pthread_cond_t mCondNotFull;    ///< Signalled when a client thread could be unblocked
     pthread_cond_t mCondNotEmpty;   ///< Signalled when a worker thread could be unblocked
     SLboolean mShutdown;   ///< Whether shutdown of thread pool has been requested
+    SLboolean mWakeAll;    ///< Whether some workers are reserved, so a signal could wake the wrong one
     unsigned mWaitingNotFull;   ///< Number of client threads waiting to enqueue
-    unsigned mWaitingNotEmpty;  ///< Number of worker threads waiting to dequeue
-    unsigned mMaxClosures;  ///< Number of slots in circular buffer for closures, not counting spare
-    unsigned mMaxThreads;   ///< Number of worker threads
-    Closure **mClosureArray;    ///< The circular buffer of closures
-    Closure **mClosureFront, **mClosureRear;
+    unsigned mWaitingNotEmpty;  ///< Number of worker threads parked, also read without mMutex
+    unsigned mMaxClosures;  ///< Number of slots in each circular buffer, not counting spare
+    unsigned mMaxThreads;   ///< Maximum number of worker threads
+    unsigned mThreadCount;  ///< Number of worker threads running, also read without mMutex
+    unsigned mGrowPending;  ///< Priority classes, bit 1 << priority, that a non-blocking add
+                            ///< left a worker thread to start for, also read without mMutex
+    ThreadPoolQueue mQueue[THREADPOOL_PRIORITIES];
     /// Saves a malloc in the typical case
 #define CLOSURE_TYPICAL 15
-    Closure *mClosureTypical[CLOSURE_TYPICAL+1];
-    pthread_t *mThreadArray;    ///< The worker threads
+    Closure mClosureTypical[THREADPOOL_PRIORITIES][CLOSURE_TYPICAL+1];
+    ThreadPoolWorker *mWorkerArray;    ///< The worker threads
 #define THREAD_TYPICAL 4
-    pthread_t mThreadTypical[THREAD_TYPICAL];
+#define THREAD_IDLE_TIMEOUT_MS 2000 // a worker thread exits after being idle for this long
+    ThreadPoolWorker mWorkerTypical[THREAD_TYPICAL];
 } ThreadPool;
 
-extern SLresult ThreadPool_init(ThreadPool *tp, unsigned maxClosures, unsigned maxThreads);
+extern SLresult ThreadPool_init(ThreadPool *tp, unsigned maxClosures, unsigned maxThreads,
+    const unsigned *reserved);
 extern void ThreadPool_deinit(ThreadPool *tp);
 extern SLresult ThreadPool_add(ThreadPool *tp, void (*handler)(void *, int), void *context,
     int parameter);
-extern Closure *ThreadPool_remove(ThreadPool *tp);
+extern SLresult ThreadPool_addPriority(ThreadPool *tp, unsigned priority,
+    void (*handler)(void *, int), void *context, int parameter);
+extern SLresult ThreadPool_tryAddPriority(ThreadPool *tp, unsigned priority,
+    void (*handler)(void *, int), void *context, int parameter);
+extern Closure *ThreadPool_remove(ThreadPool *tp, Closure *closure);
+extern void ThreadPool_growPending(ThreadPool *tp);
@@ -0,0 +1,500 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** \file VitaExt.c Vita-specific global entry points, see SLES/OpenSLES_Vita.h */
+
+#include "sles_allinclusive.h"
+
+
+/** \brief Map an application object to an audio player, or NULL if it is not one */
+
+static CAudioPlayer *objectToAudioPlayer(SLObjectItf self)
+{
+    if (NULL == self) {
+        return NULL;
+    }
+    IObject *thisObject = (IObject *) self;
+    if (SL_OBJECTID_AUDIOPLAYER != IObjectToObjectID(thisObject)) {
+        return NULL;
+    }
+    return (CAudioPlayer *) thisObject;
+}
+
+
+/** \brief slVitaSetAutoRelease Function */
+
+SLresult SLAPIENTRY slVitaSetAutoRelease(SLObjectItf player, SLboolean autoRelease)
+{
+    SL_ENTER_GLOBAL
+
+#ifdef USE_OUTPUTMIXEXT
+    CAudioPlayer *this = objectToAudioPlayer(player);
+    if (NULL == this) {
+        result = SL_RESULT_PARAMETER_INVALID;
+    } else {
+        object_lock_exclusive(&this->mObject);
+        this->mAutoRelease = SL_BOOLEAN_FALSE != autoRelease; // normalize
+        object_unlock_exclusive(&this->mObject);
+        result = SL_RESULT_SUCCESS;
+    }
+#else
+    result = SL_RESULT_FEATURE_UNSUPPORTED;
+#endif
+
+    SL_LEAVE_GLOBAL
+}
+
+
+/** \brief slVitaSetStreamBuffering Function */
+
+SLresult SLAPIENTRY slVitaSetStreamBuffering(SLObjectItf player, SLuint32 frames,
+    SLuint32 minBuffers, SLuint32 maxBuffers)
+{
+    SL_ENTER_GLOBAL
+
+#ifdef USE_SNDFILE
+    CAudioPlayer *this = objectToAudioPlayer(player);
+    if (NULL == this) {
+        result = SL_RESULT_PARAMETER_INVALID;
+    } else {
+        object_lock_exclusive(&this->mObject);
+        if (SL_OBJECT_STATE_UNREALIZED != this->mObject.mState) {
+            result = SL_RESULT_PRECONDITIONS_VIOLATED;
+        } else if (NULL == this->mSndFile.mPathname) {
+            result = SL_RESULT_FEATURE_UNSUPPORTED;
+        } else {
+            result = SndFile_setBuffering(this, frames, minBuffers, maxBuffers);
+        }
+        object_unlock_exclusive(&this->mObject);
+    }
+#else
+    result = SL_RESULT_FEATURE_UNSUPPORTED;
+#endif
+
+    SL_LEAVE_GLOBAL
+}
+
+
+/** \brief slVitaPreloadAsset Function */
+
+SLresult SLAPIENTRY slVitaPreloadAsset(SLEngineItf engine, const SLchar *pURI,
+    slVitaPreloadCallback callback, void *pContext)
+{
+    SL_ENTER_GLOBAL
+
+#ifdef USE_SNDFILE
+    if ((NULL == engine) || (NULL == pURI)) {
+        result = SL_RESULT_PARAMETER_INVALID;
+    } else {
+        IEngine *thisEngine = (IEngine *) engine;
+        const char *path = (const char *) pURI;
+        if (!strncmp(path, "file:///", 8)) {
+            path += 8;
+        }
+        // the thread pool is only there once the engine is realized
+        object_lock_shared(thisEngine->mThis);
+        SLuint8 state = thisEngine->mThis->mState;
+        object_unlock_shared(thisEngine->mThis);
+        if (SL_OBJECT_STATE_REALIZED != state) {
+            result = SL_RESULT_PRECONDITIONS_VIOLATED;
+        } else {
+            result = SndFileCache_preload(&thisEngine->mSndFileCache, &thisEngine->mThreadPool,
+                path, callback, pContext);
+        }
+    }
+#else
+    result = SL_RESULT_FEATURE_UNSUPPORTED;
+#endif
+
+    SL_LEAVE_GLOBAL
+}
+
+
+#ifdef USE_OUTPUTMIXEXT
+
+/** \brief A player prototype is an audio player that is configured but never published or
+ *  realized; players are copied from it by construct_clone
+ */
+
+struct SLVitaPlayerPrototype_ {
+    CAudioPlayer *mTemplate;
+};
+
+#endif
+
+
+/** \brief slVitaCreatePlayerPrototype Function */
+
+SLresult SLAPIENTRY slVitaCreatePlayerPrototype(SLEngineItf engine,
+    SLVitaPlayerPrototype *pPrototype, SLDataSource *pAudioSrc, SLDataSink *pAudioSnk,
+    SLuint32 numInterfaces, const SLInterfaceID *pInterfaceIds,
+    const SLboolean *pInterfaceRequired)
+{
+    SL_ENTER_GLOBAL
+
+#ifdef USE_OUTPUTMIXEXT
+    do {
+
+        if ((NULL == engine) || (NULL == pPrototype)) {
+            result = SL_RESULT_PARAMETER_INVALID;
+            break;
+        }
+        *pPrototype = NULL;
+
+        unsigned exposedMask;
+        const ClassTable *pCAudioPlayer_class = objectIDtoClass(SL_OBJECTID_AUDIOPLAYER);
+        assert(NULL != pCAudioPlayer_class);
+        result = checkInterfaces(pCAudioPlayer_class, numInterfaces,
+            pInterfaceIds, pInterfaceRequired, &exposedMask);
+        if (SL_RESULT_SUCCESS != result) {
+            break;
+        }
+
+        struct SLVitaPlayerPrototype_ *prototype = (struct SLVitaPlayerPrototype_ *)
+            malloc(sizeof(struct SLVitaPlayerPrototype_));
+        if (NULL == prototype) {
+            result = SL_RESULT_MEMORY_FAILURE;
+            break;
+        }
+
+        CAudioPlayer *this = (CAudioPlayer *) construct(pCAudioPlayer_class, exposedMask, engine);
+        if (NULL == this) {
+            free(prototype);
+            result = SL_RESULT_MEMORY_FAILURE;
+            break;
+        }
+
+        result = audioPlayerConfigure(this, pAudioSrc, pAudioSnk, numInterfaces,
+            pInterfaceIds, pInterfaceRequired);
+        // the copies are attached to the output mix by IOutputMixExt_checkAudioPlayerSourceSink
+        if ((SL_RESULT_SUCCESS == result) &&
+                (SL_DATALOCATOR_OUTPUTMIX != this->mDataSink.mLocator.mLocatorType)) {
+            result = SL_RESULT_CONTENT_UNSUPPORTED;
+        }
+        if (SL_RESULT_SUCCESS != result) {
+            IObject_Destroy(&this->mObject.mItf);
+            free(prototype);
+            break;
+        }
+
+        // the template gives back the object slot that construct reserved for it
+        IEngine *thisEngine = this->mObject.mEngine;
+        interface_lock_exclusive(thisEngine);
+        assert(0 < thisEngine->mInstanceCount);
+        --thisEngine->mInstanceCount;
+        interface_unlock_exclusive(thisEngine);
+
+        prototype->mTemplate = this;
+        *pPrototype = prototype;
+
+    } while (0);
+#else
+    result = SL_RESULT_FEATURE_UNSUPPORTED;
+#endif
+
+    SL_LEAVE_GLOBAL
+}
+
+
+/** \brief slVitaCreateAudioPlayerFromPrototype Function */
+
+SLresult SLAPIENTRY slVitaCreateAudioPlayerFromPrototype(SLVitaPlayerPrototype prototype,
+    SLObjectItf *pPlayer)
+{
+    SL_ENTER_GLOBAL
+
+#ifdef USE_OUTPUTMIXEXT
+    if ((NULL == prototype) || (NULL == pPlayer)) {
+        result = SL_RESULT_PARAMETER_INVALID;
+    } else {
+        *pPlayer = NULL;
+        const CAudioPlayer *prototypePlayer = prototype->mTemplate;
+        // recycle finished one-shot players before looking for a free object slot
+        IEngine_ReleaseFinishedPlayers(prototypePlayer->mObject.mEngine);
+        CAudioPlayer *this = (CAudioPlayer *) construct_clone(&prototypePlayer->mObject);
+        if (NULL == this) {
+            result = SL_RESULT_MEMORY_FAILURE;
+        } else {
+
+            // The copy still shares the resources of the prototypePlayer; forget them before
+            // anything can fail, so that Object::Destroy does not release them
+            memset(&this->mDataSource, 0, sizeof(DataLocatorFormat));
+            memset(&this->mDataSink, 0, sizeof(DataLocatorFormat));
+            this->mBufferQueue.mArray = NULL;
+
+            do {
+
+                result = copyDataLocatorFormat(&this->mDataSource, &prototypePlayer->mDataSource);
+                if (SL_RESULT_SUCCESS != result) {
+                    break;
+                }
+                result = copyDataLocatorFormat(&this->mDataSink, &prototypePlayer->mDataSink);
+                if (SL_RESULT_SUCCESS != result) {
+                    break;
+                }
+
+                if (prototypePlayer->mBufferQueue.mArray == prototypePlayer->mBufferQueue.mTypical) {
+                    this->mBufferQueue.mArray = this->mBufferQueue.mTypical;
+                } else {
+                    this->mBufferQueue.mArray = (BufferHeader *) malloc((this->mBufferQueue.
+                        mNumBuffers + 1) * sizeof(BufferHeader));
+                    if (NULL == this->mBufferQueue.mArray) {
+                        result = SL_RESULT_MEMORY_FAILURE;
+                        break;
+                    }
+                }
+                this->mBufferQueue.mFront = this->mBufferQueue.mArray;
+                this->mBufferQueue.mRear = this->mBufferQueue.mArray;
+                this->mDynamicSource.mDataSource = &this->mDataSource.u.mSource;
+
+#ifdef USE_SNDFILE
+                // refers the file state to our own copy of the URI
+                result = SndFile_checkAudioPlayerSourceSink(this);
+                if (SL_RESULT_SUCCESS != result) {
+                    break;
+                }
+#endif
+
+                // The copy is not yet visible to any other thread, so realize it in place
+                AsyncHook realize = this->mObject.mClass->mRealize;
+                result = (NULL != realize) ? (*realize)(this, SL_BOOLEAN_FALSE) :
+                    SL_RESULT_SUCCESS;
+                if (SL_RESULT_SUCCESS != result) {
+                    break;
+                }
+                this->mObject.mState = SL_OBJECT_STATE_REALIZED;
+
+                result = IOutputMixExt_checkAudioPlayerSourceSink(this);
+
+            } while (0);
+
+            if (SL_RESULT_SUCCESS != result) {
+                IObject_Destroy(&this->mObject.mItf);
+            } else {
+                IObject_Publish(&this->mObject);
+                // return the new audio player object
+                *pPlayer = &this->mObject.mItf;
+            }
+
+        }
+    }
+#else
+    result = SL_RESULT_FEATURE_UNSUPPORTED;
+#endif
+
+    SL_LEAVE_GLOBAL
+}
+
+
+/** \brief slVitaDestroyPlayerPrototype Function */
+
+void SLAPIENTRY slVitaDestroyPlayerPrototype(SLVitaPlayerPrototype prototype)
+{
+#ifdef USE_OUTPUTMIXEXT
+    if (NULL != prototype) {
+        CAudioPlayer *this = prototype->mTemplate;
+        // Object::Destroy gives back an object slot, so take back the one the prototypePlayer gave up
+        IEngine *thisEngine = this->mObject.mEngine;
+        interface_lock_exclusive(thisEngine);
+        ++thisEngine->mInstanceCount;
+        interface_unlock_exclusive(thisEngine);
+        IObject_Destroy(&this->mObject.mItf);
+        free(prototype);
+    }
+#endif
+}
+
+
+/** \brief A batch of objects being realized by slVitaRealizeObjects */
+
+typedef struct {
+    SLuint32 mRemaining;        ///< Objects not yet done, plus one until all have been queued
+    SLuint32 mNumObjects;
+    SLObjectItf *mObjects;
+    SLresult *mResults;
+    SLboolean mAsync;
+    slVitaRealizeCallback mCallback;
+    void *mContext;
+    pthread_mutex_t mMutex;     ///< For a synchronous batch, guards mDone
+    pthread_cond_t mCond;       ///< For a synchronous batch, signalled when mDone is set
+    SLboolean mDone;
+} RealizeBatch;
+
+
+/** \brief Count one object of the batch as done, and complete the batch after the last one */
+
+static void RealizeBatch_release(RealizeBatch *batch)
+{
+    if (0 != __atomic_sub_fetch(&batch->mRemaining, 1, __ATOMIC_ACQ_REL)) {
+        return;
+    }
+    if (batch->mAsync) {
+        if (NULL != batch->mCallback) {
+            (*batch->mCallback)(batch->mContext, batch->mNumObjects, batch->mObjects,
+                batch->mResults);
+        }
+        free(batch);
+    } else {
+        // the waiting thread frees the batch
+        int ok;
+        ok = pthread_mutex_lock(&batch->mMutex);
+        assert(0 == ok);
+        batch->mDone = SL_BOOLEAN_TRUE;
+        ok = pthread_cond_signal(&batch->mCond);
+        assert(0 == ok);
+        ok = pthread_mutex_unlock(&batch->mMutex);
+        assert(0 == ok);
+    }
+}
+
+
+/** \brief Called by a worker thread to realize one object of a batch.
+ *  Parameter self is the batch, and index is the index of the object.
+ */
+
+static void HandleRealizeBatch(void *self, int index)
+{
+    RealizeBatch *batch = (RealizeBatch *) self;
+    IObject *thisObject = (IObject *) batch->mObjects[index];
+    object_lock_exclusive(thisObject);
+    batch->mResults[index] = IObject_RealizeQueued(thisObject);
+    object_unlock_exclusive(thisObject);
+    RealizeBatch_release(batch);
+}
+
+
+/** \brief slVitaRealizeObjects Function */
+
+SLresult SLAPIENTRY slVitaRealizeObjects(SLEngineItf engine, SLuint32 numObjects,
+    const SLObjectItf *pObjects, SLboolean async, SLresult *pResults,
+    slVitaRealizeCallback callback, void *pContext)
+{
+    SL_ENTER_GLOBAL
+
+    do {
+
+        if ((NULL == engine) || (0 == numObjects) || (NULL == pObjects) ||
+                (!async && (NULL == pResults))) {
+            result = SL_RESULT_PARAMETER_INVALID;
+            break;
+        }
+        IEngine *thisEngine = (IEngine *) engine;
+
+        // the objects and results are stored after the batch, in the same allocation
+        RealizeBatch *batch = (RealizeBatch *) malloc(sizeof(RealizeBatch) +
+            numObjects * (sizeof(SLObjectItf) + sizeof(SLresult)));
+        if (NULL == batch) {
+            result = SL_RESULT_MEMORY_FAILURE;
+            break;
+        }
+        batch->mRemaining = numObjects + 1;
+        batch->mNumObjects = numObjects;
+        batch->mObjects = (SLObjectItf *) &batch[1];
+        batch->mResults = (SLresult *) &batch->mObjects[numObjects];
+        batch->mAsync = SL_BOOLEAN_FALSE != async;
+        batch->mCallback = callback;
+        batch->mContext = pContext;
+        batch->mDone = SL_BOOLEAN_FALSE;
+        if (!batch->mAsync) {
+            int err = pthread_mutex_init(&batch->mMutex, (const pthread_mutexattr_t *) NULL);
+            result = err_to_result(err);
+            if (SL_RESULT_SUCCESS != result) {
+                free(batch);
+                break;
+            }
+            err = pthread_cond_init(&batch->mCond, (const pthread_condattr_t *) NULL);
+            result = err_to_result(err);
+            if (SL_RESULT_SUCCESS != result) {
+                (void) pthread_mutex_destroy(&batch->mMutex);
+                free(batch);
+                break;
+            }
+        }
+
+        // queue each object that can be realized, as Object::Realize does
+        SLuint32 i;
+        for (i = 0; i < numObjects; ++i) {
+            IObject *thisObject = (IObject *) pObjects[i];
+            batch->mObjects[i] = pObjects[i];
+            SLresult objectResult;
+            if ((NULL == thisObject) || (thisEngine != thisObject->mEngine)) {
+                objectResult = SL_RESULT_PARAMETER_INVALID;
+            } else {
+                object_lock_exclusive(thisObject);
+                if (SL_OBJECT_STATE_UNREALIZED != thisObject->mState) {
+                    object_unlock_exclusive(thisObject);
+                    objectResult = SL_RESULT_PRECONDITIONS_VIOLATED;
+                } else {
+                    // mark operation pending and cancellable
+                    thisObject->mState = SL_OBJECT_STATE_REALIZING_1;
+                    object_unlock_exclusive(thisObject);
+                    objectResult = ThreadPool_add(&thisEngine->mThreadPool, HandleRealizeBatch,
+                        batch, (int) i);
+                    if (SL_RESULT_SUCCESS == objectResult) {
+                        // the worker thread counts it as done
+                        continue;
+                    }
+                    // Engine was destroyed during realize, or insufficient memory
+                    object_lock_exclusive(thisObject);
+                    thisObject->mState = SL_OBJECT_STATE_UNREALIZED;
+                    object_unlock_exclusive(thisObject);
+                }
+            }
+            batch->mResults[i] = objectResult;
+            RealizeBatch_release(batch);
+        }
+
+        // the last one done, which may be us, completes the batch; an asynchronous batch may
+        // already be freed after this
+        RealizeBatch_release(batch);
+        if (!async) {
+            int ok;
+            ok = pthread_mutex_lock(&batch->mMutex);
+            assert(0 == ok);
+            while (!batch->mDone) {
+                ok = pthread_cond_wait(&batch->mCond, &batch->mMutex);
+                assert(0 == ok);
+            }
+            ok = pthread_mutex_unlock(&batch->mMutex);
+            assert(0 == ok);
+            memcpy(pResults, batch->mResults, numObjects * sizeof(SLresult));
+            (void) pthread_cond_destroy(&batch->mCond);
+            (void) pthread_mutex_destroy(&batch->mMutex);
+            free(batch);
+        }
+        result = SL_RESULT_SUCCESS;
+
+    } while (0);
+
+    SL_LEAVE_GLOBAL
+}
+
+
+/** \brief slVitaDumpLockProfile Function */
+
+SLresult SLAPIENTRY slVitaDumpLockProfile(SLboolean reset)
+{
+    SL_ENTER_GLOBAL
+
+#ifdef USE_LOCK_PROFILE
+    lock_profile_dump(SL_BOOLEAN_FALSE != reset);
+    result = SL_RESULT_SUCCESS;
+#else
+    result = SL_RESULT_FEATURE_UNSUPPORTED;
+#endif
+
+    SL_LEAVE_GLOBAL
+}
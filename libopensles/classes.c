@@ -17,6 +17,7 @@
 /* Classes vs. interfaces */
 
 #include "sles_allinclusive.h"
+#include "handlers.h"
 
 
 #if USE_PROFILES & USE_PROFILES_GAME
@@ -43,7 +44,8 @@ static const ClassTable C3DGroup_class = {
     NULL,
     NULL,
     NULL,
-    C3DGroup_PreDestroy
+    C3DGroup_PreDestroy,
+    NULL
 };
 
 #endif
@@ -106,7 +108,8 @@ static const ClassTable CAudioPlayer_class = {
     CAudioPlayer_Realize,
     CAudioPlayer_Resume,
     CAudioPlayer_Destroy,
-    CAudioPlayer_PreDestroy
+    CAudioPlayer_PreDestroy,
+    AudioPlayer_handlers
 };
 
 
@@ -142,7 +145,8 @@ static const ClassTable CAudioRecorder_class = {
     CAudioRecorder_Realize,
     CAudioRecorder_Resume,
     CAudioRecorder_Destroy,
-    CAudioRecorder_PreDestroy
+    CAudioRecorder_PreDestroy,
+    AudioRecorder_handlers
 };
 
 #endif
@@ -159,8 +163,14 @@ static const struct iid_vtable Engine_interfaces[INTERFACES_Engine] = {
     {MPH_THREADSYNC, INTERFACE_IMPLICIT_BASE, offsetof(CEngine, mThreadSync)},
     {MPH_AUDIOIODEVICECAPABILITIES, INTERFACE_IMPLICIT_BASE,
         offsetof(CEngine, mAudioIODeviceCapabilities)},
+#ifdef USE_SNDFILE
+    // lists the codecs of the files that URI players can play, in any profile
+    {MPH_AUDIODECODERCAPABILITIES, INTERFACE_EXPLICIT,
+        offsetof(CEngine, mAudioDecoderCapabilities)},
+#else
     {MPH_AUDIODECODERCAPABILITIES, INTERFACE_EXPLICIT_BASE,
         offsetof(CEngine, mAudioDecoderCapabilities)},
+#endif
     {MPH_AUDIOENCODERCAPABILITIES, INTERFACE_EXPLICIT_BASE,
         offsetof(CEngine, mAudioEncoderCapabilities)},
     {MPH_3DCOMMIT, INTERFACE_EXPLICIT_GAME, offsetof(CEngine, m3DCommit)},
@@ -181,7 +191,8 @@ static const ClassTable CEngine_class = {
     CEngine_Realize,
     CEngine_Resume,
     CEngine_Destroy,
-    CEngine_PreDestroy
+    CEngine_PreDestroy,
+    NULL
 };
 
 
@@ -206,6 +217,7 @@ static const ClassTable CLEDDevice_class = {
     NULL,
     NULL,
     NULL,
+    NULL,
     NULL
 };
 
@@ -234,6 +246,7 @@ static const ClassTable CListener_class = {
     NULL,
     NULL,
     NULL,
+    NULL,
     NULL
 };
 
@@ -263,6 +276,7 @@ static const ClassTable CMetadataExtractor_class = {
     NULL,
     NULL,
     NULL,
+    NULL,
     NULL
 };
 
@@ -317,7 +331,8 @@ static const ClassTable CMidiPlayer_class = {
     NULL,
     NULL,
     NULL,
-    NULL
+    NULL,
+    MidiPlayer_handlers
 };
 
 #endif
@@ -361,7 +376,8 @@ static const ClassTable COutputMix_class = {
     COutputMix_Realize,
     COutputMix_Resume,
     COutputMix_Destroy,
-    COutputMix_PreDestroy
+    COutputMix_PreDestroy,
+    OutputMix_handlers
 };
 
 
@@ -386,6 +402,7 @@ static const ClassTable CVibraDevice_class = {
     NULL,
     NULL,
     NULL,
+    NULL,
     NULL
 };
 
@@ -123,7 +123,18 @@ static const SLuint32 Codec_IDs[] = {
     SL_AUDIOCODEC_VORBIS
 };
 
+#ifdef USE_SNDFILE
+// see SndFile_IsSupported
+static const SLuint32 SndFile_Codec_IDs[] = {
+    SL_AUDIOCODEC_PCM,
+    SL_AUDIOCODEC_VORBIS,
+    SL_VITA_AUDIOCODEC_FLAC
+};
+
+const SLuint32 *Decoder_IDs = SndFile_Codec_IDs;
+#else
 const SLuint32 *Decoder_IDs = Codec_IDs;
+#endif
 const SLuint32 *Encoder_IDs = Codec_IDs;
 
 static const SLmilliHertz SamplingRates_A[] = {
@@ -158,6 +169,73 @@ static const SLAudioCodecDescriptor CodecDescriptor_A = {
     0                    // modeSetting
 };
 
+#ifdef USE_SNDFILE
+
+// the rates and channels are those that SndFile_convert takes to the output format
+
+static const SLAudioCodecDescriptor CodecDescriptor_SndFilePCM = {
+    SndFile_MAXCHANNELS,            // maxChannels
+    8,                              // minBitsPerSample
+    32,                             // maxBitsPerSample
+    SndFile_MINRATE * 1000,         // minSampleRate
+    SndFile_MAXRATE * 1000,         // maxSampleRate
+    SL_BOOLEAN_TRUE,                // isFreqRangeContinuous
+    NULL,                           // pSampleRatesSupported;
+    0,                              // numSampleRatesSupported
+    1,                              // minBitRate
+    ~((SLuint32)0),                 // maxBitRate
+    SL_BOOLEAN_TRUE,                // isBitrateRangeContinuous
+    NULL,                           // pBitratesSupported
+    0,                              // numBitratesSupported
+    SL_AUDIOPROFILE_PCM,            // profileSetting
+    0                               // modeSetting
+};
+
+static const SLAudioCodecDescriptor CodecDescriptor_SndFileVorbis = {
+    SndFile_MAXCHANNELS,            // maxChannels
+    16,                             // minBitsPerSample
+    16,                             // maxBitsPerSample
+    SndFile_MINRATE * 1000,         // minSampleRate
+    SndFile_MAXRATE * 1000,         // maxSampleRate
+    SL_BOOLEAN_TRUE,                // isFreqRangeContinuous
+    NULL,                           // pSampleRatesSupported;
+    0,                              // numSampleRatesSupported
+    1,                              // minBitRate
+    ~((SLuint32)0),                 // maxBitRate
+    SL_BOOLEAN_TRUE,                // isBitrateRangeContinuous
+    NULL,                           // pBitratesSupported
+    0,                              // numBitratesSupported
+    0,                              // profileSetting, none defined
+    0                               // modeSetting
+};
+
+static const SLAudioCodecDescriptor CodecDescriptor_SndFileFLAC = {
+    SndFile_MAXCHANNELS,            // maxChannels
+    8,                              // minBitsPerSample
+    24,                             // maxBitsPerSample
+    SndFile_MINRATE * 1000,         // minSampleRate
+    SndFile_MAXRATE * 1000,         // maxSampleRate
+    SL_BOOLEAN_TRUE,                // isFreqRangeContinuous
+    NULL,                           // pSampleRatesSupported;
+    0,                              // numSampleRatesSupported
+    1,                              // minBitRate
+    ~((SLuint32)0),                 // maxBitRate
+    SL_BOOLEAN_TRUE,                // isBitrateRangeContinuous
+    NULL,                           // pBitratesSupported
+    0,                              // numBitratesSupported
+    0,                              // profileSetting, none defined
+    0                               // modeSetting
+};
+
+const CodecDescriptor DecoderDescriptors[] = {
+    {SL_AUDIOCODEC_PCM, &CodecDescriptor_SndFilePCM},
+    {SL_AUDIOCODEC_VORBIS, &CodecDescriptor_SndFileVorbis},
+    {SL_VITA_AUDIOCODEC_FLAC, &CodecDescriptor_SndFileFLAC},
+    {SL_AUDIOCODEC_NULL, NULL}
+};
+
+#else
+
 const CodecDescriptor DecoderDescriptors[] = {
     {SL_AUDIOCODEC_PCM, &CodecDescriptor_A},
     {SL_AUDIOCODEC_MP3, &CodecDescriptor_A},
@@ -171,6 +249,8 @@ const CodecDescriptor DecoderDescriptors[] = {
     {SL_AUDIOCODEC_NULL, NULL}
 };
 
+#endif
+
 const CodecDescriptor EncoderDescriptors[] = {
     {SL_AUDIOCODEC_PCM, &CodecDescriptor_A},
     {SL_AUDIOCODEC_MP3, &CodecDescriptor_A},
@@ -39,7 +39,7 @@ extern const struct Vibra_id_descriptor {
 
 // These are not in 1.0.1 header file
 #define SL_AUDIOCODEC_NULL   0
-#define SL_AUDIOCODEC_VORBIS 9
+// SL_AUDIOCODEC_VORBIS is in SLES/OpenSLES_Vita.h, as applications see it
 
 /** \brief Associates a codec ID with a corresponding codec descriptor */
 
@@ -48,10 +48,15 @@ typedef struct {
     const SLAudioCodecDescriptor *mDescriptor;  ///< The corresponding descriptor
 } CodecDescriptor;
 
+#ifdef USE_SNDFILE
+#define MAX_DECODERS 3 ///< (sizeof(Decoder_IDs) / sizeof(Decoder_IDs[0]))
+#else
 #define MAX_DECODERS 9 ///< (sizeof(Decoder_IDs) / sizeof(Decoder_IDs[0]))
+#endif
 #define MAX_ENCODERS 9 ///< (sizeof(Encoder_IDs) / sizeof(Encoder_IDs[0]))
 
-// For now, but encoders might be different than decoders later
+// For now, but encoders might be different than decoders later; with libsndfile the decoders
+// are those of the files that URI players can play
 extern const SLuint32 *Decoder_IDs, *Encoder_IDs;
 
 extern const CodecDescriptor DecoderDescriptors[], EncoderDescriptors[];
@@ -0,0 +1,141 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** \file handlers.c Attribute handlers, called by domain_unlock_exclusive_attributes */
+
+#include "sles_allinclusive.h"
+#include "handlers.h"
+
+// Android likes to see certain updates synchronously.  A handler runs with the lock domain that
+// reported its attribute held, and only reads fields of that domain.  It returns its own bit if
+// the attribute should also be processed asynchronously by sync, otherwise ATTR_NONE.
+
+
+// AudioPlayer
+
+static unsigned handler_AudioPlayer_gain(void *self)
+{
+    CAudioPlayer *ap = (CAudioPlayer *) self;
+#ifdef ANDROID
+    android_audioPlayer_volumeUpdate(ap);
+#else
+    audioPlayerGainUpdate(ap);
+#endif
+    return ATTR_NONE;
+}
+
+#ifdef ANDROID
+
+static unsigned handler_AudioPlayer_transport(void *self)
+{
+    CAudioPlayer *ap = (CAudioPlayer *) self;
+    // FIXME should only call when state changes
+    android_audioPlayer_setPlayState(ap, false /*lockAP*/);
+    // FIXME ditto, but for either eventflags or marker position
+    android_audioPlayer_useEventMask(ap);
+    return ATTR_NONE;
+}
+
+static unsigned handler_AudioPlayer_position(void *self)
+{
+    CAudioPlayer *ap = (CAudioPlayer *) self;
+    android_audioPlayer_seek(ap, ap->mSeek.mPos);
+    return ATTR_NONE;
+}
+
+#endif
+
+// ( buffer queue count is non-empty and play state == PLAYING ) became true
+// The two halves are in different domains: Play::SetPlayState and BufferQueue::Enqueue
+// each store their half, then fence, then peek at the other half, so at least one of them
+// reports this attribute when both become true.
+
+static unsigned handler_AudioPlayer_enqueue(void *self)
+{
+    CAudioPlayer *ap = (CAudioPlayer *) self;
+    if (SL_PLAYSTATE_PLAYING == field_peek(ap->mPlay.mState)) {
+#ifdef ANDROID
+        android_audioPlayer_bufferQueue_onRefilled(ap);
+#endif
+    }
+    return ATTR_NONE;
+}
+
+// Transport and position are handled by sync for SndFile
+const AttributeHandler AudioPlayer_handlers[ATTR_INDEX_MAX] = {
+    [ATTR_INDEX_GAIN] = handler_AudioPlayer_gain,
+#ifdef ANDROID
+    [ATTR_INDEX_TRANSPORT] = handler_AudioPlayer_transport,
+    [ATTR_INDEX_POSITION] = handler_AudioPlayer_position,
+#endif
+    [ATTR_INDEX_ENQUEUE] = handler_AudioPlayer_enqueue
+};
+
+
+// AudioRecorder
+
+#ifdef ANDROID
+
+static unsigned handler_AudioRecorder_transport(void *self)
+{
+    CAudioRecorder *ar = (CAudioRecorder *) self;
+    android_audioRecorder_useEventMask(ar);
+    return ATTR_NONE;
+}
+
+#endif
+
+const AttributeHandler AudioRecorder_handlers[ATTR_INDEX_MAX] = {
+#ifdef ANDROID
+    [ATTR_INDEX_TRANSPORT] = handler_AudioRecorder_transport
+#else
+    NULL
+#endif
+};
+
+
+// MidiPlayer
+
+static unsigned handler_MidiPlayer_gain(void *self)
+{
+    SL_LOGD("[ FIXME: gain update on an SL_OBJECTID_MIDIPLAYER to be implemented ]");
+    return ATTR_GAIN;
+}
+
+static unsigned handler_MidiPlayer_position(void *self)
+{
+    SL_LOGD("[ FIXME: position update on an SL_OBJECTID_MIDIPLAYER to be implemented ]");
+    return ATTR_POSITION;
+}
+
+const AttributeHandler MidiPlayer_handlers[ATTR_INDEX_MAX] = {
+    [ATTR_INDEX_GAIN] = handler_MidiPlayer_gain,
+    [ATTR_INDEX_POSITION] = handler_MidiPlayer_position
+};
+
+
+// OutputMix
+
+static unsigned handler_OutputMix_gain(void *self)
+{
+    // FIXME update gains on all players attached to this outputmix
+    SL_LOGD("[ FIXME: gain update on an SL_OBJECTID_OUTPUTMIX to be implemented ]");
+    return ATTR_GAIN;
+}
+
+const AttributeHandler OutputMix_handlers[ATTR_INDEX_MAX] = {
+    [ATTR_INDEX_GAIN] = handler_OutputMix_gain
+};
@@ -0,0 +1,24 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** \file handlers.h Per-class tables of synchronous attribute handlers */
+
+// Each table has ATTR_INDEX_MAX entries, and is referenced by ClassTable::mAttributeHandlers
+
+extern const AttributeHandler AudioPlayer_handlers[ATTR_INDEX_MAX];
+extern const AttributeHandler AudioRecorder_handlers[ATTR_INDEX_MAX];
+extern const AttributeHandler MidiPlayer_handlers[ATTR_INDEX_MAX];
+extern const AttributeHandler OutputMix_handlers[ATTR_INDEX_MAX];
@@ -15,265 +15,740 @@
  */
 
 #include "sles_allinclusive.h"
+#ifdef USE_LOCK_PROFILE
+#include <time.h>
+#endif
+#ifdef USE_FUTEX_LOCK
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+
+// Exclusive lockers that find shared lockers still in wait here for the last one to leave.
+// These are shared by all lock domains, as the wait is rare and short.
+
+static pthread_mutex_t sharedDrainMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sharedDrainCond = PTHREAD_COND_INITIALIZER;
+
+
+// Whether a domain of an object is never locked, see LOCK_DOMAINS_APPLICATION
+
+#define domain_elided(this, domain) ((this)->mElidedDomains & (1 << (domain)))
+
+
+// The mutex and condition variable of a lock domain.  With USE_ADAPTIVE_LOCK, a contended lock
+// spins for a while before the thread sleeps, as most critical sections are only a few dozen
+// instructions long.  On Linux the lock is a futex, elsewhere the pthread mutex after the spin.
+
+#define LOCK_SPINS 100
+
+#if defined(__i386__) || defined(__x86_64__)
+#define cpu_relax() __builtin_ia32_pause()
+#elif defined(__arm__) || defined(__aarch64__)
+#define cpu_relax() __asm__ __volatile__("yield")
+#else
+#define cpu_relax() do { } while (0)
+#endif
+
+#ifdef USE_FUTEX_LOCK
+
+static void futex_wait(unsigned *addr, unsigned value)
+{
+    // returns early on a spurious wakeup or if *addr != value, so callers re-check
+    (void) syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+}
+
+static void futex_wake(unsigned *addr, int count)
+{
+    (void) syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+static void mutex_init(LockDomain *d)
+{
+    d->mMutex = 0;
+    d->mCond = 0;
+}
+
+static void mutex_deinit(LockDomain *d)
+{
+    (void) d;
+}
+
+static int mutex_trylock(LockDomain *d)
+{
+    unsigned expected = 0;
+    return __atomic_compare_exchange_n(&d->mMutex, &expected, 1, SL_BOOLEAN_FALSE,
+        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED) ? 0 : EBUSY;
+}
+
+/** \brief Sleep until the mutex is ours; marks it as maybe having waiters */
+
+static void mutex_lock_contended(LockDomain *d)
+{
+    while (0 != __atomic_exchange_n(&d->mMutex, 2, __ATOMIC_ACQUIRE)) {
+        futex_wait(&d->mMutex, 2);
+    }
+}
+
+static void mutex_lock(LockDomain *d)
+{
+    unsigned spins;
+    for (spins = 0; spins < LOCK_SPINS; ++spins) {
+        if (0 == __atomic_load_n(&d->mMutex, __ATOMIC_RELAXED) && 0 == mutex_trylock(d)) {
+            return;
+        }
+        cpu_relax();
+    }
+    mutex_lock_contended(d);
+}
+
+static void mutex_unlock(LockDomain *d)
+{
+    if (2 == __atomic_exchange_n(&d->mMutex, 0, __ATOMIC_RELEASE)) {
+        futex_wake(&d->mMutex, 1);
+    }
+}
+
+static void mutex_cond_wait(LockDomain *d)
+{
+    // a signal after we read the sequence number changes it, so the futex does not sleep
+    unsigned sequence = __atomic_load_n(&d->mCond, __ATOMIC_RELAXED);
+    mutex_unlock(d);
+    futex_wait(&d->mCond, sequence);
+    // other threads may be asleep on the mutex by now
+    mutex_lock_contended(d);
+}
+
+static void mutex_cond_wake(LockDomain *d, SLboolean all)
+{
+    __atomic_add_fetch(&d->mCond, 1, __ATOMIC_RELAXED);
+    futex_wake(&d->mCond, all ? INT_MAX : 1);
+}
+
+#else
+
+static void mutex_init(LockDomain *d)
+{
+    int ok;
+    ok = pthread_mutex_init(&d->mMutex, (const pthread_mutexattr_t *) NULL);
+    assert(0 == ok);
+    ok = pthread_cond_init(&d->mCond, (const pthread_condattr_t *) NULL);
+    assert(0 == ok);
+}
+
+static void mutex_deinit(LockDomain *d)
+{
+    int ok;
+    ok = pthread_cond_destroy(&d->mCond);
+    assert(0 == ok);
+    ok = pthread_mutex_destroy(&d->mMutex);
+    assert(0 == ok);
+}
+
+#if defined(USE_ADAPTIVE_LOCK) || defined(USE_DEBUG)
+static int mutex_trylock(LockDomain *d)
+{
+    return pthread_mutex_trylock(&d->mMutex);
+}
+#endif
+
+static void mutex_lock(LockDomain *d)
+{
+#ifdef USE_ADAPTIVE_LOCK
+    unsigned spins;
+    for (spins = 0; spins < LOCK_SPINS; ++spins) {
+        if (0 == mutex_trylock(d)) {
+            return;
+        }
+        cpu_relax();
+    }
+#endif
+    int ok;
+    ok = pthread_mutex_lock(&d->mMutex);
+    assert(0 == ok);
+}
+
+static void mutex_unlock(LockDomain *d)
+{
+    int ok;
+    ok = pthread_mutex_unlock(&d->mMutex);
+    assert(0 == ok);
+}
+
+static void mutex_cond_wait(LockDomain *d)
+{
+    int ok;
+    ok = pthread_cond_wait(&d->mCond, &d->mMutex);
+    assert(0 == ok);
+}
+
+static void mutex_cond_wake(LockDomain *d, SLboolean all)
+{
+    int ok;
+    ok = all ? pthread_cond_broadcast(&d->mCond) : pthread_cond_signal(&d->mCond);
+    assert(0 == ok);
+}
+
+#endif
+
+
+/** \brief Called with the mutex locked: keep out new shared lockers, and wait for the current
+ *  ones to leave.  Shared lock holders only copy a few fields, so spin briefly before blocking.
+ */
+
+static void domain_exclude_shared(LockDomain *d)
+{
+    // pairs with domain_lock_shared and domain_unlock_shared: either they see mExclusive,
+    // or we see their change to mSharedCount
+    __atomic_store_n(&d->mExclusive, SL_BOOLEAN_TRUE, __ATOMIC_SEQ_CST);
+    unsigned spins;
+    for (spins = 0; spins < LOCK_SPINS; ++spins) {
+        if (0 == __atomic_load_n(&d->mSharedCount, __ATOMIC_SEQ_CST)) {
+            return;
+        }
+        cpu_relax();
+    }
+    int ok;
+    ok = pthread_mutex_lock(&sharedDrainMutex);
+    assert(0 == ok);
+    while (0 != __atomic_load_n(&d->mSharedCount, __ATOMIC_SEQ_CST)) {
+        ok = pthread_cond_wait(&sharedDrainCond, &sharedDrainMutex);
+        assert(0 == ok);
+    }
+    ok = pthread_mutex_unlock(&sharedDrainMutex);
+    assert(0 == ok);
+}
+
+
+/** \brief Called with the mutex locked, before unlocking it: let shared lockers in again */
+
+static void domain_allow_shared(LockDomain *d)
+{
+    __atomic_store_n(&d->mExclusive, SL_BOOLEAN_FALSE, __ATOMIC_RELEASE);
+}
+
+
+#ifdef USE_LOCK_PROFILE
+
+// Lock contention profile: statistics per call site of domain_lock_exclusive, or of
+// domain_cond_wait for the re-acquisition after the wait.  A call site is identified by the
+// __FILE__ pointer and __LINE__ passed to the USE_DEBUG functions, which is enough because
+// each call site passes the same string literal every time.
+
+#define LOCK_PROFILE_SITES 512      // power of 2
+
+struct LockSite {
+    const char *mFile;              // NULL if the slot is free; published with release
+    int mLine;
+    uint64_t mAcquisitions;         // number of times the lock was taken here
+    uint64_t mContended;            // of those, how many found it already locked
+    uint64_t mWaitTotal;            // ns spent waiting for the lock
+    uint64_t mWaitMax;
+    uint64_t mHoldTotal;            // ns between taking the lock here and releasing it
+    uint64_t mHoldMax;
+};
+
+static struct LockSite lockSites[LOCK_PROFILE_SITES];
+static unsigned lockSitesDropped;   // acquisitions not recorded because the table was full
+static pthread_mutex_t lockSitesMutex = PTHREAD_MUTEX_INITIALIZER;   // serializes insertions
+
+static uint64_t lock_profile_now(void)
+{
+    struct timespec ts;
+    (void) clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void lock_profile_max(uint64_t *max, uint64_t value)
+{
+    uint64_t old = __atomic_load_n(max, __ATOMIC_RELAXED);
+    while (value > old && !__atomic_compare_exchange_n(max, &old, value, SL_BOOLEAN_TRUE,
+            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+/** \brief Find or add the entry of a call site, or return NULL if the table is full */
+
+static struct LockSite *lock_profile_site(const char *file, int line)
+{
+    unsigned hash = ((unsigned) (uintptr_t) file >> 2) ^ ((unsigned) line * 2654435761U);
+    unsigned i, n;
+    // lookups do not lock: an entry is never removed, and its key is written before mFile
+    for (i = hash, n = 0; n < LOCK_PROFILE_SITES; ++i, ++n) {
+        struct LockSite *site = &lockSites[i & (LOCK_PROFILE_SITES - 1)];
+        const char *siteFile = __atomic_load_n(&site->mFile, __ATOMIC_ACQUIRE);
+        if (NULL == siteFile) {
+            break;
+        }
+        if (file == siteFile && line == site->mLine) {
+            return site;
+        }
+    }
+    if (LOCK_PROFILE_SITES == n) {
+        return NULL;
+    }
+    // not found, so add it, unless another thread has added it meanwhile
+    struct LockSite *result = NULL;
+    int ok;
+    ok = pthread_mutex_lock(&lockSitesMutex);
+    assert(0 == ok);
+    for ( ; n < LOCK_PROFILE_SITES; ++i, ++n) {
+        struct LockSite *site = &lockSites[i & (LOCK_PROFILE_SITES - 1)];
+        if (NULL == site->mFile) {
+            site->mLine = line;
+            __atomic_store_n(&site->mFile, file, __ATOMIC_RELEASE);
+            result = site;
+            break;
+        }
+        if (file == site->mFile && line == site->mLine) {
+            result = site;
+            break;
+        }
+    }
+    ok = pthread_mutex_unlock(&lockSitesMutex);
+    assert(0 == ok);
+    return result;
+}
+
+/** \brief Called with the exclusive lock just taken at file:line, after waiting since start */
 
+static void lock_profile_acquired(LockDomain *d, const char *file, int line, uint64_t start,
+    SLboolean contended)
+{
+    struct LockSite *site = lock_profile_site(file, line);
+    uint64_t now = lock_profile_now();
+    if (NULL != site) {
+        __atomic_fetch_add(&site->mAcquisitions, 1, __ATOMIC_RELAXED);
+        if (contended) {
+            __atomic_fetch_add(&site->mContended, 1, __ATOMIC_RELAXED);
+        }
+        __atomic_fetch_add(&site->mWaitTotal, now - start, __ATOMIC_RELAXED);
+        lock_profile_max(&site->mWaitMax, now - start);
+    } else {
+        __atomic_fetch_add(&lockSitesDropped, 1, __ATOMIC_RELAXED);
+    }
+    d->mSite = site;
+    d->mLockTime = now;
+}
 
-/** \brief Exclusively lock an object */
+/** \brief Called with the exclusive lock held, just before it is released */
+
+static void lock_profile_released(LockDomain *d)
+{
+    struct LockSite *site = d->mSite;
+    if (NULL != site) {
+        uint64_t hold = lock_profile_now() - d->mLockTime;
+        __atomic_fetch_add(&site->mHoldTotal, hold, __ATOMIC_RELAXED);
+        lock_profile_max(&site->mHoldMax, hold);
+        d->mSite = NULL;
+    }
+}
+
+static int lock_profile_compare(const void *a, const void *b)
+{
+    const struct LockSite *siteA = (const struct LockSite *) a;
+    const struct LockSite *siteB = (const struct LockSite *) b;
+    // most total wait first, then most total hold
+    if (siteA->mWaitTotal != siteB->mWaitTotal) {
+        return siteA->mWaitTotal < siteB->mWaitTotal ? 1 : -1;
+    }
+    if (siteA->mHoldTotal != siteB->mHoldTotal) {
+        return siteA->mHoldTotal < siteB->mHoldTotal ? 1 : -1;
+    }
+    return 0;
+}
+
+/** \brief Log the lock contention profile, call sites with the most time spent waiting first,
+ *  and optionally start a new profile.  Times are in microseconds.
+ */
+
+void lock_profile_dump(SLboolean reset)
+{
+    static struct LockSite sorted[LOCK_PROFILE_SITES];
+    unsigned i, count = 0;
+    int ok;
+    ok = pthread_mutex_lock(&lockSitesMutex);
+    assert(0 == ok);
+    for (i = 0; i < LOCK_PROFILE_SITES; ++i) {
+        struct LockSite *site = &lockSites[i];
+        if (NULL == site->mFile) {
+            continue;
+        }
+        struct LockSite *copy = &sorted[count++];
+        copy->mFile = site->mFile;
+        copy->mLine = site->mLine;
+        copy->mAcquisitions = __atomic_load_n(&site->mAcquisitions, __ATOMIC_RELAXED);
+        copy->mContended = __atomic_load_n(&site->mContended, __ATOMIC_RELAXED);
+        copy->mWaitTotal = __atomic_load_n(&site->mWaitTotal, __ATOMIC_RELAXED);
+        copy->mWaitMax = __atomic_load_n(&site->mWaitMax, __ATOMIC_RELAXED);
+        copy->mHoldTotal = __atomic_load_n(&site->mHoldTotal, __ATOMIC_RELAXED);
+        copy->mHoldMax = __atomic_load_n(&site->mHoldMax, __ATOMIC_RELAXED);
+        if (reset) {
+            // the call sites stay, as lookups do not lock
+            __atomic_store_n(&site->mAcquisitions, 0, __ATOMIC_RELAXED);
+            __atomic_store_n(&site->mContended, 0, __ATOMIC_RELAXED);
+            __atomic_store_n(&site->mWaitTotal, 0, __ATOMIC_RELAXED);
+            __atomic_store_n(&site->mWaitMax, 0, __ATOMIC_RELAXED);
+            __atomic_store_n(&site->mHoldTotal, 0, __ATOMIC_RELAXED);
+            __atomic_store_n(&site->mHoldMax, 0, __ATOMIC_RELAXED);
+        }
+    }
+    unsigned dropped = reset ? __atomic_exchange_n(&lockSitesDropped, 0, __ATOMIC_RELAXED) :
+        __atomic_load_n(&lockSitesDropped, __ATOMIC_RELAXED);
+    qsort(sorted, count, sizeof(sorted[0]), lock_profile_compare);
+    SL_LOGI("lock profile: %u call sites, %u acquisitions not recorded", count, dropped);
+    SL_LOGI("%10s %10s %6s %12s %10s %12s %10s  %s", "locks", "contended", "%",
+        "wait us", "max", "hold us", "max", "call site");
+    for (i = 0; i < count; ++i) {
+        const struct LockSite *site = &sorted[i];
+        if (0 == site->mAcquisitions) {
+            continue;
+        }
+        SL_LOGI("%10llu %10llu %6.2f %12llu %10llu %12llu %10llu  %s:%d",
+            (unsigned long long) site->mAcquisitions, (unsigned long long) site->mContended,
+            site->mContended * 100.0 / site->mAcquisitions,
+            (unsigned long long) site->mWaitTotal / 1000,
+            (unsigned long long) site->mWaitMax / 1000,
+            (unsigned long long) site->mHoldTotal / 1000,
+            (unsigned long long) site->mHoldMax / 1000, site->mFile, site->mLine);
+    }
+    // sorted is static to keep it off the stack, so it is only used with the mutex held
+    ok = pthread_mutex_unlock(&lockSitesMutex);
+    assert(0 == ok);
+}
+
+#endif
+
+
+/** \brief Initialize all lock domains of an object */
+
+void object_init_locks(IObject *this)
+{
+    unsigned domain;
+    for (domain = 0; domain < LOCK_DOMAINS; ++domain) {
+        LockDomain *d = &this->mDomains[domain];
+        mutex_init(d);
+        d->mSharedCount = 0;
+        d->mExclusive = SL_BOOLEAN_FALSE;
+#ifdef USE_DEBUG
+        memset(&d->mOwner, 0, sizeof(pthread_t));
+        d->mFile = NULL;
+        d->mLine = 0;
+#endif
+#ifdef USE_LOCK_PROFILE
+        d->mSite = NULL;
+        d->mLockTime = 0;
+#endif
+    }
+}
+
+
+/** \brief Destroy all lock domains of an object, which is exclusively locked by the caller */
+
+void object_deinit_locks(IObject *this)
+{
+    unsigned domain;
+    for (domain = 0; domain < LOCK_DOMAINS; ++domain) {
+        LockDomain *d = &this->mDomains[domain];
+        if (LOCK_DOMAIN_OBJECT == domain) {
+            // equivalent to object_unlock_exclusive, but without the rigmarole
+            mutex_unlock(d);
+        }
+        mutex_deinit(d);
+    }
+}
+
+
+/** \brief Exclusively lock a domain of an object */
 
 #ifdef USE_DEBUG
-void object_lock_exclusive_(IObject *this, const char *file, int line)
+void domain_lock_exclusive_(IObject *this, unsigned domain, const char *file, int line)
 {
+    assert(LOCK_DOMAINS > domain);
+    if (domain_elided(this, domain)) {
+        return;
+    }
+    LockDomain *d = &this->mDomains[domain];
+#ifdef USE_LOCK_PROFILE
+    uint64_t start = lock_profile_now();
+#endif
     int ok;
-    ok = pthread_mutex_trylock(&this->mMutex);
+    ok = mutex_trylock(d);
     if (0 != ok) {
+#ifdef USE_LOCK_PROFILE
+        // the backoffs below would be counted as waiting, so block instead
+        mutex_lock(d);
+#else
         // pthread_mutex_timedlock_np is not available, but wait up to 100 ms
         static const useconds_t backoffs[] = {1, 10000, 20000, 30000, 40000};
         unsigned i = 0;
         for (;;) {
             usleep(backoffs[i]);
-            ok = pthread_mutex_trylock(&this->mMutex);
+            ok = mutex_trylock(d);
             if (0 == ok)
                 break;
             if (++i >= (sizeof(backoffs) / sizeof(backoffs[0]))) {
-                SL_LOGE("%s:%d: object %p was locked by %p at %s:%d\n",
-                    file, line, this, *(void **)&this->mOwner, this->mFile, this->mLine);
+                SL_LOGE("%s:%d: object %p domain %u was locked by %p at %s:%d\n",
+                    file, line, this, domain, *(void **)&d->mOwner, d->mFile, d->mLine);
                 // attempt one more time; maybe this time we will be successful
-                ok = pthread_mutex_lock(&this->mMutex);
-                assert(0 == ok);
+                mutex_lock(d);
                 break;
             }
         }
+#endif
     }
+    domain_exclude_shared(d);
     pthread_t zero;
     memset(&zero, 0, sizeof(pthread_t));
-    if (0 != memcmp(&zero, &this->mOwner, sizeof(pthread_t))) {
-        if (pthread_equal(pthread_self(), this->mOwner)) {
-            SL_LOGE("%s:%d: object %p was recursively locked by %p at %s:%d\n",
-                file, line, this, *(void **)&this->mOwner, this->mFile, this->mLine);
+    if (0 != memcmp(&zero, &d->mOwner, sizeof(pthread_t))) {
+        if (pthread_equal(pthread_self(), d->mOwner)) {
+            SL_LOGE("%s:%d: object %p domain %u was recursively locked by %p at %s:%d\n",
+                file, line, this, domain, *(void **)&d->mOwner, d->mFile, d->mLine);
         } else {
-            SL_LOGE("%s:%d: object %p was left unlocked in unexpected state by %p at %s:%d\n",
-                file, line, this, *(void **)&this->mOwner, this->mFile, this->mLine);
+            SL_LOGE("%s:%d: object %p domain %u was left unlocked in unexpected state by %p "
+                "at %s:%d\n", file, line, this, domain, *(void **)&d->mOwner, d->mFile,
+                d->mLine);
         }
         assert(false);
     }
-    this->mOwner = pthread_self();
-    this->mFile = file;
-    this->mLine = line;
+    d->mOwner = pthread_self();
+    d->mFile = file;
+    d->mLine = line;
+#ifdef USE_LOCK_PROFILE
+    lock_profile_acquired(d, file, line, start, 0 != ok);
+#endif
 }
 #else
-void object_lock_exclusive(IObject *this)
+void domain_lock_exclusive(IObject *this, unsigned domain)
 {
-    int ok;
-    ok = pthread_mutex_lock(&this->mMutex);
-    assert(0 == ok);
+    assert(LOCK_DOMAINS > domain);
+    if (domain_elided(this, domain)) {
+        return;
+    }
+    LockDomain *d = &this->mDomains[domain];
+    mutex_lock(d);
+    domain_exclude_shared(d);
 }
 #endif
 
 
-/** \brief Exclusively unlock an object and do not report any updates */
+/** \brief Exclusively unlock a domain of an object and do not report any updates */
 
 #ifdef USE_DEBUG
-void object_unlock_exclusive_(IObject *this, const char *file, int line)
-{
-    assert(pthread_equal(pthread_self(), this->mOwner));
-    assert(NULL != this->mFile);
-    assert(0 != this->mLine);
-    memset(&this->mOwner, 0, sizeof(pthread_t));
-    this->mFile = file;
-    this->mLine = line;
-    int ok;
-    ok = pthread_mutex_unlock(&this->mMutex);
-    assert(0 == ok);
+void domain_unlock_exclusive_(IObject *this, unsigned domain, const char *file, int line)
+{
+    assert(LOCK_DOMAINS > domain);
+    if (domain_elided(this, domain)) {
+        return;
+    }
+    LockDomain *d = &this->mDomains[domain];
+    assert(pthread_equal(pthread_self(), d->mOwner));
+    assert(NULL != d->mFile);
+    assert(0 != d->mLine);
+#ifdef USE_LOCK_PROFILE
+    lock_profile_released(d);
+#endif
+    memset(&d->mOwner, 0, sizeof(pthread_t));
+    d->mFile = file;
+    d->mLine = line;
+    domain_allow_shared(d);
+    mutex_unlock(d);
 }
 #else
-void object_unlock_exclusive(IObject *this)
+void domain_unlock_exclusive(IObject *this, unsigned domain)
 {
-    int ok;
-    ok = pthread_mutex_unlock(&this->mMutex);
-    assert(0 == ok);
+    assert(LOCK_DOMAINS > domain);
+    if (domain_elided(this, domain)) {
+        return;
+    }
+    LockDomain *d = &this->mDomains[domain];
+    domain_allow_shared(d);
+    mutex_unlock(d);
 }
 #endif
 
 
-/** \brief Exclusively unlock an object and report updates to the specified bit-mask of
- *  attributes
+/** \brief Exclusively unlock a domain of an object and report updates to the specified bit-mask
+ *  of attributes.  The attribute handlers of the class only read fields of the domain that
+ *  reports the attribute: gain from the gain domain, position and transport from the transport
+ *  domain.
  */
 
 #ifdef USE_DEBUG
-void object_unlock_exclusive_attributes_(IObject *this, unsigned attributes,
+void domain_unlock_exclusive_attributes_(IObject *this, unsigned domain, unsigned attributes,
     const char *file, int line)
 #else
-void object_unlock_exclusive_attributes(IObject *this, unsigned attributes)
+void domain_unlock_exclusive_attributes(IObject *this, unsigned domain, unsigned attributes)
 #endif
 {
+    assert(LOCK_DOMAINS > domain);
+    LockDomain *d = &this->mDomains[domain];
+    SLboolean elided = 0 != domain_elided(this, domain);
 
 #ifdef USE_DEBUG
-    assert(pthread_equal(pthread_self(), this->mOwner));
-    assert(NULL != this->mFile);
-    assert(0 != this->mLine);
+    assert(elided || pthread_equal(pthread_self(), d->mOwner));
+    assert(elided || NULL != d->mFile);
+    assert(elided || 0 != d->mLine);
 #endif
 
-    int ok;
-    SLuint32 objectID = IObjectToObjectID(this);
-    CAudioPlayer *ap;
-
-    // FIXME The endless if statements are getting ugly, should use bit search
-
-    // Android likes to see certain updates synchronously
-
-    if (attributes & ATTR_GAIN) {
-        switch (objectID) {
-        case SL_OBJECTID_AUDIOPLAYER:
-            attributes &= ~ATTR_GAIN;   // no need to process asynchronously also
-            ap = (CAudioPlayer *) this;
-#ifdef ANDROID
-            android_audioPlayer_volumeUpdate(ap);
-#else
-            audioPlayerGainUpdate(ap);
-#endif
-            break;
-        case SL_OBJECTID_OUTPUTMIX:
-            // FIXME update gains on all players attached to this outputmix
-            SL_LOGD("[ FIXME: gain update on an SL_OBJECTID_OUTPUTMIX to be implemented ]");
-            break;
-        case SL_OBJECTID_MIDIPLAYER:
-            // MIDI
-            SL_LOGD("[ FIXME: gain update on an SL_OBJECTID_MIDIPLAYER to be implemented ]");
-            break;
-        default:
-            break;
-        }
-    }
-
-    if (attributes & ATTR_POSITION) {
-        switch (objectID) {
-        case SL_OBJECTID_AUDIOPLAYER:
-#ifdef ANDROID
-            ap = (CAudioPlayer *) this;
-            attributes &= ~ATTR_POSITION;   // no need to process asynchronously also
-            android_audioPlayer_seek(ap, ap->mSeek.mPos);
-#else
-            //audioPlayerTransportUpdate(ap);
-#endif
-            break;
-        case SL_OBJECTID_MIDIPLAYER:
-            // MIDI
-            SL_LOGD("[ FIXME: position update on an SL_OBJECTID_MIDIPLAYER to be implemented ]");
-            break;
-        default:
-            break;
-        }
-    }
-
-    if (attributes & ATTR_TRANSPORT) {
-        if (SL_OBJECTID_AUDIOPLAYER == objectID) {
-#ifdef ANDROID
-            attributes &= ~ATTR_TRANSPORT;   // no need to process asynchronously also
-            ap = (CAudioPlayer *) this;
-            // FIXME should only call when state changes
-            android_audioPlayer_setPlayState(ap, false /*lockAP*/);
-            // FIXME ditto, but for either eventflags or marker position
-            android_audioPlayer_useEventMask(ap);
-#else
-            //audioPlayerTransportUpdate(ap);
-#endif
-        } else if (SL_OBJECTID_AUDIORECORDER == objectID) {
-#ifdef ANDROID
-            attributes &= ~ATTR_TRANSPORT;   // no need to process asynchronously also
-            CAudioRecorder* ar = (CAudioRecorder *) this;
-            android_audioRecorder_useEventMask(ar);
-#endif
-        }
-    }
-
-    // ( buffer queue count is non-empty and play state == PLAYING ) became true
-    if (attributes & ATTR_ENQUEUE) {
-        if (SL_OBJECTID_AUDIOPLAYER == objectID) {
-            attributes &= ~ATTR_ENQUEUE;
-            ap = (CAudioPlayer *) this;
-            if (SL_PLAYSTATE_PLAYING == ap->mPlay.mState) {
-#ifdef ANDROID
-                android_audioPlayer_bufferQueue_onRefilled(ap);
-#endif
-            }
+    // Process the attributes which the class handles synchronously, lowest bit first
+    if (attributes) {
+        const AttributeHandler *handlers = this->mClass->mAttributeHandlers;
+        if (NULL != handlers) {
+            unsigned pending = attributes;
+            do {
+                unsigned i = ctz(pending);
+                assert(ATTR_INDEX_MAX > i);
+                unsigned bit = 1 << i;
+                pending &= ~bit;
+                AttributeHandler handler = handlers[i];
+                if (NULL != handler) {
+                    attributes = (attributes & ~bit) | (*handler)(this);
+                }
+            } while (pending);
         }
     }
 
+    // Other domains of this object may report attributes concurrently
     if (attributes) {
-        unsigned oldAttributesMask = this->mAttributesMask;
-        this->mAttributesMask = oldAttributesMask | attributes;
+        unsigned oldAttributesMask = __atomic_fetch_or(&this->mAttributesMask, attributes,
+            __ATOMIC_RELAXED);
         if (oldAttributesMask)
             attributes = ATTR_NONE;
     }
+    if (!elided) {
 #ifdef USE_DEBUG
-    memset(&this->mOwner, 0, sizeof(pthread_t));
-    this->mFile = file;
-    this->mLine = line;
+#ifdef USE_LOCK_PROFILE
+        lock_profile_released(d);
 #endif
-    ok = pthread_mutex_unlock(&this->mMutex);
-    assert(0 == ok);
+        memset(&d->mOwner, 0, sizeof(pthread_t));
+        d->mFile = file;
+        d->mLine = line;
+#endif
+        domain_allow_shared(d);
+        mutex_unlock(d);
+    }
     // first update to this interface since previous sync
     if (attributes) {
         unsigned id = this->mInstanceID;
         if (0 != id) {
             --id;
             assert(MAX_INSTANCE > id);
-            IEngine *thisEngine = this->mEngine;
-            interface_lock_exclusive(thisEngine);
-            thisEngine->mChangedMask |= 1 << id;
-            interface_unlock_exclusive(thisEngine);
+            // release pairs with the acquire in sync, which then sees mAttributesMask
+            __atomic_fetch_or(&this->mEngine->mChangedMask, 1 << id, __ATOMIC_RELEASE);
         }
     }
 }
 
 
-/** \brief Wait on the condition variable associated with the object; see pthread_cond_wait */
+/** \brief Wait on the condition variable of a domain of an object; see pthread_cond_wait */
 
 #ifdef USE_DEBUG
-void object_cond_wait_(IObject *this, const char *file, int line)
+void domain_cond_wait_(IObject *this, unsigned domain, const char *file, int line)
 {
+    assert(LOCK_DOMAINS > domain);
+    // nothing could wake us up
+    assert(!domain_elided(this, domain));
+    LockDomain *d = &this->mDomains[domain];
     // note that this will unlock the mutex, so we have to clear the owner
-    assert(pthread_equal(pthread_self(), this->mOwner));
-    assert(NULL != this->mFile);
-    assert(0 != this->mLine);
-    memset(&this->mOwner, 0, sizeof(pthread_t));
-    this->mFile = file;
-    this->mLine = line;
+    assert(pthread_equal(pthread_self(), d->mOwner));
+    assert(NULL != d->mFile);
+    assert(0 != d->mLine);
+#ifdef USE_LOCK_PROFILE
+    lock_profile_released(d);
+#endif
+    memset(&d->mOwner, 0, sizeof(pthread_t));
+    d->mFile = file;
+    d->mLine = line;
     // alas we don't know the new owner's identity
-    int ok;
-    ok = pthread_cond_wait(&this->mCond, &this->mMutex);
-    assert(0 == ok);
+    domain_allow_shared(d);
+    mutex_cond_wait(d);
+    domain_exclude_shared(d);
     // restore my ownership
-    this->mOwner = pthread_self();
-    this->mFile = file;
-    this->mLine = line;
+    d->mOwner = pthread_self();
+    d->mFile = file;
+    d->mLine = line;
+#ifdef USE_LOCK_PROFILE
+    // the time asleep is not lock contention, so the re-acquisition counts as uncontended
+    lock_profile_acquired(d, file, line, lock_profile_now(), SL_BOOLEAN_FALSE);
+#endif
 }
 #else
-void object_cond_wait(IObject *this)
+void domain_cond_wait(IObject *this, unsigned domain)
 {
-    int ok;
-    ok = pthread_cond_wait(&this->mCond, &this->mMutex);
-    assert(0 == ok);
+    assert(LOCK_DOMAINS > domain);
+    // nothing could wake us up
+    assert(!domain_elided(this, domain));
+    LockDomain *d = &this->mDomains[domain];
+    // shared lockers may come in while the mutex is unlocked
+    domain_allow_shared(d);
+    mutex_cond_wait(d);
+    domain_exclude_shared(d);
 }
 #endif
 
 
-/** \brief Signal the condition variable associated with the object; see pthread_cond_signal */
+/** \brief Signal the condition variable of a domain of an object; see pthread_cond_signal */
 
-void object_cond_signal(IObject *this)
+void domain_cond_signal(IObject *this, unsigned domain)
 {
-    int ok;
-    ok = pthread_cond_signal(&this->mCond);
-    assert(0 == ok);
+    assert(LOCK_DOMAINS > domain);
+    mutex_cond_wake(&this->mDomains[domain], SL_BOOLEAN_FALSE);
 }
 
 
-/** \brief Broadcast the condition variable associated with the object;
+/** \brief Broadcast the condition variable of a domain of an object;
  *  see pthread_cond_broadcast
  */
 
-void object_cond_broadcast(IObject *this)
+void domain_cond_broadcast(IObject *this, unsigned domain)
 {
-    int ok;
-    ok = pthread_cond_broadcast(&this->mCond);
-    assert(0 == ok);
+    assert(LOCK_DOMAINS > domain);
+    mutex_cond_wake(&this->mDomains[domain], SL_BOOLEAN_TRUE);
+}
+
+
+/** \brief Lock a domain of an object for reading; see locks.h */
+
+void domain_lock_shared(IObject *this, unsigned domain)
+{
+    assert(LOCK_DOMAINS > domain);
+    if (domain_elided(this, domain)) {
+        return;
+    }
+    LockDomain *d = &this->mDomains[domain];
+    __atomic_add_fetch(&d->mSharedCount, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&d->mExclusive, __ATOMIC_SEQ_CST)) {
+        // An exclusive locker is in, or on its way in, so back off and wait for it on the mutex.
+        // While we hold the mutex no exclusive locker can be in, and any that comes after
+        // we unlock it waits for us to leave.
+        domain_unlock_shared(this, domain);
+        mutex_lock(d);
+        __atomic_add_fetch(&d->mSharedCount, 1, __ATOMIC_SEQ_CST);
+        mutex_unlock(d);
+    }
+}
+
+
+/** \brief Unlock a domain of an object locked for reading */
+
+void domain_unlock_shared(IObject *this, unsigned domain)
+{
+    assert(LOCK_DOMAINS > domain);
+    if (domain_elided(this, domain)) {
+        return;
+    }
+    LockDomain *d = &this->mDomains[domain];
+    if (0 == __atomic_sub_fetch(&d->mSharedCount, 1, __ATOMIC_SEQ_CST) &&
+            __atomic_load_n(&d->mExclusive, __ATOMIC_SEQ_CST)) {
+        // the last one out lets a waiting exclusive locker in
+        int ok;
+        ok = pthread_mutex_lock(&sharedDrainMutex);
+        assert(0 == ok);
+        ok = pthread_cond_broadcast(&sharedDrainCond);
+        assert(0 == ok);
+        ok = pthread_mutex_unlock(&sharedDrainMutex);
+        assert(0 == ok);
+    }
 }
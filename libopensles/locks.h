@@ -16,53 +16,125 @@
 
 /** \file locks.h Mutual exclusion and condition variables */
 
+// USE_LOCK_PROFILE records statistics per call site of the exclusive locks, which are only
+// known with USE_DEBUG
+#if defined(USE_LOCK_PROFILE) && !defined(USE_DEBUG)
+#error USE_LOCK_PROFILE requires USE_DEBUG
+#endif
+
 #ifdef USE_DEBUG
-extern void object_lock_exclusive_(IObject *this, const char *file, int line);
-extern void object_unlock_exclusive_(IObject *this, const char *file, int line);
-extern void object_unlock_exclusive_attributes_(IObject *this, unsigned attr,
+extern void domain_lock_exclusive_(IObject *this, unsigned domain, const char *file, int line);
+extern void domain_unlock_exclusive_(IObject *this, unsigned domain, const char *file, int line);
+extern void domain_unlock_exclusive_attributes_(IObject *this, unsigned domain, unsigned attr,
     const char *file, int line);
-extern void object_cond_wait_(IObject *this, const char *file, int line);
+extern void domain_cond_wait_(IObject *this, unsigned domain, const char *file, int line);
 #else
-extern void object_lock_exclusive(IObject *this);
-extern void object_unlock_exclusive(IObject *this);
-extern void object_unlock_exclusive_attributes(IObject *this, unsigned attr);
-extern void object_cond_wait(IObject *this);
+extern void domain_lock_exclusive(IObject *this, unsigned domain);
+extern void domain_unlock_exclusive(IObject *this, unsigned domain);
+extern void domain_unlock_exclusive_attributes(IObject *this, unsigned domain, unsigned attr);
+extern void domain_cond_wait(IObject *this, unsigned domain);
+#endif
+extern void domain_cond_signal(IObject *this, unsigned domain);
+extern void domain_cond_broadcast(IObject *this, unsigned domain);
+extern void domain_lock_shared(IObject *this, unsigned domain);
+extern void domain_unlock_shared(IObject *this, unsigned domain);
+extern void object_init_locks(IObject *this);
+extern void object_deinit_locks(IObject *this);
+#ifdef USE_LOCK_PROFILE
+extern void lock_profile_dump(SLboolean reset);
 #endif
-extern void object_cond_signal(IObject *this);
-extern void object_cond_broadcast(IObject *this);
 
 #ifdef USE_DEBUG
-#define object_lock_exclusive(this) object_lock_exclusive_((this), __FILE__, __LINE__)
-#define object_unlock_exclusive(this) object_unlock_exclusive_((this), __FILE__, __LINE__)
-#define object_unlock_exclusive_attributes(this, attr) \
-    object_unlock_exclusive_attributes_((this), (attr), __FILE__, __LINE__)
-#define object_cond_wait(this) object_cond_wait_((this), __FILE__, __LINE__)
+#define domain_lock_exclusive(this, domain) \
+    domain_lock_exclusive_((this), (domain), __FILE__, __LINE__)
+#define domain_unlock_exclusive(this, domain) \
+    domain_unlock_exclusive_((this), (domain), __FILE__, __LINE__)
+#define domain_unlock_exclusive_attributes(this, domain, attr) \
+    domain_unlock_exclusive_attributes_((this), (domain), (attr), __FILE__, __LINE__)
+#define domain_cond_wait(this, domain) domain_cond_wait_((this), (domain), __FILE__, __LINE__)
 #endif
 
-// Currently shared locks are implemented as exclusive, but don't count on it
+// Any number of threads may hold the shared lock at once, but not while a thread holds the
+// exclusive lock.  Only read fields while holding the shared lock, and keep it briefly:
+// an exclusive locker waits until all shared lockers are gone.
+// Locking shared while holding exclusive, or vice versa, on the same domain deadlocks.
+
+// Each object has several lock domains, see LOCK_DOMAIN_* in sles_allinclusive.h.
+// The object lock is the object domain; it guards the IObject fields, and the fields of any
+// interface that is not in one of the other domains.  A thread may hold several domains of an
+// object, taken in increasing order, and may take the engine lock after any of them.
+// A field shared by two domains must be written with both held, or only peeked at.
+// An object of a thread-unsafe engine does not lock the domains in LOCK_DOMAINS_APPLICATION;
+// the library's own threads must never touch those, except through atomic fields.
 
-#define object_lock_shared(this)   object_lock_exclusive(this)
-#define object_unlock_shared(this) object_unlock_exclusive(this)
+#define object_lock_exclusive(this)   domain_lock_exclusive((this), LOCK_DOMAIN_OBJECT)
+#define object_unlock_exclusive(this) domain_unlock_exclusive((this), LOCK_DOMAIN_OBJECT)
+#define object_unlock_exclusive_attributes(this, attr) \
+    domain_unlock_exclusive_attributes((this), LOCK_DOMAIN_OBJECT, (attr))
+#define object_lock_shared(this)      domain_lock_shared((this), LOCK_DOMAIN_OBJECT)
+#define object_unlock_shared(this)    domain_unlock_shared((this), LOCK_DOMAIN_OBJECT)
+#define object_cond_wait(this)        domain_cond_wait((this), LOCK_DOMAIN_OBJECT)
+#define object_cond_signal(this)      domain_cond_signal((this), LOCK_DOMAIN_OBJECT)
+#define object_cond_broadcast(this)   domain_cond_broadcast((this), LOCK_DOMAIN_OBJECT)
 
-// Currently interface locks are actually on whole object, but don't count on it.
+// The domain of an interface follows from its type.  Android code locks the whole object
+// around the same fields, and C++ lacks _Generic, so there everything is in the object domain.
 // These operations are undefined on IObject, as it lacks an mThis.
 // If you have an IObject, then use the object_ functions instead.
 
-#define interface_lock_exclusive(this)   object_lock_exclusive(InterfaceToIObject(this))
-#define interface_unlock_exclusive(this) object_unlock_exclusive(InterfaceToIObject(this))
+#if defined(ANDROID) || defined(__cplusplus)
+#define InterfaceToLockDomain(this) LOCK_DOMAIN_OBJECT
+#else
+#define InterfaceToLockDomain(this) _Generic((this), \
+    IPlay *:            LOCK_DOMAIN_TRANSPORT,   \
+    IRecord *:          LOCK_DOMAIN_TRANSPORT,   \
+    ISeek *:            LOCK_DOMAIN_TRANSPORT,   \
+    IPlaybackRate *:    LOCK_DOMAIN_TRANSPORT,   \
+    IPrefetchStatus *:  LOCK_DOMAIN_TRANSPORT,   \
+    IBufferQueue *:     LOCK_DOMAIN_BUFFERQUEUE, \
+    IVolume *:          LOCK_DOMAIN_GAIN,        \
+    IMuteSolo *:        LOCK_DOMAIN_GAIN,        \
+    IEffectSend *:      LOCK_DOMAIN_GAIN,        \
+    I3DDoppler *:       LOCK_DOMAIN_3D,          \
+    I3DGrouping *:      LOCK_DOMAIN_3D,          \
+    I3DLocation *:      LOCK_DOMAIN_3D,          \
+    I3DMacroscopic *:   LOCK_DOMAIN_3D,          \
+    I3DSource *:        LOCK_DOMAIN_3D,          \
+    default:            LOCK_DOMAIN_OBJECT)
+#endif
+
+#define interface_lock_exclusive(this) \
+    domain_lock_exclusive(InterfaceToIObject(this), InterfaceToLockDomain(this))
+#define interface_unlock_exclusive(this) \
+    domain_unlock_exclusive(InterfaceToIObject(this), InterfaceToLockDomain(this))
 #define interface_unlock_exclusive_attributes(this, attr) \
-    object_unlock_exclusive_attributes(InterfaceToIObject(this), (attr))
-#define interface_lock_shared(this)      object_lock_shared(InterfaceToIObject(this))
-#define interface_unlock_shared(this)    object_unlock_shared(InterfaceToIObject(this))
-#define interface_cond_wait(this)        object_cond_wait(InterfaceToIObject(this))
-#define interface_cond_signal(this)      object_cond_signal(InterfaceToIObject(this))
-#define interface_cond_broadcast(this)   object_cond_broadcast(InterfaceToIObject(this))
+    domain_unlock_exclusive_attributes(InterfaceToIObject(this), InterfaceToLockDomain(this), \
+        (attr))
+#define interface_lock_shared(this) \
+    domain_lock_shared(InterfaceToIObject(this), InterfaceToLockDomain(this))
+#define interface_unlock_shared(this) \
+    domain_unlock_shared(InterfaceToIObject(this), InterfaceToLockDomain(this))
+#define interface_cond_wait(this) \
+    domain_cond_wait(InterfaceToIObject(this), InterfaceToLockDomain(this))
+#define interface_cond_signal(this) \
+    domain_cond_signal(InterfaceToIObject(this), InterfaceToLockDomain(this))
+#define interface_cond_broadcast(this) \
+    domain_cond_broadcast(InterfaceToIObject(this), InterfaceToLockDomain(this))
+
+// Peek and poke are an optimization for small atomic fields that don't "matter".
+// field_peek and field_poke access one aligned field, no larger than a pointer, without a lock:
+// a peek is an atomic load with acquire semantics, and a poke is an atomic store with release
+// semantics, so a thread that peeks a poked value also sees what the poker wrote before it.
+// A field that is peeked at without a lock must be written with field_poke.
+// The bracketing forms below order the plain accesses between them in the same way, for fields
+// that are not written concurrently or that may be read stale.
 
-// Peek and poke are an optimization for small atomic fields that don't "matter"
+#define field_peek(field)           __atomic_load_n(&(field), __ATOMIC_ACQUIRE)
+#define field_poke(field, value)    __atomic_store_n(&(field), (value), __ATOMIC_RELEASE)
 
 #define object_lock_peek(this)      /* object_lock_shared(this) */
-#define object_unlock_peek(this)    /* object_unlock_shared(this) */
-#define interface_lock_poke(this)   /* interface_lock_exclusive(this) */
+#define object_unlock_peek(this)    __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define interface_lock_poke(this)   __atomic_thread_fence(__ATOMIC_RELEASE)
 #define interface_unlock_poke(this) /* interface_unlock_exclusive(this) */
 #define interface_lock_peek(this)   /* interface_lock_shared(this) */
-#define interface_unlock_peek(this) /* interface_unlock_shared(this) */
+#define interface_unlock_peek(this) __atomic_thread_fence(__ATOMIC_ACQUIRE)
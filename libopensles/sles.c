@@ -98,7 +98,7 @@ SLresult AcquireStrongRef(IObject *object, SLuint32 expectedObjectID)
 void ReleaseStrongRefAndUnlockExclusive(IObject *object)
 {
 #ifdef USE_DEBUG
-    assert(pthread_equal(pthread_self(), object->mOwner));
+    assert(pthread_equal(pthread_self(), object->mDomains[LOCK_DOMAIN_OBJECT].mOwner));
 #endif
     assert(0 < object->mStrongRefCount);
     if ((0 == --object->mStrongRefCount) && (SL_OBJECT_STATE_DESTROYING == object->mState)) {
@@ -829,6 +829,87 @@ void freeDataLocatorFormat(DataLocatorFormat *dlf)
 }
 
 
+/** \brief Duplicate a string for a local deep copy */
+
+static SLchar *copyString(const SLchar *string)
+{
+    size_t len = strlen((const char *) string);
+    SLchar *myString = (SLchar *) malloc(len + 1);
+    if (NULL != myString) {
+        memcpy(myString, string, len + 1);
+    }
+    return myString;
+}
+
+
+/** \brief Take another strong reference to an object that already has at least one */
+
+static void addStrongRef(IObject *object)
+{
+    object_lock_exclusive(object);
+    assert(0 < object->mStrongRefCount);
+    ++object->mStrongRefCount;
+    object_unlock_exclusive(object);
+}
+
+
+/** \brief Make a local deep copy of a data locator format that was already checked by
+ *  checkDataSource or checkDataSink, without checking it again
+ */
+
+SLresult copyDataLocatorFormat(DataLocatorFormat *dst, const DataLocatorFormat *src)
+{
+    SLchar *myURI = NULL;
+    SLchar *myMimeType = NULL;
+    // duplicate the strings before taking any references, so that a failure has nothing to undo
+    if ((SL_DATALOCATOR_URI == src->mLocator.mLocatorType) && (NULL != src->mLocator.mURI.URI)) {
+        myURI = copyString(src->mLocator.mURI.URI);
+        if (NULL == myURI) {
+            goto fail;
+        }
+    }
+    if ((SL_DATAFORMAT_MIME == src->mFormat.mFormatType) &&
+            (NULL != src->mFormat.mMIME.mimeType)) {
+        myMimeType = copyString(src->mFormat.mMIME.mimeType);
+        if (NULL == myMimeType) {
+            goto fail;
+        }
+    }
+    *dst = *src;
+    switch (dst->mLocator.mLocatorType) {
+    case SL_DATALOCATOR_URI:
+        dst->mLocator.mURI.URI = myURI;
+        break;
+    case SL_DATALOCATOR_IODEVICE:
+        if (NULL != dst->mLocator.mIODevice.device) {
+            addStrongRef((IObject *) dst->mLocator.mIODevice.device);
+        }
+        break;
+    case SL_DATALOCATOR_OUTPUTMIX:
+        if (NULL != dst->mLocator.mOutputMix.outputMix) {
+            addStrongRef((IObject *) dst->mLocator.mOutputMix.outputMix);
+        }
+        break;
+    default:
+        break;
+    }
+    if (SL_DATAFORMAT_MIME == dst->mFormat.mFormatType) {
+        dst->mFormat.mMIME.mimeType = myMimeType;
+    }
+    dst->u.mNeutral.pLocator = &dst->mLocator;
+    dst->u.mNeutral.pFormat = &dst->mFormat;
+    return SL_RESULT_SUCCESS;
+
+fail:
+    if (NULL != myURI) {
+        free(myURI);
+    }
+    // leave nothing for freeDataLocatorFormat to release
+    memset(dst, 0, sizeof(DataLocatorFormat));
+    return SL_RESULT_MEMORY_FAILURE;
+}
+
+
 /* Interface initialization hooks */
 
 extern void
@@ -883,6 +964,7 @@ extern void
     IVolume_init(void *);
 
 extern void
+    IEngine_deinit(void *),
     IObject_deinit(void *);
 
 #if !(USE_PROFILES & USE_PROFILES_MUSIC)
@@ -910,7 +992,9 @@ extern void
 #endif
 
 #if !(USE_PROFILES & USE_PROFILES_BASE)
+#ifndef USE_SNDFILE
 #define IAudioDecoderCapabilities_init   NULL
+#endif
 #define IAudioEncoderCapabilities_init   NULL
 #define IAudioEncoder_init               NULL
 #define IAudioIODeviceCapabilities_init  NULL
@@ -955,7 +1039,7 @@ extern void
     { /* MPH_DYNAMICINTERFACEMANAGEMENT, */ IDynamicInterfaceManagement_init, NULL, NULL },
     { /* MPH_DYNAMICSOURCE, */ IDynamicSource_init, NULL, NULL },
     { /* MPH_EFFECTSEND, */ IEffectSend_init, NULL, NULL },
-    { /* MPH_ENGINE, */ IEngine_init, NULL, NULL },
+    { /* MPH_ENGINE, */ IEngine_init, NULL, IEngine_deinit },
     { /* MPH_ENGINECAPABILITIES, */ IEngineCapabilities_init, NULL, NULL },
     { /* MPH_ENVIRONMENTALREVERB, */ IEnvironmentalReverb_init, NULL, NULL },
     { /* MPH_EQUALIZER, */ IEqualizer_init, NULL, NULL },
@@ -1021,6 +1105,9 @@ IObject *construct(const ClassTable *class__, unsigned exposedMask, SLEngineItf
             if (thisEngine->mLossOfControlGlobal) {
                 lossOfControlMask = ~0;
             }
+            if (!((CEngine *) thisEngine->mThis)->mEngineCapabilities.mThreadSafe) {
+                this->mElidedDomains = LOCK_DOMAINS_APPLICATION;
+            }
         }
         this->mLossOfControlMask = lossOfControlMask;
         this->mClass = class__;
@@ -1057,6 +1144,49 @@ IObject *construct(const ClassTable *class__, unsigned exposedMask, SLEngineItf
 }
 
 
+/** \brief Construct a new instance as a copy of an unpublished and unrealized prototype that was
+ *  made by construct.  The copy has its own object slot, mutex, and condition variable, and its
+ *  exposed interfaces refer to the copy.  Class-specific fields that point within the object or
+ *  own resources are fixed up by the caller.
+ */
+
+IObject *construct_clone(const IObject *prototype)
+{
+    assert(NULL != prototype);
+    assert(0 == prototype->mInstanceID);
+    assert(SL_OBJECT_STATE_UNREALIZED == prototype->mState);
+    const ClassTable *class__ = prototype->mClass;
+    IObject *this = (IObject *) malloc(class__->mSize);
+    if (NULL != this) {
+        IEngine *thisEngine = prototype->mEngine;
+        interface_lock_exclusive(thisEngine);
+        if (MAX_INSTANCE <= thisEngine->mInstanceCount) {
+            SL_LOGE("Too many objects");
+            interface_unlock_exclusive(thisEngine);
+            free(this);
+            return NULL;
+        }
+        // pre-allocate a pending slot, but don't assign bit from mInstanceMask yet
+        ++thisEngine->mInstanceCount;
+        assert(((unsigned) ~0) != thisEngine->mInstanceMask);
+        interface_unlock_exclusive(thisEngine);
+        memcpy(this, prototype, class__->mSize);
+        const struct iid_vtable *x = class__->mInterfaces;
+        const SLuint8 *interfaceStateP = this->mInterfaceStates;
+        SLuint32 index;
+        for (index = 0; index < class__->mInterfaceCount; ++index, ++x, ++interfaceStateP) {
+            // IObject does not have an mThis
+            if (index && (INTERFACE_EXPOSED == *interfaceStateP)) {
+                ((IObject **) ((char *) this + x->mOffset))[1] = this;
+            }
+        }
+        object_init_locks(this);
+        // note that the new object is not yet published; creator must call IObject_Publish
+    }
+    return this;
+}
+
+
 /* Initial global entry points */
 
 
@@ -1092,6 +1222,12 @@ SLresult SLAPIENTRY slCreateEngine(SLObjectItf *pEngine, SLuint32 numOptions,
         // default values
         SLboolean threadSafe = SL_BOOLEAN_TRUE;
         SLboolean lossOfControlGlobal = SL_BOOLEAN_FALSE;
+#ifdef USE_SNDFILE
+        SLuint32 streamFrames = SndFile_FRAMES;
+        SLuint32 streamMinBuffers = SndFile_MINBUFS;
+        SLuint32 streamMaxBuffers = SndFile_MAXBUFS;
+        SLuint32 assetCacheBytes = SndFileCache_BUDGET;
+#endif
 
         // process engine options
         SLuint32 i;
@@ -1105,6 +1241,20 @@ SLresult SLAPIENTRY slCreateEngine(SLObjectItf *pEngine, SLuint32 numOptions,
             case SL_ENGINEOPTION_LOSSOFCONTROL:
                 lossOfControlGlobal = SL_BOOLEAN_FALSE != (SLboolean) option->data; // normalize
                 break;
+#ifdef USE_SNDFILE
+            case SL_VITA_ENGINEOPTION_STREAMFRAMES:
+                streamFrames = option->data;
+                break;
+            case SL_VITA_ENGINEOPTION_STREAMMINBUFFERS:
+                streamMinBuffers = option->data;
+                break;
+            case SL_VITA_ENGINEOPTION_STREAMMAXBUFFERS:
+                streamMaxBuffers = option->data;
+                break;
+            case SL_VITA_ENGINEOPTION_ASSETCACHEBYTES:
+                assetCacheBytes = option->data;
+                break;
+#endif
             default:
                 SL_LOGE("unknown engine option: feature=%lu data=%lu",
                     option->feature, option->data);
@@ -1115,6 +1265,14 @@ SLresult SLAPIENTRY slCreateEngine(SLObjectItf *pEngine, SLuint32 numOptions,
         if (SL_RESULT_SUCCESS != result) {
             break;
         }
+#ifdef USE_SNDFILE
+        if (!SndFile_checkBuffering(streamFrames, streamMinBuffers, streamMaxBuffers)) {
+            SL_LOGE("invalid stream buffering: frames=%lu buffers=%lu..%lu", streamFrames,
+                streamMinBuffers, streamMaxBuffers);
+            result = SL_RESULT_PARAMETER_INVALID;
+            break;
+        }
+#endif
 
         unsigned exposedMask;
         const ClassTable *pCEngine_class = objectIDtoClass(SL_OBJECTID_ENGINE);
@@ -1134,6 +1292,12 @@ SLresult SLAPIENTRY slCreateEngine(SLObjectItf *pEngine, SLuint32 numOptions,
         this->mObject.mLossOfControlMask = lossOfControlGlobal ? ~0 : 0;
         this->mEngine.mLossOfControlGlobal = lossOfControlGlobal;
         this->mEngineCapabilities.mThreadSafe = threadSafe;
+#ifdef USE_SNDFILE
+        this->mEngine.mStreamFrames = streamFrames;
+        this->mEngine.mStreamMinBuffers = streamMinBuffers;
+        this->mEngine.mStreamMaxBuffers = streamMaxBuffers;
+        this->mEngine.mSndFileCache.mBudget = assetCacheBytes;
+#endif
         *pEngine = &this->mObject.mItf;
 
     } while(0);
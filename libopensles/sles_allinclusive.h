@@ -18,13 +18,16 @@
 
 #include "SLES/OpenSLES.h"
 #include "SLES/OpenSLES_Android.h"
+#include "SLES/OpenSLES_Vita.h"
 #include <stddef.h> // offsetof
+#include <stdint.h> // uint32_t
 #include <stdlib.h> // malloc
 #include <string.h> // memcmp
 #include <stdio.h>  // debugging
 #include <assert.h> // debugging
 #include <pthread.h>
 #include <unistd.h> // usleep
+#include <sys/time.h> // gettimeofday
 #include <errno.h>
 
 #ifndef __cplusplus
@@ -111,6 +114,8 @@ typedef void (*VoidHook)(void *self);
 typedef SLresult (*StatusHook)(void *self);
 typedef SLresult (*AsyncHook)(void *self, SLboolean async);
 typedef bool (*BoolHook)(void *self);
+// Processes one attribute synchronously, returns the attributes still to be processed by sync
+typedef unsigned (*AttributeHandler)(void *self);
 
 // Describes how an interface is related to a given class, used in iid_vtable::mInterface
 
@@ -205,6 +210,8 @@ typedef struct {
     AsyncHook mResume;
     VoidHook mDestroy;
     BoolHook mPreDestroy;
+    // indexed by ATTR_INDEX_*, NULL if no attribute of this class is processed synchronously
+    const AttributeHandler *mAttributeHandlers;
 } ClassTable;
 
 // BufferHeader describes each element of a BufferQueue, other than the data
@@ -220,20 +227,146 @@ typedef struct {
 
 #ifdef USE_SNDFILE
 
-#define SndFile_BUFSIZE 512     // in 16-bit samples
+#define SndFile_BUFSIZE 512     // in 16-bit samples, of the output device
 #define SndFile_NUMBUFS 2
 
+// Decode-ahead buffering of a file stream; the defaults may be changed by engine options, and
+// per player by slVitaSetStreamBuffering
+#define SndFile_FRAMES     1024 // default stereo sample frames per decoded buffer
+#define SndFile_MINBUFS    2    // default minimum and initial number of buffers queued ahead
+#define SndFile_MAXBUFS    16   // default maximum that the adaptive depth grows to
+#define SndFile_MINFRAMES  64   // limits on the frames per decoded buffer
+#define SndFile_MAXFRAMES  16384
+#define SndFile_LIMITBUFS  64   // limit on the maximum number of buffers, below the queue limit
+#define SndFile_SHRINKAFTER 256 // buffers decoded in time before the depth shrinks by one
+
+// A PCM WAV file already in the output format plays straight from memory
+#define SndFile_READAHEAD  (256 * 1024)  // bytes of a mapped file advised ahead of playback
+#define SndFile_MAXLOAD    (1024 * 1024) // largest file read into memory when not mapped
+
+// Files of other formats are converted as they are decoded
+#define SndFile_MAXCHANNELS 8   // limits on the files that can be played
+#define SndFile_MINRATE    4000
+#define SndFile_MAXRATE    192000
+#define SndFile_TAPS       4    // input frames of the cubic resampler for each output frame
+
+// Values of SndFile::mDecodeState
+#define SndFile_IDLE      0     // no decode closure is pending or running
+#define SndFile_SCHEDULED 1     // a decode closure is pending or running on a streaming worker
+#define SndFile_SHUTDOWN  2     // the player is being destroyed, so no more decoding
+
 struct SndFile {
     // save URI also?
     SLchar *mPathname;
     SNDFILE *mSNDFILE;
     SF_INFO mSfInfo;
-    pthread_mutex_t mMutex; // protects mSNDFILE only
-    SLboolean mEOF;         // sf_read returned zero sample frames
-    SLuint32 mWhich;        // which buffer to use next
-    short mBuffer[SndFile_BUFSIZE * SndFile_NUMBUFS];
+    time_t mModified;       // of the file when it was opened, to keep its handle in the
+    off_t mFileSize;        // engine's cache for the next player of it, or -1 if it cannot be
+    pthread_mutex_t mMutex; // protects mSNDFILE and the decode state below
+    pthread_cond_t mCond;   // signalled with mMutex when a decode closure finishes
+    SLboolean mEOF;         // sf_read returned zero sample frames; poked, as the mixer peeks
+    unsigned mDecodeState;  // SndFile_IDLE etc., atomic
+    SLboolean mRetry;       // a decode could not be queued, so the sync thread schedules it;
+                            // atomic
+    SLuint32 mSeekEpoch;    // seeks requested, incremented atomically by SndFile_seek
+    SLuint32 mEpoch;        // mSeekEpoch when the decoder last applied a seek, poked with
+                            // mMutex held, so a difference means a seek is pending
+    SLuint32 mLoopEpoch;    // loop changes, incremented atomically by SndFile_loop
+    SLuint32 mLoopApplied;  // mLoopEpoch when the decoder last read the loop, with mMutex held
+    // the loop of the seek interface in frames of the file, protected by mMutex
+    SLboolean mLoop;        // enabled, and the loop is not empty
+    SLuint32 mLoopStart;
+    SLuint32 mLoopEnd;      // the frame after the loop, at most the end of the file
+    sf_count_t mFrame;      // the next frame to read through libsndfile, protected by mMutex
+    SLuint32 mWhich;        // which buffer to decode into next
+    // configuration, const after Realize
+    SLuint32 mFrames;       // stereo sample frames per buffer
+    SLuint32 mMinBuffers;   // range of the decode-ahead depth; equal for a fixed depth
+    SLuint32 mMaxBuffers;
+    // adaptive depth, protected by mMutex
+    SLuint32 mDepth;        // buffers in the ring, of which the buffer queue holds the decoded
+                            // ones in order; the transport domain peeks at it for the fill level
+    SLuint32 mTargetDepth;  // depth to change to once no queued buffer wraps around the ring
+    SLuint32 mInTime;       // buffers decoded since the depth last changed or a refill was late
+    SLboolean mPrimed;      // the queue has been full since the last seek, so a low queue
+                            // means the decoder was late
+    SLboolean mPrefetch;    // the prefetch status interface is exposed, const after Realize
+    // conversion of a file that is not 16-bit stereo at the output rate, see SndFile_convert
+    SLboolean mConvert;
+    uint64_t mStep;         // file frames per output frame, 32.32 fixed point, const
+    float mDownmix[SndFile_MAXCHANNELS][STEREO_CHANNELS]; // gains of each channel, const
+    float *mScratch;        // mFrames file frames read as float
+    float *mIn;             // stereo frames being resampled, mFrames + SndFile_TAPS of them
+    SLuint32 mInCount;      // frames in mIn, of which the first is before the next output
+    uint64_t mPos;          // of the next output frame, from mIn[1], 32.32 fixed point
+    SLboolean mInEOF;       // the end of the file is in mIn, with silence after it
+    // mMaxBuffers pointers to buffers of mFrames frames in the output format of 16-bit stereo
+    // at the output rate; a buffer is allocated when the ring first reaches it
+    short **mBuffers;
+    // a file played from memory instead, see SndFile_map; mSNDFILE and mBuffers are then NULL
+    void *mMapping;         // the file, mapped or read
+    size_t mMappingSize;
+    const char *mData;      // its data chunk, or NULL when decoding through libsndfile
+    SLuint32 mDataSize;     // bytes of whole frames in the data chunk
+    SLuint32 mDataPos;      // offset of the next block to enqueue, protected by mMutex
+    SLuint32 mAdvised;      // offset up to which readahead was advised, protected by mMutex
+    // the engine's decoded copy of the file that mData points into, instead of mMapping
+    struct SndFileAsset *mAsset;
+};
+
+// A file decoded as a whole is shared by the players of an engine, see SndFileCache.c
+#define SndFileCache_BUDGET (4 * 1024 * 1024) // default bytes of decoded assets kept by an engine
+#define SndFileCache_HANDLES 4  // streamed files kept open by an engine after their players
+#define SndFileCache_FAILURES 16    // files that failed to load remembered by an engine
+
+// Values of SndFileAsset::mState
+#define SndFileAsset_LOADING 0  // being loaded by the first thread that asked for it
+#define SndFileAsset_READY   1
+#define SndFileAsset_FAILED  2  // could not be loaded, or is too large to keep, see mResult
+
+/** \brief The whole of a file as 16-bit stereo at the output rate, which players of the file
+ *  play from memory through their own SndFile::mDataPos.  Immutable once ready.
+ */
+
+struct SndFileAsset {
+    struct SndFileAsset *mNext; // in the cache, from most to least recently used
+    struct SndFileAsset *mPrev;
+    char *mPath;                // with the modification time and size of the file, the key
+    time_t mModified;
+    off_t mFileSize;
+    // protected by the cache mutex
+    SLuint32 mState;            // SndFileAsset_LOADING etc.
+    SLresult mResult;           // why a failed asset failed
+    SLuint32 mRefCount;         // players playing it, and threads loading or waiting for it
+    SLboolean mCached;          // whether it is in the cache; a stale asset is freed by the last
+                                // release instead
+    // the data, mapped or read from a file in the output format, or else decoded
+    void *mStorage;
+    size_t mStorageSize;
+    SLboolean mMapped;          // mStorage is a file mapping, otherwise it is from malloc
+    const char *mData;
+    SLuint32 mDataSize;         // bytes of whole frames, counted against the budget
 };
 
+struct SndFilePreload;
+
+/** \brief The decoded assets of an engine, evicted least recently used first when their total
+ *  size is over budget and no player uses them
+ */
+
+typedef struct SndFileCache {
+    pthread_mutex_t mMutex;
+    pthread_cond_t mCond;       // broadcast with mMutex when an asset finishes loading
+    struct SndFileAsset *mHead; // most recently used
+    struct SndFileAsset *mTail; // least recently used
+    size_t mBytes;              // of the ready assets in the cache
+    SLuint32 mFailures;         // failed assets in the cache
+    size_t mBudget;             // const after the engine is created; 0 disables the cache
+    struct SndFilePreload *mPreloads;   // queued or running, freed with the cache if never run
+    struct SndFileHandle *mHandles;     // open files no player uses, most recently used first
+    SLuint32 mHandleCount;
+} SndFileCache;
+
 #endif // USE_SNDFILE
 
 /* Our own merged version of SLDataSource and SLDataSink */
@@ -268,6 +401,33 @@ typedef struct {
     DataFormat mFormat;
 } DataLocatorFormat;
 
+/** \brief A lock domain is a mutex and condition variable that guard part of an object */
+
+typedef struct {
+#if defined(USE_ADAPTIVE_LOCK) && defined(__linux__)
+#define USE_FUTEX_LOCK
+    unsigned mMutex;                ///< 0 unlocked, 1 locked, 2 locked and maybe waiters
+#else
+    pthread_mutex_t mMutex;
+#endif
+    unsigned mSharedCount;          ///< number of threads holding the shared lock, see locks.c
+    SLboolean mExclusive;           ///< whether a thread holds or is taking the exclusive lock
+#ifdef USE_DEBUG
+    pthread_t mOwner;
+    const char *mFile;
+    int mLine;
+#endif
+#ifdef USE_LOCK_PROFILE
+    struct LockSite *mSite;         ///< call site of the current exclusive lock, or NULL
+    uint64_t mLockTime;             ///< when the current exclusive lock was acquired, in ns
+#endif
+#ifdef USE_FUTEX_LOCK
+    unsigned mCond;                 ///< sequence number, advanced by each signal and broadcast
+#else
+    pthread_cond_t mCond;
+#endif
+} LockDomain;
+
 /* Interface structures */
 
 typedef struct Object_interface {
@@ -280,17 +440,21 @@ typedef struct Object_interface {
     void *mContext;
     unsigned mGottenMask;           ///< bit-mask of interfaces exposed or added, then gotten
     unsigned mLossOfControlMask;    // interfaces with loss of control enabled
-    unsigned mAttributesMask;       // attributes which have changed since last sync
+    unsigned mAttributesMask;       // attributes which have changed since last sync, atomic
+    unsigned mElidedDomains;        // lock domains that are never locked, const
 #if USE_PROFILES & USE_PROFILES_BASE
     SLint32 mPriority;
 #endif
-    pthread_mutex_t mMutex;
-#ifdef USE_DEBUG
-    pthread_t mOwner;
-    const char *mFile;
-    int mLine;
-#endif
-    pthread_cond_t mCond;
+#define LOCK_DOMAIN_OBJECT      0   // the object itself, and interfaces not listed below
+#define LOCK_DOMAIN_TRANSPORT   1   // play, record, seek, playback rate, prefetch status
+#define LOCK_DOMAIN_BUFFERQUEUE 2   // buffer queue
+#define LOCK_DOMAIN_GAIN        3   // volume, mute solo, effect send
+#define LOCK_DOMAIN_3D          4   // 3D doppler, grouping, location, macroscopic, source
+#define LOCK_DOMAINS            5
+// Domains that only application threads lock: with SL_ENGINEOPTION_THREADSAFE false there is
+// one application thread, so the objects of that engine do not lock these domains at all
+#define LOCK_DOMAINS_APPLICATION ((1 << LOCK_DOMAIN_GAIN) | (1 << LOCK_DOMAIN_3D))
+    LockDomain mDomains[LOCK_DOMAINS];  ///< lock order is by increasing index, then engine
     SLuint8 mState;                 // really SLuint32, but SLuint8 to save space
 #if USE_PROFILES & USE_PROFILES_BASE
     SLuint8 mPreemptable;           // really SLboolean, but SLuint8 to save space
@@ -477,6 +641,10 @@ typedef struct BufferQueue_interface {
     // originally SLuint32, but range-checked down to SLuint16
     SLuint16 mNumBuffers;
     /*SLboolean*/ SLuint16 mClearRequested;
+    // a request for the mixer to drop the front buffer if it is still the one at this play index,
+    // without the requester waiting; see SndFile_applySeek
+    SLboolean mDiscardRequested;
+    SLuint32 mDiscardIndex;
     BufferHeader *mArray;
     BufferHeader *mFront, *mRear;
 #ifdef ANDROID
@@ -540,12 +708,20 @@ typedef struct Engine_interface {
     // Each engine is its own universe.
     SLuint32 mInstanceCount;
     unsigned mInstanceMask; // 1 bit per active object
-    unsigned mChangedMask;  // objects which have changed since last sync
+    unsigned mChangedMask;  // objects which have changed since last sync, atomic
 #define MAX_INSTANCE 32     // maximum active objects per engine, see mInstanceMask
     IObject *mInstances[MAX_INSTANCE];
     SLboolean mShutdown;
     SLboolean mShutdownAck;
+    IObject *mSyncInstance; // object the sync thread is updating, which Destroy waits for
     ThreadPool mThreadPool; // for asynchronous operations
+#ifdef USE_SNDFILE
+    // defaults for decode-ahead buffering of file streams, set by engine options
+    SLuint32 mStreamFrames;
+    SLuint32 mStreamMinBuffers;
+    SLuint32 mStreamMaxBuffers;
+    SndFileCache mSndFileCache;
+#endif
 #if defined(ANDROID) && !defined(USE_BACKPORT)
     // FIXME number of presets will only be saved in IEqualizer, preset names will not be stored
     SLuint32 mEqNumPresets;
@@ -693,6 +869,13 @@ typedef struct {
     IObject *mThis;
     unsigned mActiveMask;   // 1 bit per active track
     Track mTracks[MAX_TRACK];
+    // Hot per-track mixer state, one entry per track, indexed by track number
+    const void *mReaders[MAX_TRACK];    ///< Pointer to next frame in BufferHeader.mBuffer
+    SLuint32 mAvails[MAX_TRACK];        ///< Number of available bytes in the current buffer
+    float mGains[MAX_TRACK][STEREO_CHANNELS];   ///< Pushed by audioPlayerGainUpdate
+    SLuint32 mStates[MAX_TRACK];        ///< Play state of the audio player, mirrored on change
+    SLuint32 mFramesMixed[MAX_TRACK];   ///< Sample frames mixed from track; reset periodically
+    unsigned mRequestMask;  ///< 1 bit per track with a request pending for the mixer
     SLboolean mDestroyRequested;    ///< Mixer to acknowledge application's call to Object::Destroy
 } IOutputMixExt;
 #endif
@@ -748,6 +931,7 @@ typedef struct {
     void *mContext;
     SLuint32 mCallbackEventsMask;
     SLpermille mFillUpdatePeriod;
+    SLpermille mReportedLevel;  // fill level at the last fill level change event
 } IPrefetchStatus;
 
 typedef struct {
@@ -965,8 +1149,9 @@ enum AndroidObject_state {
     // implementation-specific data for this instance
 #ifdef USE_OUTPUTMIXEXT
     Track *mTrack;
-    float mGains[STEREO_CHANNELS];  ///< Computed gain based on volume, mute, solo, stereo position
     SLboolean mDestroyRequested;    ///< Mixer to acknowledge application's call to Object::Destroy
+    SLboolean mAutoRelease;         ///< Engine destroys the player after it plays out its data
+    SLboolean mReleasePending;      ///< Mixer stopped an auto-release player, sync thread reclaims
 #endif
 #ifdef USE_SNDFILE
     struct SndFile mSndFile;
@@ -1185,11 +1370,16 @@ extern SLresult checkInterfaces(const ClassTable *class__,
     const SLboolean *pInterfaceRequired, unsigned *pExposedMask);
 extern IObject *construct(const ClassTable *class__,
     unsigned exposedMask, SLEngineItf engine);
+extern IObject *construct_clone(const IObject *prototype);
 extern const ClassTable *objectIDtoClass(SLuint32 objectID);
 extern const struct SLInterfaceID_ SL_IID_array[MPH_MAX];
 extern SLuint32 IObjectToObjectID(IObject *object);
 extern void IObject_Publish(IObject *this);
 extern void IObject_Destroy(SLObjectItf self);
+extern SLresult IObject_RealizeQueued(IObject *this);
+#ifdef USE_OUTPUTMIXEXT
+extern void IEngine_ReleaseFinishedPlayers(IEngine *this);
+#endif
 
 // Map an interface to it's "object ID" (which is really a class ID).
 // Note: this operation is undefined on IObject, as it lacks an mThis.
@@ -1220,6 +1410,10 @@ extern SLresult checkSourceFormatVsInterfacesCompatibility(
         SLuint32 numInterfaces, const SLInterfaceID *pInterfaceIds,
         const SLboolean *pInterfaceRequired);
 extern void freeDataLocatorFormat(DataLocatorFormat *dlf);
+extern SLresult copyDataLocatorFormat(DataLocatorFormat *dst, const DataLocatorFormat *src);
+extern SLresult audioPlayerConfigure(CAudioPlayer *this, SLDataSource *pAudioSrc,
+    SLDataSink *pAudioSnk, SLuint32 numInterfaces, const SLInterfaceID *pInterfaceIds,
+    const SLboolean *pInterfaceRequired);
 
 extern bool C3DGroup_PreDestroy(void *self);
 
@@ -1275,6 +1469,14 @@ extern const char * const interface_names[MPH_MAX];
 #define ATTR_POSITION   ((unsigned) 0x1 << 2) // requested position (a.k.a. seek position)
 #define ATTR_ENQUEUE    ((unsigned) 0x1 << 3) // buffer queue became non-empty and in playing state
 
+// Bit numbers of the attributes, used to index ClassTable::mAttributeHandlers
+
+#define ATTR_INDEX_GAIN      0
+#define ATTR_INDEX_TRANSPORT 1
+#define ATTR_INDEX_POSITION  2
+#define ATTR_INDEX_ENQUEUE   3
+#define ATTR_INDEX_MAX       4
+
 #define SL_DATALOCATOR_NULL 0    // application specified a NULL value for pLocator
 #define SL_DATAFORMAT_NULL 0     // application specified a NULL or undefined value for pFormat
 
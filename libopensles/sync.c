@@ -50,10 +50,19 @@ void *sync_start(void *arg)
             // here is where we would process the enqueued 3D commands
         }
         unsigned instanceMask = this->mEngine.mInstanceMask;
-        unsigned changedMask = this->mEngine.mChangedMask;
-        this->mEngine.mChangedMask = 0;
+        // unlocking an object domain with attributes updates this without the engine lock
+        unsigned changedMask = __atomic_exchange_n(&this->mEngine.mChangedMask, 0,
+            __ATOMIC_ACQUIRE);
         object_unlock_exclusive(&this->mObject);
 
+#ifdef USE_OUTPUTMIXEXT
+        // reclaim auto-release players that have played out all of their data
+        IEngine_ReleaseFinishedPlayers(&this->mEngine);
+#endif
+
+        // start the worker threads that the mixer thread could not start on its own
+        ThreadPool_growPending(&this->mEngine.mThreadPool);
+
         // now we know which objects exist, and which of those have changes
 
         unsigned combinedMask = changedMask | instanceMask;
@@ -61,32 +70,43 @@ void *sync_start(void *arg)
             unsigned i = ctz(combinedMask);
             assert(MAX_INSTANCE > i);
             combinedMask &= ~(1 << i);
+            // Object::Destroy waits for us to finish with the instance before it unpublishes it,
+            // so hold on to it in the engine; the instance lock is not taken here, as Destroy
+            // holds it while waiting
+            object_lock_exclusive(&this->mObject);
             IObject *instance = (IObject *) this->mEngine.mInstances[i];
+            this->mEngine.mSyncInstance = instance;
+            object_unlock_exclusive(&this->mObject);
             // Could be NULL during construct or destroy
             if (NULL == instance) {
                 continue;
             }
 
-            object_lock_exclusive(instance);
-            unsigned attributesMask = instance->mAttributesMask;
-            instance->mAttributesMask = 0;
+            // the interface lock domains update this without the object lock
+            unsigned attributesMask = __atomic_exchange_n(&instance->mAttributesMask, 0,
+                __ATOMIC_RELAXED);
 
             switch (IObjectToObjectID(instance)) {
             case SL_OBJECTID_AUDIOPLAYER:
                 // do something here
-                object_unlock_exclusive(instance);
 #ifdef USE_SNDFILE
+                // a transport update schedules the decoder too
                 if (attributesMask & (ATTR_POSITION | ATTR_TRANSPORT)) {
-                    CAudioPlayer *audioPlayer = (CAudioPlayer *) instance;
-                    audioPlayerTransportUpdate(audioPlayer);
+                    audioPlayerTransportUpdate((CAudioPlayer *) instance);
+                } else {
+                    SndFile_retry((CAudioPlayer *) instance);
                 }
 #endif
                 break;
 
             default:
-                object_unlock_exclusive(instance);
                 break;
             }
+
+            object_lock_exclusive(&this->mObject);
+            this->mEngine.mSyncInstance = NULL;
+            object_cond_broadcast(&this->mObject);
+            object_unlock_exclusive(&this->mObject);
         }
     }
     return NULL;
@@ -0,0 +1,40 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Support shared by the benchmarks
+
+#include "sles_allinclusive.h"
+#include <time.h>
+#include "common.h"
+
+// The library sources normally get this from sles.c, which a benchmark of the whole library has
+__attribute__((weak)) SLresult err_to_result(int err)
+{
+    if (EAGAIN == err || ENOMEM == err) {
+        return SL_RESULT_RESOURCE_ERROR;
+    }
+    if (0 != err) {
+        return SL_RESULT_INTERNAL_ERROR;
+    }
+    return SL_RESULT_SUCCESS;
+}
+
+double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Measure the exclusive object lock under contention from 2, 4 and 8 threads, each holding it
+// for a short critical section like a gain copy or a queue pointer update, and the hand-off
+// rate of object_cond_wait between two threads.  Build with and without USE_ADAPTIVE_LOCK,
+// or with USE_LOCK_PROFILE to see the profile of the same run.
+
+#include "sles_allinclusive.h"
+#include "common.h"
+
+static IObject object;
+static struct {
+    unsigned mFront, mRear, mCount;
+    float mGains[2];
+} fields;           // stand-ins for the fields of a short critical section
+static int stop;
+
+static void *locker(void *context)
+{
+    unsigned long *pCount = (unsigned long *) context;
+    unsigned long count = 0;
+    volatile unsigned work = 0;
+    while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+        object_lock_exclusive(&object);
+        fields.mFront = (fields.mFront + 1) & 15;
+        fields.mRear = (fields.mRear + 1) & 15;
+        ++fields.mCount;
+        fields.mGains[0] = fields.mGains[1] * 0.5f;
+        fields.mGains[1] = fields.mGains[0] + 0.25f;
+        object_unlock_exclusive(&object);
+        // some work outside the lock, as a caller would do between calls
+        unsigned i;
+        for (i = 0; i < 50; ++i) {
+            work += i;
+        }
+        ++count;
+    }
+    *pCount = count;
+    return NULL;
+}
+
+static void contend(unsigned threads, double seconds)
+{
+    pthread_t thread[8];
+    unsigned long counts[8];
+    assert(threads <= 8);
+    __atomic_store_n(&stop, 0, __ATOMIC_RELAXED);
+    fields.mCount = 0;
+    double start = now();
+    unsigned i;
+    for (i = 0; i < threads; ++i) {
+        int ok = pthread_create(&thread[i], NULL, locker, &counts[i]);
+        assert(0 == ok);
+    }
+    usleep((useconds_t) (seconds * 1000000.0));
+    __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+    unsigned long total = 0;
+    for (i = 0; i < threads; ++i) {
+        (void) pthread_join(thread[i], NULL);
+        total += counts[i];
+    }
+    seconds = now() - start;
+    // every critical section ran under the lock, so no increment was lost
+    assert(total == fields.mCount);
+    printf("%u threads: %10.0f locks/s\n", threads, total / seconds);
+}
+
+static unsigned turn;       // whose turn it is, 0 or 1, guarded by the object lock
+static unsigned long handoffs;
+
+static void *ponger(void *context)
+{
+    unsigned me = (unsigned) (uintptr_t) context;
+    object_lock_exclusive(&object);
+    for (;;) {
+        while (turn != me && !stop) {
+            object_cond_wait(&object);
+        }
+        if (stop) {
+            break;
+        }
+        turn = !me;
+        ++handoffs;
+        object_cond_broadcast(&object);
+    }
+    object_unlock_exclusive(&object);
+    return NULL;
+}
+
+static void pingpong(double seconds)
+{
+    pthread_t thread[2];
+    stop = 0;
+    turn = 0;
+    handoffs = 0;
+    double start = now();
+    unsigned i;
+    for (i = 0; i < 2; ++i) {
+        int ok = pthread_create(&thread[i], NULL, ponger, (void *) (uintptr_t) i);
+        assert(0 == ok);
+    }
+    usleep((useconds_t) (seconds * 1000000.0));
+    object_lock_exclusive(&object);
+    stop = 1;
+    object_cond_broadcast(&object);
+    object_unlock_exclusive(&object);
+    for (i = 0; i < 2; ++i) {
+        (void) pthread_join(thread[i], NULL);
+    }
+    seconds = now() - start;
+    printf("cond_wait: %10.0f hand-offs/s\n", handoffs / seconds);
+}
+
+int main(int argc, char **argv)
+{
+    double seconds = argc > 1 ? atof(argv[1]) : 1.0;
+    object_init_locks(&object);
+#ifdef USE_ADAPTIVE_LOCK
+    printf("adaptive lock\n");
+#else
+    printf("pthread lock\n");
+#endif
+    static const unsigned threadCounts[] = {2, 4, 8};
+    unsigned i;
+    for (i = 0; i < sizeof(threadCounts) / sizeof(threadCounts[0]); ++i) {
+        contend(threadCounts[i], seconds);
+    }
+    pingpong(seconds);
+#ifdef USE_LOCK_PROFILE
+    lock_profile_dump(SL_BOOLEAN_FALSE);
+#endif
+    return EXIT_SUCCESS;
+}
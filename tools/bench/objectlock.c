@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Measure getter throughput on one object while a writer keeps updating it, with the getters
+// taking the shared lock, or the exclusive lock as they did before shared locks existed
+
+#include "sles_allinclusive.h"
+#include "common.h"
+
+static IObject object;
+static SLuint32 field1, field2;    // stand-ins for the fields a getter copies, sum always 0
+static int stop;
+static SLboolean shared;
+
+static void *reader(void *context)
+{
+    unsigned long *pCount = (unsigned long *) context;
+    unsigned long count = 0;
+    while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+        if (shared) {
+            object_lock_shared(&object);
+        } else {
+            object_lock_exclusive(&object);
+        }
+        SLuint32 sum = field1 + field2;
+        if (shared) {
+            object_unlock_shared(&object);
+        } else {
+            object_unlock_exclusive(&object);
+        }
+        // the writer changes both fields under the exclusive lock, so a reader never sees one
+        // without the other
+        assert(0 == sum);
+        ++count;
+    }
+    *pCount = count;
+    return NULL;
+}
+
+static void *writer(void *context)
+{
+    unsigned long *pCount = (unsigned long *) context;
+    unsigned long count = 0;
+    while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+        object_lock_exclusive(&object);
+        ++field1;
+        --field2;
+        object_unlock_exclusive(&object);
+        ++count;
+        usleep(100);
+    }
+    *pCount = count;
+    return NULL;
+}
+
+static void run(unsigned readers, double seconds)
+{
+    pthread_t threads[readers + 1];
+    unsigned long counts[readers + 1];
+    __atomic_store_n(&stop, 0, __ATOMIC_RELAXED);
+    unsigned i;
+    for (i = 0; i <= readers; ++i) {
+        pthread_create(&threads[i], NULL, i < readers ? reader : writer, &counts[i]);
+    }
+    usleep((useconds_t) (seconds * 1e6));
+    __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+    unsigned long total = 0;
+    for (i = 0; i <= readers; ++i) {
+        pthread_join(threads[i], NULL);
+        if (i < readers)
+            total += counts[i];
+    }
+    printf("%-9s %u readers: %10.0f gets/s, writer %6.0f sets/s\n",
+        shared ? "shared" : "exclusive", readers, total / seconds, counts[readers] / seconds);
+}
+
+int main(int argc, char **argv)
+{
+    double seconds = argc > 1 ? atof(argv[1]) : 1.0;
+    object_init_locks(&object);
+    static const unsigned readerCounts[] = {1, 2, 4};
+    unsigned i;
+    for (i = 0; i < sizeof(readerCounts) / sizeof(readerCounts[0]); ++i) {
+        shared = SL_BOOLEAN_FALSE;
+        run(readerCounts[i], seconds);
+        shared = SL_BOOLEAN_TRUE;
+        run(readerCounts[i], seconds);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Measure how long latency-critical closures wait behind a burst of slow background closures
+
+#include "sles_allinclusive.h"
+#include <time.h>
+#include "common.h"
+
+#define BACKGROUND 64           // number of slow background closures
+#define BACKGROUND_MS 2         // how long each of them takes
+#define STREAMING 20            // number of streaming closures, one per millisecond
+
+static ThreadPool pool;
+static double added[STREAMING];
+static double latency[STREAMING];
+static unsigned done;
+
+static void finished(void)
+{
+    __atomic_add_fetch(&done, 1, __ATOMIC_SEQ_CST);
+}
+
+static void background(void *context, int parameter)
+{
+    struct timespec ts = {0, BACKGROUND_MS * 1000000};
+    nanosleep(&ts, NULL);
+    finished();
+}
+
+static void streaming(void *context, int parameter)
+{
+    latency[parameter] = now() - added[parameter];
+    finished();
+}
+
+// Run one configuration: the priority class of the streaming closures and the reservations
+static void run(const char *name, unsigned priority, const unsigned *reserved)
+{
+    SLresult result = ThreadPool_init(&pool, BACKGROUND + STREAMING, 0, reserved);
+    assert(SL_RESULT_SUCCESS == result);
+    done = 0;
+    unsigned i;
+    for (i = 0; i < BACKGROUND; ++i) {
+        result = ThreadPool_add(&pool, background, NULL, i);
+        assert(SL_RESULT_SUCCESS == result);
+    }
+    for (i = 0; i < STREAMING; ++i) {
+        struct timespec ts = {0, 1000000};
+        nanosleep(&ts, NULL);
+        added[i] = now();
+        result = ThreadPool_addPriority(&pool, priority, streaming, NULL, i);
+        assert(SL_RESULT_SUCCESS == result);
+    }
+    while (__atomic_load_n(&done, __ATOMIC_SEQ_CST) < BACKGROUND + STREAMING) {
+        struct timespec ts = {0, 1000000};
+        nanosleep(&ts, NULL);
+    }
+    ThreadPool_deinit(&pool);
+    double sum = 0.0, max = 0.0;
+    for (i = 0; i < STREAMING; ++i) {
+        sum += latency[i];
+        if (latency[i] > max)
+            max = latency[i];
+    }
+    printf("%-9s streaming latency: mean %7.3f ms, max %7.3f ms\n", name,
+        sum * 1e3 / STREAMING, max * 1e3);
+}
+
+int main(int argc, char **argv)
+{
+    static const unsigned reserved[THREADPOOL_PRIORITIES] = {1, 0};
+    run("fifo", THREADPOOL_PRIORITY_BACKGROUND, NULL);
+    run("lanes", THREADPOOL_PRIORITY_STREAMING, NULL);
+    run("reserved", THREADPOOL_PRIORITY_STREAMING, reserved);
+    return EXIT_SUCCESS;
+}
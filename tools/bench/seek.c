@@ -0,0 +1,227 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Measure the seek-to-audible latency of URI players: the time from Seek::SetPosition until the
+// mixer first outputs audio from the new position, with 1, 8 and 24 players streaming and all of
+// them seeking at once.  The file is silent but for a marked region at its end, and in each trial
+// one player seeks into the marked region while the others seek elsewhere in the silence, so the
+// first mixer buffer that is not silent is that seek becoming audible.  The file is at 48 kHz, so
+// it is streamed and resampled rather than played from memory.  This builds the whole library,
+// with a mixer thread paced like the Vita audio port in place of Vita.c.
+
+#include "sles_allinclusive.h"
+#include "common.h"
+
+int _opensles_user_freq = 44100;
+
+#define PATH    "/tmp/seekbench.wav"
+#define RATE    48000
+#define SECONDS 20          // length of the file
+#define MARK    16          // second at which the marked region starts
+#define TRIALS  100
+
+static IEngine *mixEngine;
+static pthread_t mixThread;
+static int mixStop;
+static int armed;           // set by a trial, cleared by the mixer when it outputs audio
+static double audible;      // when the mixer cleared armed
+static int silent;          // the last mixer buffer was silent
+
+// Stand-in for the Vita audio thread, which blocks on the audio port for each buffer
+static void *mixer(void *arg)
+{
+    static short stream[SndFile_BUFSIZE];
+    double period = (double) (SndFile_BUFSIZE / STEREO_CHANNELS) / _opensles_user_freq;
+    double next = now();
+    while (!__atomic_load_n(&mixStop, __ATOMIC_RELAXED)) {
+        memset(stream, 0, sizeof(stream));
+        interface_lock_shared(mixEngine);
+        COutputMix *outputMix = mixEngine->mOutputMix;
+        interface_unlock_shared(mixEngine);
+        if (NULL != outputMix) {
+            IOutputMixExt_FillBuffer(&outputMix->mOutputMixExt.mItf, stream, sizeof(stream));
+        }
+        unsigned i;
+        for (i = 0; i < SndFile_BUFSIZE && 0 == stream[i]; ++i)
+            ;
+        __atomic_store_n(&silent, SndFile_BUFSIZE == i, __ATOMIC_RELEASE);
+        if (SndFile_BUFSIZE != i && __atomic_load_n(&armed, __ATOMIC_ACQUIRE)) {
+            audible = now();
+            __atomic_store_n(&armed, 0, __ATOMIC_RELEASE);
+        }
+        next += period;
+        double wait = next - now();
+        if (wait > 0) {
+            usleep((useconds_t) (wait * 1000000.0));
+        }
+    }
+    return NULL;
+}
+
+void SDL_open(IEngine *thisEngine)
+{
+    mixEngine = thisEngine;
+    __atomic_store_n(&mixStop, 0, __ATOMIC_RELAXED);
+    int ok = pthread_create(&mixThread, NULL, mixer, NULL);
+    assert(0 == ok);
+}
+
+// like Vita.c, the thread is not joined, as the engine is locked here
+void SDL_close(void)
+{
+    __atomic_store_n(&mixStop, 1, __ATOMIC_RELAXED);
+    (void) pthread_detach(mixThread);
+}
+
+static void writeFile(void)
+{
+    FILE *f = fopen(PATH, "wb");
+    assert(NULL != f);
+    SLuint32 frames = RATE * SECONDS, bytes = frames * STEREO_CHANNELS * sizeof(short);
+    SLuint32 byteRate = RATE * STEREO_CHANNELS * sizeof(short), rate = RATE;
+    unsigned char header[44] = "RIFF\0\0\0\0WAVEfmt \x10\0\0\0\x01\0\x02\0";
+    memcpy(&header[24], &rate, 4);
+    memcpy(&header[28], &byteRate, 4);
+    header[32] = STEREO_CHANNELS * sizeof(short);
+    header[34] = 16;
+    memcpy(&header[36], "data", 4);
+    memcpy(&header[40], &bytes, 4);
+    fwrite(header, 1, sizeof(header), f);
+    static short block[RATE * STEREO_CHANNELS];
+    unsigned second;
+    for (second = 0; second < SECONDS; ++second) {
+        short value = second < MARK ? 0 : 8192;
+        unsigned i;
+        for (i = 0; i < RATE * STEREO_CHANNELS; ++i) {
+            block[i] = value;
+        }
+        fwrite(block, sizeof(short), RATE * STEREO_CHANNELS, f);
+    }
+    fclose(f);
+}
+
+static int compare(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+    return x < y ? -1 : x > y;
+}
+
+static void waitSilent(void)
+{
+    double start = now();
+    // a buffer after the seeks, then a silent one
+    usleep(20000);
+    while (!__atomic_load_n(&silent, __ATOMIC_ACQUIRE) && now() - start < 1.0) {
+        usleep(1000);
+    }
+}
+
+static void run(SLEngineItf engineEngine, SLObjectItf outputMixObject, unsigned players)
+{
+    SLObjectItf objects[MAX_INSTANCE];
+    SLSeekItf seeks[MAX_INSTANCE];
+    SLDataLocator_URI locator = {SL_DATALOCATOR_URI, (SLchar *) PATH};
+    SLDataFormat_MIME format = {SL_DATAFORMAT_MIME, NULL, SL_CONTAINERTYPE_UNSPECIFIED};
+    SLDataSource source = {&locator, &format};
+    SLDataLocator_OutputMix locatorOutputMix = {SL_DATALOCATOR_OUTPUTMIX, outputMixObject};
+    SLDataSink sink = {&locatorOutputMix, NULL};
+    const SLInterfaceID ids[1] = {SL_IID_SEEK};
+    const SLboolean req[1] = {SL_BOOLEAN_TRUE};
+    SLresult result;
+    unsigned i;
+    for (i = 0; i < players; ++i) {
+        result = (*engineEngine)->CreateAudioPlayer(engineEngine, &objects[i], &source, &sink,
+            1, ids, req);
+        assert(SL_RESULT_SUCCESS == result);
+        result = (*objects[i])->Realize(objects[i], SL_BOOLEAN_FALSE);
+        assert(SL_RESULT_SUCCESS == result);
+        result = (*objects[i])->GetInterface(objects[i], SL_IID_SEEK, &seeks[i]);
+        assert(SL_RESULT_SUCCESS == result);
+        SLPlayItf play;
+        result = (*objects[i])->GetInterface(objects[i], SL_IID_PLAY, &play);
+        assert(SL_RESULT_SUCCESS == result);
+        result = (*play)->SetPlayState(play, SL_PLAYSTATE_PLAYING);
+        assert(SL_RESULT_SUCCESS == result);
+    }
+    waitSilent();
+    double latencies[TRIALS];
+    unsigned trials = 0, lost = 0, trial;
+    for (trial = 0; trial < TRIALS; ++trial) {
+        unsigned marked = trial % players;
+        // the others seek first, so their seeks are in flight with the marked one
+        for (i = 0; i < players; ++i) {
+            if (i != marked) {
+                (*seeks[i])->SetPosition(seeks[i], rand() % ((MARK - 4) * 1000),
+                    SL_SEEKMODE_ACCURATE);
+            }
+        }
+        __atomic_store_n(&armed, 1, __ATOMIC_RELEASE);
+        double start = now();
+        (*seeks[marked])->SetPosition(seeks[marked], MARK * 1000 + 100 + rand() % 2000,
+            SL_SEEKMODE_ACCURATE);
+        while (__atomic_load_n(&armed, __ATOMIC_ACQUIRE) && now() - start < 1.0) {
+            usleep(100);
+        }
+        if (__atomic_exchange_n(&armed, 0, __ATOMIC_ACQ_REL)) {
+            ++lost;
+        } else {
+            latencies[trials++] = (audible - start) * 1000.0;
+        }
+        (*seeks[marked])->SetPosition(seeks[marked], rand() % ((MARK - 4) * 1000),
+            SL_SEEKMODE_ACCURATE);
+        waitSilent();
+    }
+    for (i = 0; i < players; ++i) {
+        (*objects[i])->Destroy(objects[i]);
+    }
+    qsort(latencies, trials, sizeof(double), compare);
+    if (0 < trials) {
+        printf("%2u players: seek to audible min %6.1f median %6.1f p95 %6.1f max %6.1f ms",
+            players, latencies[0], latencies[trials / 2], latencies[trials * 95 / 100],
+            latencies[trials - 1]);
+    } else {
+        printf("%2u players:", players);
+    }
+    printf(lost ? ", %u not audible within 1 s\n" : "\n", lost);
+}
+
+int main(int argc, char **argv)
+{
+    writeFile();
+    // without the asset cache every player streams the file on its own
+    SLEngineOption options[] = {{SL_VITA_ENGINEOPTION_ASSETCACHEBYTES, 0}};
+    SLObjectItf engineObject, outputMixObject;
+    SLEngineItf engineEngine;
+    SLresult result = slCreateEngine(&engineObject, 1, options, 0, NULL, NULL);
+    assert(SL_RESULT_SUCCESS == result);
+    result = (*engineObject)->Realize(engineObject, SL_BOOLEAN_FALSE);
+    assert(SL_RESULT_SUCCESS == result);
+    result = (*engineObject)->GetInterface(engineObject, SL_IID_ENGINE, &engineEngine);
+    assert(SL_RESULT_SUCCESS == result);
+    result = (*engineEngine)->CreateOutputMix(engineEngine, &outputMixObject, 0, NULL, NULL);
+    assert(SL_RESULT_SUCCESS == result);
+    result = (*outputMixObject)->Realize(outputMixObject, SL_BOOLEAN_FALSE);
+    assert(SL_RESULT_SUCCESS == result);
+    static const unsigned playerCounts[] = {1, 8, 24};
+    unsigned i;
+    for (i = 0; i < sizeof(playerCounts) / sizeof(playerCounts[0]); ++i) {
+        run(engineEngine, outputMixObject, playerCounts[i]);
+    }
+    (*outputMixObject)->Destroy(outputMixObject);
+    (*engineObject)->Destroy(engineObject);
+    unlink(PATH);
+    return EXIT_SUCCESS;
+}
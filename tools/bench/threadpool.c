@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2010 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Measure ThreadPool_add and ThreadPool_remove throughput
+// With a fan-out, each closure added by a client adds that many more closures from the worker
+
+#include "sles_allinclusive.h"
+#include "common.h"
+
+static ThreadPool pool;
+static unsigned perClient;
+static unsigned fanout;
+static pthread_mutex_t doneMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t doneCond = PTHREAD_COND_INITIALIZER;
+static unsigned done;
+
+static void handler(void *context, int parameter)
+{
+    if (NULL != context) {
+        unsigned i;
+        for (i = 0; i < fanout; ++i) {
+            SLresult result = ThreadPool_add(&pool, handler, NULL, parameter);
+            assert(SL_RESULT_SUCCESS == result);
+        }
+    }
+    if (__atomic_add_fetch(&done, 1, __ATOMIC_SEQ_CST) == (unsigned) parameter) {
+        pthread_mutex_lock(&doneMutex);
+        pthread_cond_signal(&doneCond);
+        pthread_mutex_unlock(&doneMutex);
+    }
+}
+
+static void *client(void *context)
+{
+    int total = (int) (size_t) context;
+    unsigned i;
+    for (i = 0; i < perClient; ++i) {
+        SLresult result = ThreadPool_add(&pool, handler, &pool, total);
+        assert(SL_RESULT_SUCCESS == result);
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned closures = argc > 1 ? atoi(argv[1]) : 1000000;
+    unsigned clients = argc > 2 ? atoi(argv[2]) : 4;
+    fanout = argc > 3 ? atoi(argv[3]) : 0;
+    if (0 == clients || closures < clients * (fanout + 1)) {
+        fprintf(stderr, "usage: %s [closures] [clients] [fanout]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    perClient = closures / (clients * (fanout + 1));
+    unsigned total = perClient * clients * (fanout + 1);
+    double start = now();
+    SLresult result = ThreadPool_init(&pool, 0, 0, NULL);
+    assert(SL_RESULT_SUCCESS == result);
+    printf("ThreadPool_init: %.1f us\n", (now() - start) * 1e6);
+    pthread_t threads[clients];
+    start = now();
+    unsigned i;
+    for (i = 0; i < clients; ++i) {
+        pthread_create(&threads[i], NULL, client, (void *) (size_t) total);
+    }
+    for (i = 0; i < clients; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    pthread_mutex_lock(&doneMutex);
+    while (__atomic_load_n(&done, __ATOMIC_SEQ_CST) < total) {
+        pthread_cond_wait(&doneCond, &doneMutex);
+    }
+    pthread_mutex_unlock(&doneMutex);
+    double elapsed = now() - start;
+    ThreadPool_deinit(&pool);
+    printf("%u closures, %u clients, fan-out %u, %u workers: %.3f s, %.0f ns per closure\n",
+        total, clients, fanout, THREAD_TYPICAL, elapsed, elapsed * 1e9 / total);
+    return EXIT_SUCCESS;
+}